@@ -74,6 +74,37 @@ int main () {
       return -1;
     }
   }
+
+  // Build replaces the contents, including anything inserted.
+  for (int i = 0; i < 10; i++) {
+    heap.Insert(values[i].i, &values[i]);
+  }
+  vector<Heap<uint64, TestValue>::Cell> cells;
+  for (int i = values.size() / 2; i < values.size(); i++) {
+    cells.push_back({values[i].i, &values[i]});
+  }
+  heap.Build(std::move(cells));
+  if (heap.Size() != values.size() - values.size() / 2) {
+    printf("FAIL: Wrong size %d after Build\n", heap.Size());
+    return -1;
+  }
+  for (int i = 0; i < values.size(); i++) {
+    if ((i < values.size() / 2) != (values[i].location == -1)) {
+      printf("FAIL (C)! %d has location %d after Build\n",
+             i, values[i].location);
+      return -1;
+    }
+  }
+
+  last = heap.PopMinimumValue();
+  while (!heap.Empty()) {
+    TestValue *now = heap.PopMinimumValue();
+    if (now->i < last->i) {
+      printf("FAIL (D): %llu %llu\n", last->i, now->i);
+      return -1;
+    }
+    last = now;
+  }
   
   printf("OK\n");
   return 0;
@@ -0,0 +1,50 @@
+
+#include "aot-runtime.h"
+
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+#include "fceu.h"
+#include "utils/crc32.h"
+
+using namespace std;
+
+namespace {
+struct Registry {
+  std::mutex m;
+  vector<const AOTGame *> games;
+};
+}  // namespace
+
+// Constructed on first use, since registration happens during
+// static initialization in other translation units.
+static Registry *GetRegistry() {
+  static Registry *registry = new Registry;
+  return registry;
+}
+
+AOTRegistration::AOTRegistration(const AOTGame *game) {
+  Registry *registry = GetRegistry();
+  std::lock_guard<std::mutex> ml(registry->m);
+  registry->games.push_back(game);
+}
+
+const AOTGame *FindAOTGame(const uint8 *md5) {
+  Registry *registry = GetRegistry();
+  std::lock_guard<std::mutex> ml(registry->m);
+  for (const AOTGame *game : registry->games)
+    if (0 == memcmp(game->md5, md5, sizeof game->md5))
+      return game;
+  return nullptr;
+}
+
+uint32 AOTCodeCRC32(FC *fc, uint32 code_start, uint32 code_past_end) {
+  // Read through the handlers (like the compiler does) rather than
+  // peeking at cart pages, since this is only done occasionally.
+  vector<uint8> code;
+  code.reserve(code_past_end - code_start);
+  for (uint32 addr = code_start; addr < code_past_end; addr++)
+    code.push_back(fc->fceu->ARead[addr](fc, addr));
+  return CalcCRC32(0, code.data(), code.size());
+}
@@ -0,0 +1,46 @@
+/*
+  Runtime support for ahead-of-time compiled 6502 code.
+
+  aot.exe translates the code for a particular game into C++. The
+  generated dispatcher file describes the game with an AOTGame and
+  registers it at static initialization time, so linking in the
+  generated objects is enough to make it available. Emulator::SetAOT
+  then looks for a compiled game matching the loaded cartridge.
+*/
+
+#ifndef __AOT_RUNTIME_H
+#define __AOT_RUNTIME_H
+
+#include "types.h"
+#include "fc.h"
+
+struct AOTGame {
+  // Symbol that prefixes the generated code, like "mario".
+  const char *name;
+  // MD5 of the cartridge it was compiled from, as in FCEUGI::MD5.
+  uint8 md5[16];
+  // The code in [code_start, code_past_end) was compiled under the
+  // assumption that it doesn't change. code_crc32 is of those bytes
+  // as mapped at compile time.
+  uint32 code_start;
+  uint32 code_past_end;
+  uint32 code_crc32;
+  // Same contract as X6502::Run. Addresses that weren't compiled
+  // (e.g. because they were never executed while profiling) fall
+  // back to the interpreter.
+  void (*run)(FC *fc, int32 cycles);
+};
+
+// Generated code creates a static instance of this.
+struct AOTRegistration {
+  explicit AOTRegistration(const AOTGame *game);
+};
+
+// Returns the compiled game for the cartridge with this MD5, or
+// nullptr if none was linked in.
+const AOTGame *FindAOTGame(const uint8 *md5);
+
+// Compute the CRC32 of the code range as currently mapped.
+uint32 AOTCodeCRC32(FC *fc, uint32 code_start, uint32 code_past_end);
+
+#endif
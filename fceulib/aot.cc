@@ -37,9 +37,11 @@
 #include "test-util.h"
 #include "base/stringprintf.h"
 #include "threadutil.h"
+#include "simplefm2.h"
 
 #include "x6502.h"
 #include "cart.h"
+#include "aot-runtime.h"
 
 #include <mutex>
 #include <thread>
@@ -2847,8 +2849,11 @@ struct AOT {
 	fprintf(f, I "// %04x = %02x\n", pc_addr, b1);
 
 	// PERF: Similarly, good to avoid testing this over and over.
-	// Mappers can trigger interrupt, as can sound.
-	fprintf(f, I "if (" LOCAL_IRQLOW ") {\n");
+	// Mappers can trigger interrupt, as can sound. A mapper write
+	// can also swap out the bank this code was compiled from
+	// (X6502::aot_stale), in which case the interpreter finishes
+	// the slice.
+	fprintf(f, I "if (" LOCAL_IRQLOW " || X->aot_stale) {\n");
 	FlushLocals(f, ~0);
 	fprintf (f, I "%s_any(fc); return; }\n",
 		 symbol.c_str());
@@ -2948,9 +2953,12 @@ struct AOT {
   int64 next_symbol = 0;
 };
 
-// Returns the files written (without .cc extension).
+// Returns the files written (without .cc extension). entries are
+// the addresses to generate entry points for, in ascending order; they
+// must all be in [addr_start, addr_past_end).
 static vector<string> GenerateCode(const CodeConfig &config,
 				   const Code &code,
+				   const vector<uint32> &entries,
 				   uint32 addr_start,
 				   uint32 addr_past_end,
 				   const string &symbol,
@@ -2970,17 +2978,16 @@ static vector<string> GenerateCode(const CodeConfig &config,
   // (RunLoop), which is of course fully general. So our goal here is
   // to find cases that are very common and optimize those.
 
-  vector<int> start_addrs;
-  for (int i = addr_start;
-       i < addr_past_end;
-       i += config.entrypoints_per_file) {
-    start_addrs.push_back(i);
+  // Indices into entries that start each file.
+  vector<int> start_idxs;
+  for (int i = 0; i < entries.size(); i += config.entrypoints_per_file) {
+    start_idxs.push_back(i);
   }
 
   std::mutex ret_m;
   vector<string> ret;
   
-  auto F = [&config, &code, addr_start, addr_past_end, &symbol, &cart_name,
+  auto F = [&config, &code, &entries, addr_past_end, &symbol, &cart_name,
 	    &ret_m, &ret](int i) {
     AOT aot;
     string filebase = StringPrintf("%s_%d", symbol.c_str(), i);
@@ -3011,10 +3018,10 @@ static vector<string> GenerateCode(const CodeConfig &config,
 	    symbol.c_str());
 
     // Then, a function for each address entry point.
-    for (uint32 j = i;
-	 j < addr_past_end && j < i + config.entrypoints_per_file;
+    for (int j = i;
+	 j < entries.size() && j < i + config.entrypoints_per_file;
 	 j++) {
-      aot.GenerateEntry(config, code, j, addr_past_end, symbol, f);      
+      aot.GenerateEntry(config, code, entries[j], addr_past_end, symbol, f);
     }
 
     fclose(f);
@@ -3025,15 +3032,19 @@ static vector<string> GenerateCode(const CodeConfig &config,
     }
   };
   
-  ParallelApp(start_addrs, F, 16);
+  ParallelApp(start_idxs, F, 16);
   return ret;
 }
 
-// One of these per compiled file. It does the per-Run setup and
-// coordinates control transfer between the chunks.
+// One of these per compiled game. It does the per-Run setup and
+// coordinates control transfer between the chunks. It also registers
+// the game so that Emulator::SetAOT can find it.
 static void GenerateDispatcher(const CodeConfig &config,
+			       const vector<uint32> &entries,
 			       uint32 addr_start,
 			       uint32 addr_past_end,
+			       const uint8 *md5,
+			       uint32 code_crc32,
 			       const string &symbol,
 			       const string &filename) {
   FILE *f = fopen(filename.c_str(), "w");
@@ -3043,10 +3054,13 @@ static void GenerateDispatcher(const CodeConfig &config,
 	  "#include <cstdint>\n"
 	  "#include \"x6502.h\"\n"
 	  "#include \"fc.h\"\n"
-	  "#include \"fceu.h\"\n\n");
+	  "#include \"fceu.h\"\n"
+	  "#include \"aot-runtime.h\"\n\n");
   
   // Avoid needing a header file; just generate the externs here.
-  for (int i = addr_start; i < addr_past_end; i++) {
+  vector<bool> compiled(0x10000, false);
+  for (uint32 i : entries) {
+    compiled[i] = true;
     fprintf(f, "void %s_%04x(FC *);\n", symbol.c_str(), i);
   }
 
@@ -3057,7 +3071,7 @@ static void GenerateDispatcher(const CodeConfig &config,
   
   fprintf(f, "static void (*entries[0x10000])(FC *fc) = {\n");
   for (int i = 0; i < 0x10000; i++) {
-    if (i < addr_start || i >= addr_past_end)
+    if (!compiled[i])
       fprintf(f, "  &%s_any,\n", symbol.c_str());
     else
       fprintf(f, "  &%s_%04x,\n", symbol.c_str(), i);
@@ -3078,6 +3092,11 @@ static void GenerateDispatcher(const CodeConfig &config,
   fprintf(f, "  X->count += cycles;\n");
 
   fprintf(f, "  while (X->count > 0) {\n");
+  // The cartridge remapped compiled code; see X6502::aot_stale.
+  fprintf(f, "    if (X->aot_stale) {\n"
+	  "      X->RunLoop();\n"
+	  "      return;\n"
+	  "    }\n");
   fprintf(f, "    const uint16 pc = X->reg_PC;\n");
   fprintf(f, "    void (*const entry)(FC *) = entries[pc];\n");
   fprintf(f, "    (*entry)(fc);\n");
@@ -3085,6 +3104,19 @@ static void GenerateDispatcher(const CodeConfig &config,
 
   fprintf(f, "}  // Dispatcher.\n\n\n");
 
+  fprintf(f, "static const AOTGame %s_game = {\n"
+	  "  \"%s\",\n"
+	  "  {", symbol.c_str(), symbol.c_str());
+  for (int i = 0; i < 16; i++)
+    fprintf(f, "%s0x%02x", i ? ", " : "", md5[i]);
+  fprintf(f, "},\n"
+	  "  0x%04x, 0x%05x, 0x%08x,\n"
+	  "  &%s_Run,\n"
+	  "};\n"
+	  "static AOTRegistration %s_registration(&%s_game);\n",
+	  addr_start, addr_past_end, code_crc32,
+	  symbol.c_str(), symbol.c_str(), symbol.c_str());
+
   fprintf(stderr, "Wrote %s.\n", filename.c_str());
   fclose(f);
 }
@@ -3124,33 +3156,132 @@ RomConfig ContraROM() {
   return rom;
 }
 
+static void Usage() {
+  printf("Usage: aot.exe game [--romdir dir] [--movie file.fm2]\n"
+	 "   or: aot.exe --rom file.nes --symbol name --start hex --end hex\n"
+	 "               [--effectless-reads] [--entries-per-file n]\n"
+	 "               [--movie file.fm2]\n"
+	 "\n"
+	 "game is one of the ROMs documented inside aot.cc (mario, contra).\n"
+	 "--end is one past the last address to compile. With --movie, the\n"
+	 "movie is played first, and only addresses that the CPU executed\n"
+	 "get compiled entry points; the rest use the interpreter. This\n"
+	 "produces much less code.\n"
+	 "\n"
+	 "Writes symbol.cc, symbol_N.cc, and symbol.makefile. Link them in\n"
+	 "with make AOT_GAMES=symbol and enable with Emulator::SetAOT.\n");
+}
+
 int main(int argc, char **argv) {
   string romdir = "roms/";
+  string game, movie;
+  RomConfig rom;
+  bool custom = false;
+
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    auto Next = [argc, argv, &i, &arg]() -> string {
+      if (i + 1 >= argc) {
+	fprintf(stderr, "%s needs an argument.\n", arg.c_str());
+	exit(-1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--romdir") {
+      romdir = Next() + "/";
+    } else if (arg == "--movie") {
+      movie = Next();
+    } else if (arg == "--rom") {
+      rom.file = Next();
+      custom = true;
+    } else if (arg == "--symbol") {
+      game = Next();
+    } else if (arg == "--start") {
+      rom.code_addr_start = strtol(Next().c_str(), nullptr, 16);
+    } else if (arg == "--end") {
+      rom.code_addr_after_end = strtol(Next().c_str(), nullptr, 16);
+    } else if (arg == "--effectless-reads") {
+      rom.effectless_read_8000_ffff = true;
+    } else if (arg == "--entries-per-file") {
+      rom.entrypoints_per_file = atoi(Next().c_str());
+    } else if (!arg.empty() && arg[0] != '-' && game.empty()) {
+      game = arg;
+    } else {
+      Usage();
+      return -1;
+    }
+  }
 
-  if (argc != 2) {
-    printf("Give the name of a game (no extension) on the command-line; "
-	   "it must have already been documented inside aot.cc.\n");
+  if (game.empty()) {
+    Usage();
     return -1;
   }
 
-  string game = argv[1];
-  RomConfig rom;
-  if (game == "mario") {
+  string romfile;
+  if (custom) {
+    if (rom.code_addr_start < 0 ||
+	rom.code_addr_after_end <= rom.code_addr_start ||
+	rom.code_addr_after_end > 0x10000 ||
+	rom.entrypoints_per_file <= 0) {
+      Usage();
+      return -1;
+    }
+    romfile = rom.file;
+  } else if (game == "mario") {
     rom = MarioROM();
+    romfile = romdir + rom.file;
   } else if (game == "contra") {
     rom = ContraROM();
+    romfile = romdir + rom.file;
   } else {
-    printf("Unknown game %s. You have to put some constants in aot.cc.\n",
+    printf("Unknown game %s. Use --rom, or put some constants in aot.cc.\n",
 	   game.c_str());
     return -1;
   }
   
-  std::unique_ptr<Emulator> emu(Emulator::Create(romdir + "/" + rom.file));
+  std::unique_ptr<Emulator> emu(Emulator::Create(romfile));
+  CHECK(emu.get() != nullptr) << romfile;
 
   Timer compile_timer;
 
   FC *fc = emu->GetFC();
 
+  // Which addresses get entry points. Without a profile, all of them.
+  vector<uint32> entries;
+  if (movie.empty()) {
+    for (uint32 addr = rom.code_addr_start;
+	 addr < rom.code_addr_after_end;
+	 addr++) {
+      entries.push_back(addr);
+    }
+  } else {
+    #ifdef AOT_INSTRUMENTATION
+    const vector<pair<uint8, uint8>> inputs =
+      SimpleFM2::ReadInputs2P(movie);
+    CHECK(!inputs.empty()) << "Empty or missing movie " << movie;
+    for (const pair<uint8, uint8> &input : inputs)
+      emu->Step(input.first, input.second);
+
+    for (uint32 addr = rom.code_addr_start;
+	 addr < rom.code_addr_after_end;
+	 addr++) {
+      if (fc->X->pc_histo[addr] > 0)
+	entries.push_back(addr);
+    }
+    fprintf(stderr, "Profiled %d frames; %d/%d addresses were executed.\n",
+	    (int)inputs.size(), (int)entries.size(),
+	    rom.code_addr_after_end - rom.code_addr_start);
+    #else
+    fprintf(stderr, "Profiling with --movie requires x6502 to be built "
+	    "with AOT_INSTRUMENTATION.\n");
+    return -1;
+    #endif
+
+    // Code generation below assumes the power-on mapping.
+    emu.reset(Emulator::Create(romfile));
+    fc = emu->GetFC();
+  }
+
   // Note that even if an area isn't writable, it's possible that it's
   // unmapped, in which case the read returns the value of the last
   // read (this is usually predictable statically, but definitely
@@ -3166,6 +3297,8 @@ int main(int argc, char **argv) {
     // compile! (Though it does not exercise all cases in the code...)
     // code.code[addr] = addr & 0xFF;
   }
+  const uint32 code_crc32 =
+    AOTCodeCRC32(fc, rom.code_addr_start, rom.code_addr_after_end);
 
   CodeConfig config;
   config.entrypoints_per_file = rom.entrypoints_per_file;
@@ -3174,19 +3307,22 @@ int main(int argc, char **argv) {
   config.effectless_read_8000_ffff = rom.effectless_read_8000_ffff;
 
   vector<string> files =
-    GenerateCode(config, code, rom.code_addr_start, rom.code_addr_after_end,
+    GenerateCode(config, code, entries,
+		 rom.code_addr_start, rom.code_addr_after_end,
 		 game, rom.file);
-  GenerateDispatcher(config, rom.code_addr_start, rom.code_addr_after_end,
+  GenerateDispatcher(config, entries,
+		     rom.code_addr_start, rom.code_addr_after_end,
+		     fc->fceu->GameInfo->MD5.data, code_crc32,
 		     game, game + ".cc");
   files.push_back(game);
 
   {
-    // This just makes it easier to manually build makefiles during
-    // development. XXX do this a better way.
+    // Included by the main makefile for each game in AOT_GAMES.
     FILE *mf = fopen(StringPrintf("%s.makefile", game.c_str()).c_str(),
 		     "w");
     CHECK(mf != nullptr);
-    fprintf(mf, "FCEULIB_GAME_OBJECTS= ");
+    fprintf(mf, "# Generated by aot.exe for %s.\n", rom.file.c_str());
+    fprintf(mf, "GAME_OBJECTS += ");
     for (const string &f : files) {
       fprintf(mf, "%s.o ", f.c_str());
     }
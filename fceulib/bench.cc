@@ -70,13 +70,21 @@ int main(int argc, char **argv) {
   string romdir = "roms/";
   double startup_seconds;
 
+  // Optionally, bench.exe game.nes movie.fm2 runs a different game.
+  // The expected checksums are only for the default.
+  const bool is_default = argc < 3;
+  const string romfile = is_default ? "mario.nes" : argv[1];
+  const string moviefile = is_default ? "mario-long.fm2" : argv[2];
+
   Timer startup_timer;
   // TODO: This is not really fair since it counts all the IO.
-  std::unique_ptr<Emulator> emu(Emulator::Create("mario.nes"));
+  std::unique_ptr<Emulator> emu(Emulator::Create(romfile));
+  CHECK(emu.get() != nullptr) << romfile;
   startup_seconds = startup_timer.GetSeconds();
   vector<uint8> start = emu->SaveUncompressed();
   
-  vector<uint8> movie = SimpleFM2::ReadInputs("mario-long.fm2");
+  vector<uint8> movie = SimpleFM2::ReadInputs(moviefile);
+  CHECK(!movie.empty()) << moviefile;
 
   double exec_seconds = -1.0;
   
@@ -106,7 +114,8 @@ int main(int argc, char **argv) {
       last_means.erase(last_means.begin());
     }
     last_means.push_back(mtrunc);
-    printf("Round %4d in %.4f, mean %.4f\n", executions, sec, mean);
+    printf("Round %4d in %.4f, mean %.4f (%.1f frames/sec)\n",
+           executions, sec, mean, movie.size() / mean);
   }
   
   uint64 ram_checksum = emu->RamChecksum();
@@ -119,8 +128,61 @@ int main(int argc, char **argv) {
 
   fprintf(stderr,
           "Startup time: %.4fs\n"
-          "Exec time:    %.4fs\n",
-          startup_seconds, exec_seconds);
+          "Exec time:    %.4fs\n"
+          "Frames/sec:   %.1f\n",
+          startup_seconds, exec_seconds,
+          movie.size() / exec_seconds);
+
+  if (Emulator::HasPerfCounters()) {
+    // Counted over all the rounds above.
+    const PerfCounters pc = emu->GetPerfCounters();
+    const double frames = std::max(pc.frames, (int64)1);
+    int64 reads = 0, writes = 0;
+    for (int p = 0; p < 256; p++) {
+      reads += pc.handler_reads[p];
+      writes += pc.handler_writes[p];
+    }
+    fprintf(stderr,
+            "Per frame: %.1f instructions, %.1f ppu lines, %.2f irqs, "
+            "%.2f nmis,\n"
+            "  %.1f dma cycles, %.1f mapper cpu hooks, "
+            "%.1f mapper scanline hooks,\n"
+            "  %.1f handler reads, %.1f handler writes\n",
+            pc.instructions / frames, pc.ppu_lines / frames,
+            pc.irqs / frames, pc.nmis / frames, pc.dma_cycles / frames,
+            pc.mapper_cpu_hooks / frames,
+            pc.mapper_scanline_hooks / frames,
+            reads / frames, writes / frames);
+  }
+
+  // Same movie with each combination of outputs. Only the RAM has to
+  // agree, since the image and sound are stale when not produced.
+  {
+    static constexpr Emulator::OutputMask masks[] = {
+      Emulator::OUTPUT_NONE, Emulator::OUTPUT_VIDEO,
+      Emulator::OUTPUT_SOUND, Emulator::OUTPUT_VIDEO_AND_SOUND,
+    };
+    static constexpr const char *mask_names[] = {
+      "none", "video", "sound", "video+sound",
+    };
+    static constexpr int MASK_ROUNDS = 5;
+    fprintf(stderr, "\nBy output mask (best of %d):\n", MASK_ROUNDS);
+    for (int m = 0; m < 4; m++) {
+      double best = -1.0;
+      for (int r = 0; r < MASK_ROUNDS; r++) {
+        emu->LoadUncompressed(start);
+        Timer mask_timer;
+        for (const uint8 input : movie) emu->StepWith(input, masks[m]);
+        const double sec = mask_timer.GetSeconds();
+        CHECK(emu->RamChecksum() == ram_checksum) << mask_names[m];
+        if (best < 0.0 || sec < best) best = sec;
+      }
+      fprintf(stderr, "  %-12s %.4fs  %.1f frames/sec\n",
+              mask_names[m], best, movie.size() / best);
+    }
+  }
+
+  if (!is_default) return 0;
 
   // mario-tom
   // static constexpr uint64 expected_ram = 0xaf57274ece679455ULL;
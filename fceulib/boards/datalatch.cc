@@ -61,6 +61,19 @@ struct DataLatch : public CartInterface {
     WSync();
   }
 
+  // Same, for a cartiface whose dynamic type is exactly M (a final
+  // subclass), so that the WSync call can be resolved and inlined at
+  // compile time. Subclasses install this over LatchWrite in Power.
+  template<class M>
+  static DECLFW(LatchWriteFinal) {
+    M *me = (M*)fc->fceu->cartiface;
+    if (has_bus_conflicts)
+      me->latch = V & fc->cart->ReadPage(A);
+    else
+      me->latch = V;
+    me->WSync();
+  }
+
   void Power() override {
     latch = latch_init;
     WSync();
@@ -149,6 +162,12 @@ namespace {
 struct UNROM final : public DataLatch<true> {
   using DataLatch::DataLatch;
   uint32 mirror_in_use = 0;
+
+  void Power() final override {
+    DataLatch::Power();
+    fc->fceu->SetWriteHandler(addrreg0, addrreg1, LatchWriteFinal<UNROM>);
+  }
+
   void WSync() final override {
     if (fc->cart->PRGsize[0] <= 128 * 1024) {
       fc->cart->setprg16(0x8000, latch & 0x7);
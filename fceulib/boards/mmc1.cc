@@ -62,6 +62,10 @@ struct MMC1 final : public CartInterface {
 
   uint64 lreset = 0ULL;
 
+  // Whether the plain cart handlers are currently installed for WRAM
+  // (-1 if not yet known). Not saved; it's derived from DRegs.
+  int wram_fast = -1;
+
   static DECLFW(MBWRAM) {
     return ((MMC1*)fc->fceu->cartiface)->MBWRAM_Direct(DECLFW_FORWARD);
   }
@@ -106,7 +110,26 @@ struct MMC1 final : public CartInterface {
     }
   }
 
+  // While WRAM is enabled, reading or writing it is the same as the
+  // generic cart handlers, which the CPU can skip entirely (see
+  // FCEU::read_fast). So install those, and only use MAWRAM/MBWRAM
+  // while it is disabled. Games hammer WRAM, but rarely toggle it.
+  void MMC1WRAM() {
+    if (!(mmc1opts & 1)) return;
+    const int enabled = is_155 || !(DRegs[3] & 0x10);
+    if (enabled == wram_fast) return;
+    wram_fast = enabled;
+    if (enabled) {
+      fc->fceu->SetReadHandler(0x6000, 0x7FFF, Cart::CartBR);
+      fc->fceu->SetWriteHandler(0x6000, 0x7FFF, Cart::CartBW);
+    } else {
+      fc->fceu->SetReadHandler(0x6000, 0x7FFF, MAWRAM);
+      fc->fceu->SetWriteHandler(0x6000, 0x7FFF, MBWRAM);
+    }
+  }
+
   void MMC1PRG() {
+    MMC1WRAM();
     uint8 offs = DRegs[1] & 0x10;
     if (is_105) {
       switch (DRegs[0] & 0xC) {
@@ -276,8 +299,8 @@ struct MMC1 final : public CartInterface {
     fc->fceu->SetReadHandler(0x8000, 0xFFFF, Cart::CartBR);
 
     if (mmc1opts & 1) {
-      fc->fceu->SetReadHandler(0x6000, 0x7FFF, MAWRAM);
-      fc->fceu->SetWriteHandler(0x6000, 0x7FFF, MBWRAM);
+      // Handlers are installed by MMC1WRAM.
+      wram_fast = -1;
       fc->cart->setprg8r(0x10, 0x6000, 0);
     }
 
@@ -33,32 +33,42 @@
 // ------------------------- Generic MM3 Code ---------------------------
 // ----------------------------------------------------------------------
 
-void MMC3::FixMMC3PRG(int V) {
+template<class M>
+void MMC3::FixMMC3PRGAs(M *self, int V) {
   if (V & 0x40) {
-    PWrap(0xC000, DRegBuf[6]);
-    PWrap(0x8000, ~1);
+    self->PWrap(0xC000, self->DRegBuf[6]);
+    self->PWrap(0x8000, ~1);
   } else {
-    PWrap(0x8000, DRegBuf[6]);
-    PWrap(0xC000, ~1);
+    self->PWrap(0x8000, self->DRegBuf[6]);
+    self->PWrap(0xC000, ~1);
   }
-  PWrap(0xA000, DRegBuf[7]);
-  PWrap(0xE000, ~0);
+  self->PWrap(0xA000, self->DRegBuf[7]);
+  self->PWrap(0xE000, ~0);
 }
 
-void MMC3::FixMMC3CHR(int V) {
+template<class M>
+void MMC3::FixMMC3CHRAs(M *self, int V) {
   int cbase = (V & 0x80) << 5;
 
-  CWrap((cbase ^ 0x000), DRegBuf[0] & (~1));
-  CWrap((cbase ^ 0x400), DRegBuf[0] | 1);
-  CWrap((cbase ^ 0x800), DRegBuf[1] & (~1));
-  CWrap((cbase ^ 0xC00), DRegBuf[1] | 1);
+  self->CWrap((cbase ^ 0x000), self->DRegBuf[0] & (~1));
+  self->CWrap((cbase ^ 0x400), self->DRegBuf[0] | 1);
+  self->CWrap((cbase ^ 0x800), self->DRegBuf[1] & (~1));
+  self->CWrap((cbase ^ 0xC00), self->DRegBuf[1] | 1);
+
+  self->CWrap(cbase ^ 0x1000, self->DRegBuf[2]);
+  self->CWrap(cbase ^ 0x1400, self->DRegBuf[3]);
+  self->CWrap(cbase ^ 0x1800, self->DRegBuf[4]);
+  self->CWrap(cbase ^ 0x1c00, self->DRegBuf[5]);
 
-  CWrap(cbase ^ 0x1000, DRegBuf[2]);
-  CWrap(cbase ^ 0x1400, DRegBuf[3]);
-  CWrap(cbase ^ 0x1800, DRegBuf[4]);
-  CWrap(cbase ^ 0x1c00, DRegBuf[5]);
+  self->MWrap(self->A000B);
+}
 
-  MWrap(A000B);
+void MMC3::FixMMC3PRG(int V) {
+  FixMMC3PRGAs(this, V);
+}
+
+void MMC3::FixMMC3CHR(int V) {
+  FixMMC3CHRAs(this, V);
 }
 
 // Was MMC3RegReset.
@@ -84,43 +94,54 @@ DECLFW_RET MMC3::MMC3_CMDWrite(DECLFW_ARGS) {
 }
 
 DECLFW_RET MMC3::MMC3_CMDWrite_Direct(DECLFW_ARGS) {
+  MMC3_CMDWriteAs(this, A, V);
+}
+
+// static
+template<class M>
+DECLFW_RET MMC3::MMC3_CMDWriteFinal(DECLFW_ARGS) {
+  MMC3_CMDWriteAs((M *)fc->fceu->cartiface, A, V);
+}
+
+template<class M>
+void MMC3::MMC3_CMDWriteAs(M *self, uint32 A, uint8 V) {
   // FCEU_printf("bs %04x %02x\n",A,V);
   switch (A & 0xE001) {
     case 0x8000:
-      if ((V & 0x40) != (MMC3_cmd & 0x40)) FixMMC3PRG(V);
-      if ((V & 0x80) != (MMC3_cmd & 0x80)) FixMMC3CHR(V);
-      MMC3_cmd = V;
+      if ((V & 0x40) != (self->MMC3_cmd & 0x40)) FixMMC3PRGAs(self, V);
+      if ((V & 0x80) != (self->MMC3_cmd & 0x80)) FixMMC3CHRAs(self, V);
+      self->MMC3_cmd = V;
       break;
     case 0x8001: {
-      int cbase = (MMC3_cmd & 0x80) << 5;
-      DRegBuf[MMC3_cmd & 0x7] = V;
-      switch (MMC3_cmd & 0x07) {
+      int cbase = (self->MMC3_cmd & 0x80) << 5;
+      self->DRegBuf[self->MMC3_cmd & 0x7] = V;
+      switch (self->MMC3_cmd & 0x07) {
         case 0:
-          CWrap((cbase ^ 0x000), V & (~1));
-          CWrap((cbase ^ 0x400), V | 1);
+          self->CWrap((cbase ^ 0x000), V & (~1));
+          self->CWrap((cbase ^ 0x400), V | 1);
           break;
         case 1:
-          CWrap((cbase ^ 0x800), V & (~1));
-          CWrap((cbase ^ 0xC00), V | 1);
+          self->CWrap((cbase ^ 0x800), V & (~1));
+          self->CWrap((cbase ^ 0xC00), V | 1);
           break;
-        case 2: CWrap(cbase ^ 0x1000, V); break;
-        case 3: CWrap(cbase ^ 0x1400, V); break;
-        case 4: CWrap(cbase ^ 0x1800, V); break;
-        case 5: CWrap(cbase ^ 0x1C00, V); break;
+        case 2: self->CWrap(cbase ^ 0x1000, V); break;
+        case 3: self->CWrap(cbase ^ 0x1400, V); break;
+        case 4: self->CWrap(cbase ^ 0x1800, V); break;
+        case 5: self->CWrap(cbase ^ 0x1C00, V); break;
         case 6:
-          if (MMC3_cmd & 0x40)
-            PWrap(0xC000, V);
+          if (self->MMC3_cmd & 0x40)
+            self->PWrap(0xC000, V);
           else
-            PWrap(0x8000, V);
+            self->PWrap(0x8000, V);
           break;
-        case 7: PWrap(0xA000, V); break;
+        case 7: self->PWrap(0xA000, V); break;
       }
       break;
     }
     case 0xA000:
-      MWrap(V);
+      self->MWrap(V);
       break;
-    case 0xA001: A001B = V; break;
+    case 0xA001: self->A001B = V; break;
   }
 }
 
@@ -329,6 +350,7 @@ struct Mapper4 final : public MMC3 {
   void Power() final override {
     TRACEF("M4power %d...", hackm4);
     MMC3::Power();
+    fc->fceu->SetWriteHandler(0x8000, 0xBFFF, MMC3_CMDWriteFinal<Mapper4>);
     A000B = (hackm4 ^ 1) & 1;
     fc->cart->setmirror(hackm4);
   }
@@ -1452,32 +1474,44 @@ CartInterface *Mapper254_Init(FC *fc, CartInfo *info) {
 
 // ---------------------------- UNIF Boards -----------------------------
 
+namespace {
+// The standard boards, which use the MMC3's wrap functions as-is.
+// Being final lets them use the devirtualized write handler.
+struct PlainMMC3 final : public MMC3 {
+  void Power() final override {
+    MMC3::Power();
+    fc->fceu->SetWriteHandler(0x8000, 0xBFFF, MMC3_CMDWriteFinal<PlainMMC3>);
+  }
+  using MMC3::MMC3;
+};
+}
+
 CartInterface *TBROM_Init(FC *fc, CartInfo *info) {
-  return new MMC3(fc, info, 64, 64, 0, 0);
+  return new PlainMMC3(fc, info, 64, 64, 0, 0);
 }
 
 CartInterface *TEROM_Init(FC *fc, CartInfo *info) {
-  return new MMC3(fc, info, 32, 32, 0, 0);
+  return new PlainMMC3(fc, info, 32, 32, 0, 0);
 }
 
 CartInterface *TFROM_Init(FC *fc, CartInfo *info) {
-  return new MMC3(fc, info, 512, 64, 0, 0);
+  return new PlainMMC3(fc, info, 512, 64, 0, 0);
 }
 
 CartInterface *TGROM_Init(FC *fc, CartInfo *info) {
-  return new MMC3(fc, info, 512, 0, 0, 0);
+  return new PlainMMC3(fc, info, 512, 0, 0, 0);
 }
 
 CartInterface *TKROM_Init(FC *fc, CartInfo *info) {
-  return new MMC3(fc, info, 512, 256, 8, info->battery);
+  return new PlainMMC3(fc, info, 512, 256, 8, info->battery);
 }
 
 CartInterface *TLROM_Init(FC *fc, CartInfo *info) {
-  return new MMC3(fc, info, 512, 256, 0, 0);
+  return new PlainMMC3(fc, info, 512, 256, 0, 0);
 }
 
 CartInterface *TSROM_Init(FC *fc, CartInfo *info) {
-  return new MMC3(fc, info, 512, 256, 8, 0);
+  return new PlainMMC3(fc, info, 512, 256, 8, 0);
 }
 
 namespace {
@@ -1528,6 +1562,6 @@ CartInterface *TQROM_Init(FC *fc, CartInfo *info) {
 }
 
 CartInterface *HKROM_Init(FC *fc, CartInfo *info) {
-  return new MMC3(fc, info, 512, 512, 1, info->battery);
+  return new PlainMMC3(fc, info, 512, 512, 1, info->battery);
 }
 
@@ -15,6 +15,15 @@ struct MMC3 : public CartInterface {
   static void MMC3_CMDWrite(DECLFW_ARGS);
   static void MMC3_IRQWrite(DECLFW_ARGS);
 
+  // Same as MMC3_CMDWrite, for a cartiface whose dynamic type is
+  // exactly M. Since M is final, the calls to PWrap, CWrap and MWrap
+  // are resolved at compile time and can be inlined, which matters
+  // for games that bank switch a lot. Final subclasses (in mmc3.cc,
+  // where this is defined) opt in by installing it at 0x8000-0xBFFF
+  // after MMC3::Power.
+  template<class M>
+  static void MMC3_CMDWriteFinal(DECLFW_ARGS);
+
   virtual void PWrap(uint32 A, uint8 V);
   virtual void CWrap(uint32 A, uint8 V);
   virtual void MWrap(uint8 V);
@@ -34,6 +43,12 @@ struct MMC3 : public CartInterface {
   DECLFW_RET MMC3_CMDWrite_Direct(DECLFW_ARGS);
   DECLFW_RET MMC3_IRQWrite_Direct(DECLFW_ARGS);
 
+  // Implementations of the above for self of type M. With M = MMC3,
+  // the wrap functions are called virtually.
+  template<class M> static void FixMMC3PRGAs(M *self, int V);
+  template<class M> static void FixMMC3CHRAs(M *self, int V);
+  template<class M> static void MMC3_CMDWriteAs(M *self, uint32 A, uint8 V);
+
   int isRevB = 1;
 
   uint8 *MMC3_WRAM = nullptr;
@@ -33,6 +33,7 @@
 
 #include "cart.h"
 #include "x6502.h"
+#include "aot-runtime.h"
 
 #include "file.h"
 #include "utils/memory.h"
@@ -62,6 +63,21 @@ void Cart::SetPagePtr(int s, uint32 A, uint8 *p, bool is_ram) {
       Page[AB + x] = 0;
     }
   }
+  // Compiled code for the old bank must stop running right away; see
+  // X6502::aot_stale. Only the pages it was compiled from matter;
+  // bank switching elsewhere (e.g. the other PRG window) is fine.
+  const X6502 *X = fc->X;
+  if (X != nullptr && X->aot != nullptr) {
+    const uint32 lo = X->aot->code_start >> 11;
+    const uint32 hi = (X->aot->code_past_end - 1) >> 11;
+    for (int x = 0; x < (s >> 1); x++) {
+      const uint32 p = AB + x;
+      if (p >= lo && p <= hi && Page[p] != X->aot_pages[p])
+        fc->X->aot_stale = true;
+    }
+  }
+  // Keep the CPU's fast paths pointing at the new bank.
+  fc->fceu->UpdateFastPages(AB << 11, ((AB + (s >> 1)) << 11) - 1);
 }
 
 // WTF is this? nothing - x*2048 is a pointer before nothing, like
@@ -83,6 +99,7 @@ void Cart::ResetCartMapping() {
   for (int x = 0; x < 8; x++) {
     VPage[x] = nothing - x * 0x400;
   }
+  fc->fceu->UpdateFastPages(0x0000, 0xFFFF);
 }
 
 void Cart::SetupCartPRGMapping(int chip, uint8 *p, uint32 size, bool is_ram) {
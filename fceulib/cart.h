@@ -67,6 +67,15 @@ struct Cart {
   // directly.
   void WritePage(uint32 A, uint8 V) { Page[A >> 11][A] = V; }
   uint8 ReadPage(uint32 A) const { return Page[A >> 11][A]; }
+  // The (offset) pointer for the 2k page itself, so that
+  // PageIdentity(A >> 11)[A] is ReadPage(A). Also useful for telling
+  // whether the page has been remapped.
+  const uint8 *PageIdentity(int page) const { return Page[page]; }
+  // The same pointer, but only if the 2k page is mapped to PRG RAM
+  // (so that CartBW would write to it); otherwise nullptr.
+  uint8 *RAMPage(int page) const {
+    return PRGIsRAM[page] ? Page[page] : nullptr;
+  }
 
   void WriteVPage(uint32 A, uint8 V) { VPage[A >> 10][A] = V; }
   uint8 ReadVPage(uint32 A) const { return VPage[A >> 10][A]; }
@@ -8,34 +8,41 @@
 using namespace std;
 
 using Trace = Traces::Trace;
+using Pos = TraceFile::Pos;
 
 static constexpr int MAX_HISTORY = 120;
 
-int main(int argc, char **argv) {
-  if (argc != 3) {
-    fprintf(stderr,
-            "Compares two trace files, given on the command line, "
-            "to show the first difference (if any).\n");
-    return -1;
-  }
+static void PrintDisagreement(const list<string> &recent, int64_t idx,
+                              const Trace &l, const Trace &r) {
+  printf("\n"
+         "---------------------------------------------\n"
+         "Recent:\n");
+  for (const string &s : recent)
+    printf("%s\n", s.c_str());
+
+  printf("\n"
+         "=============================================\n");
+  printf("At index %lld, traces disagree.\n", (long long)idx);
+  printf("Diff:\n%s\n",
+         Traces::Difference(l, r).c_str());
+}
 
-  vector<Trace> left = Traces::ReadFromFile(argv[1]);
-  fprintf(stderr, "Loaded %lld traces from %s.\n", left.size(), argv[1]);
-  vector<Trace> right = Traces::ReadFromFile(argv[2]);
-  fprintf(stderr, "Loaded %lld traces from %s.\n", right.size(), argv[2]);
+// For files in the old format, which have to be loaded.
+static bool CompareLoaded(const char *lfile, const char *rfile) {
+  vector<Trace> left = Traces::ReadFromFile(lfile);
+  fprintf(stderr, "Loaded %lld traces from %s.\n", left.size(), lfile);
+  vector<Trace> right = Traces::ReadFromFile(rfile);
+  fprintf(stderr, "Loaded %lld traces from %s.\n", right.size(), rfile);
 
-  bool same = true;
   for (int i = 0; i < max(left.size(), right.size()); i++) {
     if (i >= left.size()) {
       printf("The right trace is longer (%lld vs. %lld) but they\n"
              "are the same up to that point.\n", left.size(), right.size());
-      same = false;
-      break;
+      return false;
     } else if (i >= right.size()) {
       printf("The left trace is longer (%lld vs. %lld) but they\n"
              "are the same up to that point.\n", left.size(), right.size());
-      same = false;
-      break;
+      return false;
     }
 
     const Trace &l = left[i], &r = right[i];
@@ -46,19 +53,80 @@ int main(int argc, char **argv) {
         recent.push_front(Traces::LineString(left[j]));
         countleft--;
       }
-      printf("\n"
-             "---------------------------------------------\n"
-             "Recent:\n");
-      for (const string &s : recent)
-        printf("%s\n", s.c_str());
-
-      printf("\n"
-             "=============================================\n");
-      printf("At index %d, traces disagree.\n", i);
-      printf("Diff:\n%s\n",
-             Traces::Difference(l, r).c_str());
-      same = false;
-      break;
+      PrintDisagreement(recent, i, l, r);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Skips the common prefix using the digests, then compares the
+// mapped files record by record.
+static bool CompareStreaming(const TraceFile &left, const TraceFile &right) {
+  Pos lpos = left.Begin(), rpos = right.Begin();
+  int64_t idx = 0;
+  if (left.DigestInterval() == right.DigestInterval()) {
+    // The digests are cumulative, so once they differ, they differ
+    // from then on. Find the first one that differs.
+    int lo = 0, hi = min(left.NumDigests(), right.NumDigests());
+    while (lo < hi) {
+      const int mid = lo + (hi - lo) / 2;
+      if (left.Digest(mid) == right.Digest(mid)) lo = mid + 1;
+      else hi = mid;
+    }
+    // Everything through digest lo - 1 agrees. Back up one more
+    // digest (when possible) so that there is some recent history to
+    // show.
+    const int start = lo - 2;
+    if (start >= 0) {
+      lpos = left.AfterDigest(start);
+      rpos = right.AfterDigest(start);
+      idx = (int64_t)(start + 1) * left.DigestInterval();
+      fprintf(stderr, "Skipped %lld identical traces using digests.\n",
+              (long long)idx);
+    }
+  }
+
+  // Positions in the left file, only rendered if needed.
+  list<Pos> recent;
+  for (;; idx++) {
+    const bool lend = lpos == left.End(), rend = rpos == right.End();
+    if (lend && rend) return true;
+    if (lend || rend) {
+      printf("The %s trace is longer, but they are the same up to\n"
+             "index %lld.\n", lend ? "right" : "left", (long long)idx);
+      return false;
+    }
+
+    if (!TraceFile::Equal(left, lpos, right, rpos)) {
+      list<string> lines;
+      for (Pos p : recent) lines.push_back(Traces::LineString(left.Get(p)));
+      PrintDisagreement(lines, idx, left.Get(lpos), right.Get(rpos));
+      return false;
+    }
+
+    recent.push_back(lpos);
+    if (recent.size() > MAX_HISTORY) recent.pop_front();
+    lpos = left.Next(lpos);
+    rpos = right.Next(rpos);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr,
+            "Compares two trace files, given on the command line, "
+            "to show the first difference (if any).\n");
+    return -1;
+  }
+
+  bool same = false;
+  {
+    TraceFile left(argv[1]), right(argv[2]);
+    if (left.Valid() && right.Valid()) {
+      same = CompareStreaming(left, right);
+    } else {
+      same = CompareLoaded(argv[1], argv[2]);
     }
   }
 
@@ -0,0 +1,121 @@
+
+#include "emulator-batch.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "emulator.h"
+#include "base/logging.h"
+
+using namespace std;
+
+EmulatorBatch::EmulatorBatch(const string &romfile, int size,
+                             int num_threads) {
+  CHECK(size > 0);
+  CHECK(num_threads > 0);
+  emus.reserve(size);
+  Emulator *first = Emulator::Create(romfile);
+  CHECK(first != nullptr) << "EmulatorBatch failed to create: " << romfile;
+  emus.push_back(first);
+  while ((int)emus.size() < size)
+    emus.push_back(first->Clone());
+
+  // The calling thread also does work.
+  for (int i = 1; i < num_threads; i++)
+    workers.emplace_back([this]() { WorkerThread(); });
+}
+
+EmulatorBatch::~EmulatorBatch() {
+  {
+    unique_lock<mutex> ml(m);
+    shutdown = true;
+  }
+  job_cv.notify_all();
+  for (thread &t : workers) t.join();
+  for (Emulator *emu : emus) delete emu;
+}
+
+void EmulatorBatch::DoGroups() {
+  unique_lock<mutex> ml(m);
+  active++;
+  while (next_group < num_groups) {
+    const int g = next_group++;
+    const function<void(int)> *f = job;
+    ml.unlock();
+    (*f)(g);
+    ml.lock();
+  }
+  active--;
+  if (active == 0) done_cv.notify_all();
+}
+
+void EmulatorBatch::WorkerThread() {
+  int64 seen = 0;
+  for (;;) {
+    {
+      unique_lock<mutex> ml(m);
+      job_cv.wait(ml, [this, seen]() {
+        return shutdown || generation != seen;
+      });
+      if (shutdown) return;
+      seen = generation;
+    }
+    // If we woke up late, the job may already be finished. That's
+    // fine; there will just be no groups left.
+    DoGroups();
+  }
+}
+
+void EmulatorBatch::RunGroups(int n, const function<void(int)> &f) {
+  {
+    unique_lock<mutex> ml(m);
+    job = &f;
+    num_groups = n;
+    next_group = 0;
+    generation++;
+  }
+  job_cv.notify_all();
+
+  DoGroups();
+
+  unique_lock<mutex> ml(m);
+  done_cv.wait(ml, [this]() {
+    return next_group >= num_groups && active == 0;
+  });
+  job = nullptr;
+}
+
+void EmulatorBatch::StepAll(const uint16 *inputs, int n) {
+  CHECK(n >= 0 && n <= Size());
+  RunGroups((n + GROUP_SIZE - 1) / GROUP_SIZE,
+            [this, inputs, n](int g) {
+              const int end = std::min(n, (g + 1) * GROUP_SIZE);
+              for (int i = g * GROUP_SIZE; i < end; i++)
+                emus[i]->Step16(inputs[i]);
+            });
+}
+
+void EmulatorBatch::StepSequences(const vector<vector<uint16>> &inputs) {
+  const int n = inputs.size();
+  CHECK(n <= Size());
+  RunGroups((n + GROUP_SIZE - 1) / GROUP_SIZE,
+            [this, &inputs, n](int g) {
+              const int start = g * GROUP_SIZE;
+              const int end = std::min(n, start + GROUP_SIZE);
+              size_t frames = 0;
+              for (int i = start; i < end; i++)
+                frames = std::max(frames, inputs[i].size());
+              // Frame-major, so that members of the group alternate.
+              for (size_t t = 0; t < frames; t++) {
+                for (int i = start; i < end; i++) {
+                  if (t < inputs[i].size())
+                    emus[i]->Step16(inputs[i][t]);
+                }
+              }
+            });
+}
@@ -0,0 +1,77 @@
+/*
+  Steps many emulator instances of the same game together. This is
+  for throughput-oriented clients (like tree search) that would
+  otherwise manage their own threads, each stepping one emulator.
+*/
+
+#ifndef __EMULATOR_BATCH_H
+#define __EMULATOR_BATCH_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+struct Emulator;
+
+struct EmulatorBatch {
+  // Creates size instances of the game (all but the first by cloning,
+  // so they share the ROM), and num_threads worker threads, counting
+  // the calling thread. Aborts on error.
+  EmulatorBatch(const std::string &romfile, int size, int num_threads);
+
+  // Stops the worker threads and deletes the emulators.
+  ~EmulatorBatch();
+
+  int Size() const { return (int)emus.size(); }
+  // The emulator remains owned by the batch. It can be used directly
+  // (e.g. to load or save state) between calls to the Step functions.
+  Emulator *Get(int idx) { return emus[idx]; }
+
+  // Advance instances 0..n-1 by one frame each, like
+  // Get(i)->Step16(inputs[i]). n must be at most Size().
+  void StepAll(const uint16 *inputs, int n);
+
+  // Run each instance i < inputs.size() through the whole sequence
+  // inputs[i] (which can have any length, including zero), like
+  // calling Get(i)->Step16 on each element in order. inputs.size()
+  // must be at most Size().
+  void StepSequences(const std::vector<std::vector<uint16>> &inputs);
+
+ private:
+  // Instances are handed to threads in groups of this size. A thread
+  // steps each member of its group for one frame before starting
+  // the next frame, so that independent work is interleaved.
+  static constexpr int GROUP_SIZE = 4;
+
+  // Call f(idx) for each group index in [0, num_groups), in parallel,
+  // and return once they are all done.
+  void RunGroups(int num_groups, const std::function<void(int)> &f);
+  // Take groups from the current job until there are none left.
+  void DoGroups();
+  void WorkerThread();
+
+  std::vector<Emulator *> emus;
+  std::vector<std::thread> workers;
+
+  // Protects the current job and the fields below.
+  std::mutex m;
+  // Signaled when there is a new job or we are shutting down.
+  std::condition_variable job_cv;
+  // Signaled when a worker finishes its part of the job.
+  std::condition_variable done_cv;
+  // Incremented for each new job.
+  int64 generation = 0;
+  bool shutdown = false;
+  const std::function<void(int)> *job = nullptr;
+  int num_groups = 0;
+  int next_group = 0;
+  // Number of workers that are inside DoGroups for the current job.
+  int active = 0;
+};
+
+#endif
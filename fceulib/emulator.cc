@@ -1,6 +1,7 @@
 
 #include "emulator.h"
 
+#include <cstring>
 #include <string>
 #include <vector>
 #include <zlib.h>
@@ -14,6 +15,11 @@
 #include "palette.h"
 #include "input.h"
 #include "ppu.h"
+#include "cart.h"
+#include "ines.h"
+#include "x6502.h"
+#include "aot-runtime.h"
+#include "transition-cache.h"
 
 #include "fc.h"
 
@@ -83,6 +89,18 @@ uint64 Emulator::Registers() const {
   return ret;
 }
 
+uint64 Emulator::SavedRegisters(const vector<uint8> &save) {
+  const uint16 pc = save[SAVE_PC_OFFSET] | (save[SAVE_PC_OFFSET + 1] << 8);
+  uint64 ret = 0LL;
+  ret <<= 16; ret |= pc;
+  ret <<= 8; ret |= save[SAVE_A_OFFSET];
+  ret <<= 8; ret |= save[SAVE_X_OFFSET];
+  ret <<= 8; ret |= save[SAVE_Y_OFFSET];
+  ret <<= 8; ret |= save[SAVE_S_OFFSET];
+  ret <<= 8; ret |= save[SAVE_P_OFFSET];
+  return ret;
+}
+
 uint64 Emulator::CPUStateChecksum() {
   md5_context ctx;
   md5_starts(&ctx);
@@ -183,10 +201,8 @@ Emulator::~Emulator() {
 
 Emulator::Emulator(FC *fc) : fc(fc) {}
 
-Emulator *Emulator::Create(const string &romfile) {
-  // XXX TODO: If AOT is enabled, then we should give an error if the
-  // romfile doesn't match (or just make it possible to have multiple
-  // AOT games compiled in, with fallback).
+// Allocates and initializes an FC with no game loaded.
+FC *Emulator::NewFC() {
   FC *fc = new FC;
 
   // initialize the infrastructure
@@ -219,7 +235,18 @@ Emulator *Emulator::Create(const string &romfile) {
   // affect the CPU (and anyway makes things slower). -tom7  22 May 2016
   fc->ppu->DisableSpriteLimitation(1);
 
+  return fc;
+}
+
+Emulator *Emulator::Create(const string &romfile) {
+  // XXX TODO: If AOT is enabled, then we should give an error if the
+  // romfile doesn't match (or just make it possible to have multiple
+  // AOT games compiled in, with fallback).
+  FC *fc = NewFC();
+  if (fc == nullptr) return nullptr;
+
   Emulator *emu = new Emulator(fc);
+  emu->romfile = romfile;
   // Load the game.
   if (1 != emu->LoadGame(romfile.c_str())) {
     fprintf(stderr, "Couldn't load [%s]\n", romfile.c_str());
@@ -227,15 +254,115 @@ Emulator *Emulator::Create(const string &romfile) {
     return nullptr;
   }
 
+  // The fixed offsets in the header are a promise to clients, so
+  // make sure the state layout hasn't drifted.
+  {
+    const vector<uint8> save = emu->SaveUncompressed();
+    CHECK(save.size() >= SAVE_RAM_OFFSET + RAM_BYTE_SIZE &&
+          0 == memcmp(SavedRAM(save), fc->fceu->RAM, RAM_BYTE_SIZE) &&
+          SavedRegisters(save) == emu->Registers())
+      << "Save state layout doesn't match Emulator::SAVE_*_OFFSET";
+  }
+
   return emu;
 }
 
-enum Skip : int {
-  // Compute the screen pixels, audio
-  DO_VIDEO_AND_SOUND = 0,
-  // Limited ability to skip video and sound.
-  SKIP_VIDEO_AND_SOUND = 2,
-};
+Emulator *Emulator::Clone() {
+  FC *newfc = NewFC();
+  if (newfc == nullptr) {
+    fprintf(stderr, "Clone: Couldn't initialize.\n");
+    abort();
+  }
+
+  // Loading will use the shared image rather than reading the ROM.
+  newfc->ines->cart_image = fc->ines->cart_image;
+
+  Emulator *emu = new Emulator(newfc);
+  emu->romfile = romfile;
+  if (!emu->LoadGame(romfile)) {
+    fprintf(stderr, "Clone: Couldn't load [%s]\n", romfile.c_str());
+    abort();
+  }
+
+  if (newfc->ines->cart_image != fc->ines->cart_image) {
+    fprintf(stderr, "Clone: [%s] is not the same cartridge as the "
+            "original emulator's\n", romfile.c_str());
+    abort();
+  }
+
+  emu->joydata = joydata;
+  // Before loading the state, since SetAOT checks the code against
+  // the power-on mapping; the original may have switched banks since.
+  if (fc->X->aot != nullptr) emu->SetAOT(true);
+  emu->LoadUncompressed(SaveUncompressed());
+  memcpy(newfc->fceu->XBuf, fc->fceu->XBuf, 256 * 256);
+  memcpy(newfc->fceu->XBackBuf, fc->fceu->XBackBuf, 256 * 256);
+  return emu;
+}
+
+bool Emulator::HasPerfCounters() {
+  return FCEU_PERF_COUNTERS;
+}
+
+PerfCounters Emulator::GetPerfCounters() const {
+#if FCEU_PERF_COUNTERS
+  return fc->X->perf;
+#else
+  return PerfCounters();
+#endif
+}
+
+void Emulator::ResetPerfCounters() {
+#if FCEU_PERF_COUNTERS
+  fc->X->perf = PerfCounters();
+#endif
+}
+
+void Emulator::WatchRAM(const vector<uint16> &addrs, int capacity) {
+  delete fc->fceu->ram_watch;
+  fc->fceu->ram_watch = new RAMWatch(addrs, capacity);
+  fc->fceu->ram_watched_pages = 0;
+  for (int p = 0; p < 8; p++)
+    if (fc->fceu->ram_watch->WatchesPage(p))
+      fc->fceu->ram_watched_pages |= 1 << p;
+  fc->fceu->UpdateFastPages(0x0000, 0x1FFF);
+}
+
+void Emulator::UnwatchRAM() {
+  delete fc->fceu->ram_watch;
+  fc->fceu->ram_watch = nullptr;
+  fc->fceu->ram_watched_pages = 0;
+  fc->fceu->UpdateFastPages(0x0000, 0x1FFF);
+}
+
+int64 Emulator::TakeRAMChanges(vector<RAMWatch::Change> *out) {
+  CHECK(fc->fceu->ram_watch != nullptr) << "Not watching RAM.";
+  return fc->fceu->ram_watch->Take(out);
+}
+
+bool Emulator::SetAOT(bool enabled) {
+  X6502 *X = fc->X;
+  X->aot = nullptr;
+  X->aot_stale = false;
+  if (!enabled) return false;
+
+  const AOTGame *game = FindAOTGame(fc->fceu->GameInfo->MD5.data);
+  if (game == nullptr) return false;
+
+  // The compiled code is only valid for the bytes it was compiled
+  // from; make sure the cart maps those right now, and then remember
+  // the mapping so that X6502 can tell if it changes.
+  if (AOTCodeCRC32(fc, game->code_start, game->code_past_end) !=
+      game->code_crc32) {
+    fprintf(stderr, "AOT code for %s doesn't match what's mapped in "
+            "%04x-%04x. Not using it.\n",
+            game->name, game->code_start, game->code_past_end - 1);
+    return false;
+  }
+  for (int p = 0; p < 32; p++) X->aot_pages[p] = fc->cart->PageIdentity(p);
+  X->aot = game;
+  return true;
+}
 
 // Make one emulator step with the given input.
 // Bits from MSB to LSB are
@@ -245,7 +372,7 @@ void Emulator::Step(uint8 controller1, uint8 controller2) {
   // the bits are in the same order as in the fm2 file.
   joydata = ((uint32)controller2 << 8) | controller1;
   // Emulate a single frame.
-  fc->fceu->FCEUI_Emulate(SKIP_VIDEO_AND_SOUND);
+  fc->fceu->FCEUI_Emulate(false, false);
 }
 
 void Emulator::Step16(uint16 controllers) {
@@ -253,19 +380,72 @@ void Emulator::Step16(uint16 controllers) {
   // the bits are in the same order as in the fm2 file.
   joydata = (uint32)controllers;
   // Emulate a single frame.
-  fc->fceu->FCEUI_Emulate(SKIP_VIDEO_AND_SOUND);
+  fc->fceu->FCEUI_Emulate(false, false);
+}
+
+void Emulator::CachingStep16(uint16 controllers, TransitionCache *cache) {
+  vector<uint8> start;
+  SaveUncompressed(&start);
+  vector<uint8> result;
+  if (cache->Lookup(start, controllers, &result)) {
+    LoadUncompressed(result);
+  } else {
+    Step16(controllers);
+    SaveUncompressed(&result);
+    cache->Remember(start, controllers, result);
+  }
+}
+
+int Emulator::StepSequence(const uint16 *inputs, int n,
+                           const Predicate &pred) {
+  using Clause = Predicate::Clause;
+  const uint8 *ram = fc->fceu->RAM;
+  const int num_clauses = pred.clauses.size();
+  const Clause *clauses = pred.clauses.data();
+
+  // Only the watched bytes are tracked from frame to frame.
+  vector<uint8> prev(num_clauses);
+  for (int c = 0; c < num_clauses; c++)
+    prev[c] = ram[clauses[c].loc];
+
+  for (int i = 0; i < n; i++) {
+    Step16(inputs[i]);
+    bool hit = false;
+    for (int c = 0; c < num_clauses; c++) {
+      const Clause &clause = clauses[c];
+      const uint8 now = ram[clause.loc];
+      switch (clause.op) {
+      case Predicate::CHANGED: hit |= now != prev[c]; break;
+      case Predicate::DECREASED: hit |= now < prev[c]; break;
+      case Predicate::INCREASED: hit |= now > prev[c]; break;
+      case Predicate::EQUALS: hit |= now == clause.value; break;
+      case Predicate::NOT_EQUALS: hit |= now != clause.value; break;
+      case Predicate::LESS: hit |= now < clause.value; break;
+      case Predicate::GREATER: hit |= now > clause.value; break;
+      }
+      prev[c] = now;
+    }
+    if (hit) return i;
+  }
+  return -1;
 }
 
 void Emulator::StepFull(uint8 controller1, uint8 controller2) {
   joydata = ((uint32)controller2 << 8) | controller1;
   // Emulate a single frame.
-  fc->fceu->FCEUI_Emulate(DO_VIDEO_AND_SOUND);
+  fc->fceu->FCEUI_Emulate(true, true);
 }
 
 void Emulator::StepFull16(uint16 controllers) {
   joydata = (uint32)controllers;
   // Emulate a single frame.
-  fc->fceu->FCEUI_Emulate(DO_VIDEO_AND_SOUND);
+  fc->fceu->FCEUI_Emulate(true, true);
+}
+
+void Emulator::StepWith(uint16 controllers, OutputMask mask) {
+  joydata = (uint32)controllers;
+  fc->fceu->FCEUI_Emulate((mask & OUTPUT_VIDEO) != 0,
+                          (mask & OUTPUT_SOUND) != 0);
 }
 
 const uint8 *Emulator::RawIndexedImage() const {
@@ -280,6 +460,183 @@ vector<uint8> Emulator::IndexedImage() const {
   return ret;
 }
 
+// Draws an approximation of the frame into out (256x240) as NES
+// palette indices. See ApproximateIndexedImage.
+static void ApproximateFrame(const FC *fc, uint8 *out) {
+  const PPU *ppu = fc->ppu;
+  const Cart *cart = fc->cart;
+  const uint8 *palram = ppu->PALRAM;
+
+  // The PPU state when each scanline started. Without tracking, we
+  // only have the state at the end of the frame.
+  uint8 line_ctrl[240], line_mask[240], line_nt[240], line_x[240];
+  uint8 first_y;
+  #ifdef TRACK_INTERFRAME_SCROLL
+  memcpy(line_ctrl, ppu->interframe_ctrl, 240);
+  memcpy(line_mask, ppu->interframe_mask, 240);
+  memcpy(line_nt, ppu->interframe_nt, 240);
+  memcpy(line_x, ppu->interframe_x, 240);
+  first_y = ppu->interframe_y[0];
+  #else
+  memset(line_ctrl, ppu->PPU_values[0], 240);
+  memset(line_mask, ppu->PPU_values[1], 240);
+  memset(line_nt, ppu->PPU_values[0] & 3, 240);
+  memset(line_x, ppu->GetXScroll8(), 240);
+  first_y = ppu->GetYScroll8();
+  #endif
+
+  // Vertical position only comes from the start of the frame.
+  const uint32 ystart = ((line_nt[0] >> 1) & 1) * 240 + first_y;
+
+  // Per-pixel flags: BG_OPAQUE if the background pixel is opaque
+  // (for sprite priority), and CLAIMED once some sprite has an opaque
+  // pixel there. On the heap; this is 60k.
+  enum : uint8 { BG_OPAQUE = 1, CLAIMED = 2 };
+  vector<uint8> flags(256 * 240, 0);
+
+  for (int y = 0; y < 240; y++) {
+    const uint8 mask = line_mask[y];
+    // Monochrome mode keeps only the luma bits.
+    const uint8 color_mask = (mask & 0x01) ? 0x30 : 0x3F;
+    uint8 *row = &out[y * 256];
+    memset(row, palram[0] & color_mask, 256);
+    if (!(mask & 0x08)) continue;
+
+    const uint32 bg_pat = (line_ctrl[y] & 0x10) ? 0x1000 : 0x0000;
+    const int left = (mask & 0x02) ? 0 : 8;
+    const uint32 vy = (ystart + y) % 480;
+    const int nt_y = vy >= 240 ? 1 : 0;
+    const int yy = vy - nt_y * 240;
+    const uint32 xstart = (line_nt[y] & 1) * 256 + line_x[y];
+
+    // One tile (8 pixels) at a time. The first one may be partly
+    // off the left edge because of fine scrolling.
+    for (int x0 = -(int)(xstart & 7); x0 < 256; x0 += 8) {
+      const uint32 vx = (xstart + x0) & 511;
+      const uint8 *nt = ppu->vnapage[nt_y * 2 + (vx >> 8)];
+      if (nt == nullptr) continue;
+      const int tx = (vx & 255) >> 3, ty = yy >> 3;
+      const uint8 tile = nt[ty * 32 + tx];
+      const uint8 attr = nt[0x3C0 + (ty >> 2) * 8 + (tx >> 2)];
+      const int shift = ((ty & 2) << 1) | (tx & 2);
+      const uint8 *colors = &palram[((attr >> shift) & 3) * 4];
+      const uint32 addr = bg_pat + tile * 16 + (yy & 7);
+      const uint8 lo = cart->ReadVPage(addr);
+      const uint8 hi = cart->ReadVPage(addr + 8);
+      if ((lo | hi) == 0) continue;
+
+      for (int col = 0; col < 8; col++) {
+        const int x = x0 + col;
+        if (x < left || x >= 256) continue;
+        const int bit = 7 - col;
+        const uint8 value = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+        if (value != 0) {
+          row[x] = colors[value] & color_mask;
+          flags[y * 256 + x] = BG_OPAQUE;
+        }
+      }
+    }
+  }
+
+  // The lowest-numbered opaque sprite at a pixel wins, even if it
+  // is behind the background.
+  const uint8 *spram = ppu->SPRAM;
+  for (int n = 0; n < 64; n++) {
+    // Sprites are drawn one line below their Y coordinate.
+    const int sy = spram[n * 4 + 0] + 1;
+    const uint8 tile = spram[n * 4 + 1];
+    const uint8 attr = spram[n * 4 + 2];
+    const int sx = spram[n * 4 + 3];
+    const bool behind = !!(attr & 0x20);
+    const bool h_flip = !!(attr & 0x40);
+    const bool v_flip = !!(attr & 0x80);
+    const uint8 *colors = &palram[(4 + (attr & 3)) * 4];
+
+    for (int y = sy; y < 240 && y < sy + 16; y++) {
+      const uint8 ctrl = line_ctrl[y], mask = line_mask[y];
+      const int height = (ctrl & 0x20) ? 16 : 8;
+      if (y >= sy + height) break;
+      if (!(mask & 0x10)) continue;
+      const int r = v_flip ? height - 1 - (y - sy) : (y - sy);
+      uint32 addr;
+      if (height == 16) {
+        addr = ((tile & 1) ? 0x1000 : 0x0000) +
+          ((tile & 0xFE) + (r >> 3)) * 16 + (r & 7);
+      } else {
+        addr = ((ctrl & 0x08) ? 0x1000 : 0x0000) + tile * 16 + r;
+      }
+      const uint8 lo = cart->ReadVPage(addr);
+      const uint8 hi = cart->ReadVPage(addr + 8);
+      if ((lo | hi) == 0) continue;
+
+      const uint8 color_mask = (mask & 0x01) ? 0x30 : 0x3F;
+      const int left = (mask & 0x04) ? 0 : 8;
+      for (int col = 0; col < 8; col++) {
+        const int x = sx + col;
+        if (x >= 256) break;
+        if (x < left) continue;
+        const int bit = h_flip ? col : 7 - col;
+        const uint8 value = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+        const int idx = y * 256 + x;
+        if (value == 0 || (flags[idx] & CLAIMED)) continue;
+        flags[idx] |= CLAIMED;
+        if (!behind || !(flags[idx] & BG_OPAQUE))
+          out[idx] = colors[value] & color_mask;
+      }
+    }
+  }
+}
+
+vector<uint8> Emulator::ApproximateIndexedImage() const {
+  vector<uint8> ret(256 * 240);
+  ApproximateFrame(fc, ret.data());
+  return ret;
+}
+
+// Expands ApproximateFrame to 256x256 RGBA, or BGRA if argb is set.
+static void ApproximateImage(const FC *fc, bool argb, vector<uint8> *out) {
+  if (out->size() != IMAGE_BYTE_SIZE) {
+    out->clear();
+    out->resize(IMAGE_BYTE_SIZE);
+  }
+
+  // Like XBuf, using the palette with no emphasis (0x80).
+  uint8 colors[64][4];
+  for (int c = 0; c < 64; c++) {
+    uint8 r, g, b;
+    fc->palette->FCEUD_GetPalette(0x80 | c, &r, &g, &b);
+    colors[c][0] = argb ? b : r;
+    colors[c][1] = g;
+    colors[c][2] = argb ? r : b;
+    colors[c][3] = 0xFF;
+  }
+
+  vector<uint8> indices(256 * 240);
+  ApproximateFrame(fc, indices.data());
+  uint8 *dest = out->data();
+  for (int i = 0; i < 256 * 240; i++)
+    memcpy(&dest[i * 4], colors[indices[i]], 4);
+  // The rest is black.
+  for (int i = 256 * 240; i < 256 * 256; i++) {
+    dest[i * 4 + 0] = dest[i * 4 + 1] = dest[i * 4 + 2] = 0;
+    dest[i * 4 + 3] = 0xFF;
+  }
+}
+
+void Emulator::GetApproximateImage(vector<uint8> *rgba) const {
+  ApproximateImage(fc, false, rgba);
+}
+
+vector<uint8> Emulator::GetApproximateImage() const {
+  vector<uint8> ret(IMAGE_BYTE_SIZE);
+  GetApproximateImage(&ret);
+  return ret;
+}
+
+void Emulator::GetApproximateImageARGB(vector<uint8> *argb) const {
+  ApproximateImage(fc, true, argb);
+}
+
 void Emulator::GetImage(vector<uint8> *rgba) const {
   if (rgba->size() != IMAGE_BYTE_SIZE) {
     rgba->clear();
@@ -355,7 +712,7 @@ void Emulator::GetSound(vector<int16> *wav) {
 }
 
 void Emulator::Save(vector<uint8> *out) {
-  SaveEx(out, nullptr);
+  SaveEx(nullptr, out);
 }
 
 void Emulator::GetBasis(vector<uint8> *out) {
@@ -379,6 +736,27 @@ void Emulator::LoadUncompressed(const vector<uint8> &in) {
   }
 }
 
+void Emulator::SaveDelta(const vector<uint8> &parent, vector<uint8> *out) {
+  if (!fc->state->FCEUSS_SaveDelta(parent, out)) {
+    fprintf(stderr, "Couldn't save delta state\n");
+    abort();
+  }
+}
+
+vector<uint8> Emulator::SaveDelta(const vector<uint8> &parent) {
+  vector<uint8> ret;
+  SaveDelta(parent, &ret);
+  return ret;
+}
+
+void Emulator::LoadDelta(const vector<uint8> &parent,
+                         const vector<uint8> &delta) {
+  if (!fc->state->FCEUSS_LoadDelta(parent, delta)) {
+    fprintf(stderr, "Couldn't restore from delta state\n");
+    abort();
+  }
+}
+
 void Emulator::Load(const vector<uint8> &state) {
   LoadEx(nullptr, state);
 }
@@ -402,15 +780,148 @@ uint32 Emulator::GetYScroll() const {
   return ytable_select + (uint32)ypos;
 }
 
-// Compression yields 2x slowdown, but states go from ~80kb to 1.4kb
-// Without screenshot, ~1.3kb and only 40% slowdown
-// XXX External interface now allows client to specify, so maybe just
-// make this a guarantee.
-#define USE_COMPRESSION 1
+// Compressed states (SaveEx) start with this 8-byte header: the
+// magic bytes "FCS", the codec, and the uncompressed length as a
+// little-endian uint32. Before there was a header, states were just
+// the length followed by the zlib stream (of the state minus the
+// basis); since states are much smaller than 16MB, the fourth byte
+// was always zero, which is not a valid codec.
+static constexpr int SAVE_HEADER_SIZE = 8;
+static void XorBasis(const vector<uint8> *basis, vector<uint8> *v) {
+  if (basis == nullptr) return;
+  const int blen = min(basis->size(), v->size());
+  const uint8 *b = basis->data();
+  uint8 *d = v->data();
+  int i = 0;
+  // A word at a time; -O2 does not vectorize the byte loop.
+  for (; i + 8 <= blen; i += 8) {
+    uint64 x, y;
+    memcpy(&x, d + i, 8);
+    memcpy(&y, b + i, 8);
+    x ^= y;
+    memcpy(d + i, &x, 8);
+  }
+  for (; i < blen; i++) d[i] ^= b[i];
+}
+
+// The fast codec's run-length encoding. After XOR with a basis, the
+// state is mostly zeroes, so this just encodes alternating runs of
+// zeroes and literal bytes: a varint count of zeroes, a varint count
+// of literals, and then the literals, repeated until the input is
+// used up. (cc-lib's RLE is more general, but several times slower.)
+static void PutVarint(uint32 v, vector<uint8> *out) {
+  while (v >= 0x80) {
+    out->push_back((uint8)(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back((uint8)v);
+}
+
+static bool GetVarint(const uint8 **pos, const uint8 *end, uint32 *v) {
+  *v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*pos == end) return false;
+    const uint8 b = *(*pos)++;
+    *v |= (uint32)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+static void ZeroRunEncode(const vector<uint8> &in, vector<uint8> *out) {
+  const uint8 *d = in.data();
+  const int len = in.size();
+  out->reserve(out->size() + len / 8 + 16);
+  int i = 0;
+  while (i < len) {
+    const int zstart = i;
+    for (;;) {
+      uint64 w;
+      if (i + 8 > len) break;
+      memcpy(&w, d + i, 8);
+      if (w != 0) break;
+      i += 8;
+    }
+    while (i < len && d[i] == 0) i++;
+    const int lstart = i;
+    // Literals end at a pair of zeroes (a single zero is cheaper to
+    // include than to encode as a run).
+    while (i < len && (d[i] != 0 || (i + 1 < len && d[i + 1] != 0))) i++;
+    PutVarint(lstart - zstart, out);
+    PutVarint(i - lstart, out);
+    out->insert(out->end(), d + lstart, d + i);
+  }
+}
 
-#if USE_COMPRESSION
+static bool ZeroRunDecode(const uint8 *pos, const uint8 *end,
+                          uint32 len, vector<uint8> *out) {
+  out->resize(len);
+  uint8 *o = out->data();
+  uint32 done = 0;
+  while (pos != end) {
+    uint32 zeroes, literals;
+    if (!GetVarint(&pos, end, &zeroes) ||
+        !GetVarint(&pos, end, &literals) ||
+        zeroes > len - done ||
+        literals > len - done - zeroes ||
+        literals > (uint32)(end - pos))
+      return false;
+    memset(o + done, 0, zeroes);
+    done += zeroes;
+    memcpy(o + done, pos, literals);
+    done += literals;
+    pos += literals;
+  }
+  return done == len;
+}
 
-void Emulator::SaveEx(const vector<uint8> *basis, vector<uint8> *state) {
+// Compress a raw (FCEUSS_SaveRAW) state for SaveEx and CompressState.
+static void EncodeState(vector<uint8> raw, const vector<uint8> *basis,
+                        vector<uint8> *state, Emulator::SaveCodec codec) {
+  // Encode.
+  XorBasis(basis, &raw);
+
+  const uint32 len = raw.size();
+  const uint8 header[SAVE_HEADER_SIZE] = {
+    'F', 'C', 'S', (uint8)codec,
+    (uint8)len, (uint8)(len >> 8), (uint8)(len >> 16), (uint8)(len >> 24),
+  };
+
+  switch (codec) {
+  case Emulator::CODEC_ZLIB: {
+    // worst case compression:
+    // zlib says "0.1% larger than sourceLen plus 12 bytes"
+    uLongf comprlen = (len >> 9) + 12 + len;
+
+    // Make sure there is contiguous space. Need room for header too.
+    state->resize(SAVE_HEADER_SIZE + comprlen);
+
+    if (Z_OK != compress2(&(*state)[SAVE_HEADER_SIZE], &comprlen,
+                          raw.data(), len, Z_DEFAULT_COMPRESSION)) {
+      fprintf(stderr, "Couldn't compress.\n");
+      abort();
+    }
+
+    // Trim to what we actually needed.
+    state->resize(SAVE_HEADER_SIZE + comprlen);
+    break;
+  }
+  case Emulator::CODEC_FAST: {
+    state->resize(SAVE_HEADER_SIZE);
+    ZeroRunEncode(raw, state);
+    break;
+  }
+  default:
+    fprintf(stderr, "Unknown save codec %d\n", (int)codec);
+    abort();
+  }
+
+  memcpy(state->data(), header, SAVE_HEADER_SIZE);
+  state->shrink_to_fit();
+}
+
+void Emulator::SaveEx(const vector<uint8> *basis, vector<uint8> *state,
+                      SaveCodec codec) {
   // TODO PERF
   // Saving is not as efficient as we'd like for a pure in-memory operation
   //  - uses tags to tell you what's next, even though we could already know
@@ -420,44 +931,22 @@ void Emulator::SaveEx(const vector<uint8> *basis, vector<uint8> *state) {
 
   vector<uint8> raw;
   fc->state->FCEUSS_SaveRAW(&raw);
+  EncodeState(std::move(raw), basis, state, codec);
+}
 
-  // Encode.
-  int blen = (basis == nullptr) ? 0 : (min(basis->size(), raw.size()));
-  for (int i = 0; i < blen; i++) {
-    raw[i] -= (*basis)[i];
-  }
-
-  // Compress.
-  int len = raw.size();
-  // worst case compression:
-  // zlib says "0.1% larger than sourceLen plus 12 bytes"
-  uLongf comprlen = (len >> 9) + 12 + len;
-
-  // Make sure there is contiguous space. Need room for header too.
-  state->resize(4 + comprlen);
-
-  if (Z_OK != compress2(&(*state)[4], &comprlen, raw.data(), len,
-                        Z_DEFAULT_COMPRESSION)) {
-    fprintf(stderr, "Couldn't compress.\n");
-    abort();
-  }
-
-  *(uint32*)state->data() = len;
-
-  // Trim to what we actually needed.
-  state->resize(4 + comprlen);
-  state->shrink_to_fit();
+void Emulator::CompressState(const vector<uint8> &uncompressed,
+                             const vector<uint8> *basis, vector<uint8> *out,
+                             SaveCodec codec) {
+  EncodeState(uncompressed, basis, out, codec);
 }
 
-void Emulator::LoadEx(const vector<uint8> *basis, const vector<uint8> &state) {
-  // Decompress. First word tells us the decompressed size.
-  int uncomprlen = *(const uint32*)state.data();
-  vector<uint8> uncompressed;
-  uncompressed.resize(uncomprlen);
+// Decompress a zlib stream into a buffer of the given size.
+static void ZlibUncompress(const uint8 *data, int size,
+                           int uncomprlen, vector<uint8> *out) {
+  out->resize(uncomprlen);
   uLongf uncomprlenf = uncomprlen;
 
-  switch (uncompress(uncompressed.data(), &uncomprlenf,
-                     &state[4], state.size() - 4)) {
+  switch (uncompress(out->data(), &uncomprlenf, data, size)) {
   case Z_OK: break;
   case Z_BUF_ERROR:
     fprintf(stderr, "zlib: Not enough room in output. Uncompressed length\n"
@@ -476,34 +965,51 @@ void Emulator::LoadEx(const vector<uint8> *basis, const vector<uint8> &state) {
   // fprintf(stderr, "After uncompression: %d\n", uncomprlen);
 
   // Why doesn't this equal the result from before?
-  uncompressed.resize(uncomprlen);
-
-  // Decode.
-  int blen = (basis == nullptr) ? 0 : (min(basis->size(), uncompressed.size()));
-  for (int i = 0; i < blen; i++) {
-    uncompressed[i] += (*basis)[i];
-  }
-
-  if (!fc->state->FCEUSS_LoadRAW(uncompressed)) {
-    fprintf(stderr, "Couldn't restore from state\n");
-    abort();
-  }
+  out->resize(uncomprlen);
 }
 
-#else
+void Emulator::LoadEx(const vector<uint8> *basis, const vector<uint8> &state) {
+  vector<uint8> uncompressed;
+  if (state.size() >= SAVE_HEADER_SIZE &&
+      state[0] == 'F' && state[1] == 'C' && state[2] == 'S' &&
+      state[3] != 0) {
+    const uint32 len = (uint32)state[4] | ((uint32)state[5] << 8) |
+      ((uint32)state[6] << 16) | ((uint32)state[7] << 24);
+    const uint8 *data = state.data() + SAVE_HEADER_SIZE;
+    const int size = state.size() - SAVE_HEADER_SIZE;
+    switch (state[3]) {
+    case CODEC_ZLIB:
+      ZlibUncompress(data, size, len, &uncompressed);
+      break;
+    case CODEC_FAST: {
+      if (!ZeroRunDecode(data, data + size, len, &uncompressed)) {
+        fprintf(stderr, "Corrupt state (fast codec)\n");
+        abort();
+      }
+      break;
+    }
+    default:
+      fprintf(stderr, "Unknown save codec %d\n", (int)state[3]);
+      abort();
+    }
 
-// When compression is disabled, we ignore the basis (no point) and
-// don't store any size header. These functions become very simple.
-void Emulator::SaveEx(vector<uint8> *state, const vector<uint8> *basis) {
-  fc->state->FCEUSS_SaveRAW(out);
-}
+    // Decode.
+    XorBasis(basis, &uncompressed);
+  } else {
+    // Old format. First word tells us the decompressed size, and the
+    // basis was subtracted.
+    const int uncomprlen = *(const uint32*)state.data();
+    ZlibUncompress(&state[4], state.size() - 4, uncomprlen, &uncompressed);
+
+    const int blen =
+      (basis == nullptr) ? 0 : (min(basis->size(), uncompressed.size()));
+    for (int i = 0; i < blen; i++) {
+      uncompressed[i] += (*basis)[i];
+    }
+  }
 
-void Emulator::LoadEx(vector<uint8> *state, const vector<uint8> *basis) {
-  if (!fc->state->FCEUSS_LoadRAW(*state)) {
+  if (!fc->state->FCEUSS_LoadRAW(uncompressed)) {
     fprintf(stderr, "Couldn't restore from state\n");
     abort();
   }
 }
-
-
-#endif
@@ -14,17 +14,29 @@
 #include "types.h"
 
 #include "fc.h"
+#include "perf-counters.h"
+#include "ram-watch.h"
 
 using namespace std;
 
 struct FCEUGI;
+struct TransitionCache;
 struct Emulator {
   static constexpr int AUDIO_SAMPLE_RATE = 44100;
 
   // Returns nullptr (or aborts) on error. Upon success, returns
-  // a new-ly allocated instance.
+  // a new-ly allocated instance. All emulators in the process that
+  // have the same game loaded share its (read-only) PRG/CHR ROM;
+  // only RAM, including CHR RAM and WRAM, is per instance.
   static Emulator *Create(const string &romfile);
 
+  // Create a new, independent instance in the same state as this one
+  // (including the last image from StepFull). The immutable PRG/CHR
+  // ROM is shared with this instance rather than being read from the
+  // file and hashed again, so this is much cheaper than Create. (The
+  // ROM file is still opened to check its header.) Aborts on error.
+  Emulator *Clone();
+
   ~Emulator();
 
   // Serialize the state to the vector, allowing it to be restored
@@ -41,6 +53,63 @@ struct Emulator {
   void Step(uint8 controller1, uint8 controller2);
   // High 8 bits are controller1, low are controller2.
   void Step16(uint16 controllers);
+
+  // Same as Step16, but if the cache has seen this input from the
+  // current state before, just restore the remembered result. (This
+  // costs a SaveUncompressed and a hash either way, so it only pays
+  // off when transitions are actually repeated.) The cache can be
+  // shared by any emulators with the same game loaded, including
+  // from different threads.
+  void CachingStep16(uint16 controllers, TransitionCache *cache);
+
+  // A condition on RAM that is checked after every frame of
+  // StepSequence. It holds if any of its clauses do, so an empty
+  // predicate never holds. Build with the methods below, e.g.
+  //   Emulator::Predicate p;
+  //   p.Decreased(0x75).AnyChanged({0x10, 0x11});
+  // Comparisons to the "previous" value are against the same byte
+  // one frame earlier (for the first frame, when the sequence began).
+  struct Predicate {
+    Predicate &Changed(int loc) { return Add(CHANGED, loc, 0); }
+    Predicate &AnyChanged(const vector<int> &locs) {
+      for (int loc : locs) Changed(loc);
+      return *this;
+    }
+    Predicate &Decreased(int loc) { return Add(DECREASED, loc, 0); }
+    Predicate &Increased(int loc) { return Add(INCREASED, loc, 0); }
+    Predicate &Equals(int loc, uint8 v) { return Add(EQUALS, loc, v); }
+    Predicate &NotEquals(int loc, uint8 v) {
+      return Add(NOT_EQUALS, loc, v);
+    }
+    Predicate &Less(int loc, uint8 v) { return Add(LESS, loc, v); }
+    Predicate &Greater(int loc, uint8 v) { return Add(GREATER, loc, v); }
+
+    bool Empty() const { return clauses.empty(); }
+
+   private:
+    friend struct Emulator;
+    enum Op : uint8 {
+      CHANGED, DECREASED, INCREASED,
+      EQUALS, NOT_EQUALS, LESS, GREATER,
+    };
+    struct Clause {
+      uint16 loc;
+      Op op;
+      uint8 value;
+    };
+    Predicate &Add(Op op, int loc, uint8 value) {
+      clauses.push_back(Clause{(uint16)(loc & 0x7FF), op, value});
+      return *this;
+    }
+    vector<Clause> clauses;
+  };
+
+  // Step16 with inputs[0], ..., inputs[n - 1], testing the predicate
+  // after each frame. Stops as soon as it holds and returns the index
+  // of the input that caused that (so inputs[0..idx] have been
+  // executed), or returns -1 after executing all n. This is much
+  // cheaper than copying the memory after each frame to check it.
+  int StepSequence(const uint16 *inputs, int n, const Predicate &pred);
   
   // Copy the 0x800 bytes of RAM.
   void GetMemory(vector<uint8> *mem);
@@ -52,6 +121,24 @@ struct Emulator {
   // but allows calling GetImage and GetSound.
   void StepFull(uint8 controller1, uint8 controller2);
   void StepFull16(uint16 controllers);
+
+  // Which outputs StepWith produces. The emulated machine (RAM, CPU,
+  // and so on) behaves the same either way; skipped outputs are just
+  // left stale.
+  enum OutputMask : uint8 {
+    OUTPUT_NONE = 0,
+    // Render pixels for GetImage and friends.
+    OUTPUT_VIDEO = 1,
+    // Synthesize the frame's samples for GetSound.
+    OUTPUT_SOUND = 2,
+    OUTPUT_VIDEO_AND_SOUND = OUTPUT_VIDEO | OUTPUT_SOUND,
+  };
+  // Step16 is StepWith(controllers, OUTPUT_NONE), and StepFull16 is
+  // StepWith(controllers, OUTPUT_VIDEO_AND_SOUND). Use this when only
+  // one is needed, like image-only analysis (video) or recording
+  // audio (sound). As with StepFull, the savestates produced can
+  // differ from Step's in their sound emulation details.
+  void StepWith(uint16 controllers, OutputMask mask);
   
   // Get image. StepFull must have been called to produce this frame,
   // or else who knows what's in there? (Note that restoring a state
@@ -98,12 +185,68 @@ struct Emulator {
   vector<uint8> SaveUncompressed();
   void LoadUncompressed(const vector<uint8> &in);
 
+  // The uncompressed save state format (SaveUncompressed, GetBasis)
+  // always begins with the CPU registers and the 0x800 bytes of RAM,
+  // at these fixed byte offsets. This allows inspecting a saved state
+  // without restoring it. (Not true of compressed or delta states.)
+  // The 16-bit PC is stored little-endian (it's an RLSB field).
+  static constexpr int SAVE_PC_OFFSET = 13;
+  static constexpr int SAVE_A_OFFSET = 23;
+  static constexpr int SAVE_P_OFFSET = 32;
+  static constexpr int SAVE_X_OFFSET = 41;
+  static constexpr int SAVE_Y_OFFSET = 50;
+  static constexpr int SAVE_S_OFFSET = 59;
+  static constexpr int SAVE_RAM_OFFSET = 68;
+
+  // Pointer to the 0x800 bytes of RAM within an uncompressed save
+  // state. Valid as long as the vector is not modified.
+  static const uint8 *SavedRAM(const vector<uint8> &save) {
+    return save.data() + SAVE_RAM_OFFSET;
+  }
+  // No bounds checking; idx must be in [0, 2047].
+  static uint8 SavedRAMByte(const vector<uint8> &save, int idx) {
+    return save[SAVE_RAM_OFFSET + idx];
+  }
+  // Register file of an uncompressed save state, packed the same
+  // way as Registers().
+  static uint64 SavedRegisters(const vector<uint8> &save);
+
+  // Incremental ("copy-on-write") save states. The parent must be
+  // the output of SaveUncompressed for this game. The delta only
+  // contains the fixed-size pages (RAM, WRAM, PPU memory, mapper
+  // state, etc.) that differ from the parent, so it is much smaller
+  // than a full state when the two are a few frames apart. Loading
+  // only writes the pages that differ from the current state. A
+  // delta must be loaded with the same parent it was saved with.
+  void SaveDelta(const vector<uint8> &parent, vector<uint8> *out);
+  vector<uint8> SaveDelta(const vector<uint8> &parent);
+  void LoadDelta(const vector<uint8> &parent, const vector<uint8> &delta);
+
   // Save and load with a basis vector. The vector can contain anything, and
   // doesn't even have to be the same length as an uncompressed save state,
   // but a state needs to be loaded with the same basis as it was saved.
   // basis can be NULL, and then these behave the same as Save/Load.
-  void SaveEx(const vector<uint8> *basis, vector<uint8> *out);
+  //
+  // The codec selects how the state is compressed after XORing it with
+  // the basis. zlib gives the smallest states. The fast codec just
+  // run-length encodes the zero bytes; states are somewhat larger
+  // (especially with a poor basis), but saving and loading are more
+  // than ten times faster. See savestate-bench.cc. The output records
+  // the codec, so LoadEx can decode any of them (and states from before
+  // the codec header existed).
+  enum SaveCodec : uint8 {
+    CODEC_ZLIB = 1,
+    CODEC_FAST = 2,
+  };
+  void SaveEx(const vector<uint8> *basis, vector<uint8> *out,
+              SaveCodec codec = CODEC_ZLIB);
   void LoadEx(const vector<uint8> *basis, const vector<uint8> &in);
+  // The same as SaveEx, but compresses a state from SaveUncompressed
+  // (which need not be the current one), so it doesn't need an
+  // emulator. Load the result with LoadEx.
+  static void CompressState(const vector<uint8> &uncompressed,
+                            const vector<uint8> *basis, vector<uint8> *out,
+                            SaveCodec codec = CODEC_ZLIB);
 
   // Get the X Scroll offset from the PPU.
   // This may be confused by games that are not actually horizontally
@@ -126,6 +269,22 @@ struct Emulator {
   // NES palette indices in [0, 63].
   vector<uint8> IndexedImage() const;
 
+  // Approximate video for headless use. Rather than reading the
+  // renderer's output, this synthesizes the frame on demand from the
+  // nametables, pattern tables, palette RAM, OAM and the scroll
+  // position and control registers recorded for each scanline. So it
+  // works after Step (or with DISABLE_VIDEO), and only costs anything
+  // when called, which is much cheaper than StepFull on every frame
+  // if only some of them are looked at. Not reproduced: mid-frame
+  // changes to vertical scroll or CHR banks (as for some status
+  // bars), the 8-sprites-per-line limit, color emphasis, and MMC5
+  // extended modes. Same formats as IndexedImage, GetImage and
+  // GetImageARGB.
+  vector<uint8> ApproximateIndexedImage() const;
+  void GetApproximateImage(vector<uint8> *rgba) const;
+  vector<uint8> GetApproximateImage() const;
+  void GetApproximateImageARGB(vector<uint8> *argb) const;
+
   // Returns the X6502 register file packed into uint64, as
   // 0 PC (16 bit) A X Y S P
   // P is flags. The high 8 bits are always 0.
@@ -134,6 +293,42 @@ struct Emulator {
   // No bounds checking; idx must be in [0, 2047].
   uint8 ReadRAM(int idx) const;
   void SetRAM(int idx, uint8 value);
+
+  // Use ahead-of-time compiled code for the CPU instead of the
+  // interpreter. This requires that code for this cartridge was
+  // generated by aot.exe and linked in (see the makefile). Returns
+  // true if compiled code is now in use. Even when enabled, the
+  // interpreter still runs if the compiled code is bank-switched
+  // out. Off by default; clones inherit the setting. Whether it's
+  // faster depends on the game; for the test carts, frame time is
+  // dominated by the PPU and there is no measurable difference.
+  bool SetAOT(bool enabled);
+
+  // Counts of what the emulator has been doing (instructions, handler
+  // calls, PPU lines, etc.; see perf-counters.h) since it was created
+  // or ResetPerfCounters was called. These are only collected if
+  // fceulib was compiled with FCEU_PERF_COUNTERS=1, which slows it
+  // down somewhat; otherwise HasPerfCounters is false and the
+  // counters are always zero.
+  static bool HasPerfCounters();
+  PerfCounters GetPerfCounters() const;
+  void ResetPerfCounters();
+
+  // Log changes to the given RAM locations (in [0, 2047]) as they
+  // happen, instead of calling GetMemory after every frame and
+  // comparing. At most one change is logged per location per frame;
+  // see ram-watch.h. Up to capacity changes are kept between calls to
+  // TakeRAMChanges. Frames are numbered from 0 starting with the next
+  // Step. Replaces any existing watch. Writes to watched pages are
+  // somewhat slower, and ahead-of-time compiled code (SetAOT) is not
+  // used while watching. The watch is not copied by Clone nor saved
+  // in states.
+  void WatchRAM(const vector<uint16> &addrs, int capacity);
+  void UnwatchRAM();
+  // Appends the changes logged since the last call (oldest first) to
+  // out, and returns the number of changes that were dropped because
+  // there were more than capacity. Must be watching.
+  int64 TakeRAMChanges(vector<RAMWatch::Change> *out);
   
   // XXXXX debugging only.
   FC *GetFC() { return fc; }
@@ -144,16 +339,19 @@ struct Emulator {
   Emulator(FC *fc);
 
  private:
+  static FC *NewFC();
   bool DriverInitialize(FCEUGI *gi);
   bool LoadGame(const string &path);
 
   FC *fc = nullptr;
+  // The file we were loaded from, for Clone.
+  string romfile;
 
   // Joystick data. I think used for both controller 0 and 1. Part of
   // the "API". TODO: Move into FCEU or input object?
   uint32 joydata = 0;
 
-  // Maybe we should consider supporting cloning, actually.
+  // Use Clone.
   Emulator(const Emulator &) = delete;
   Emulator &operator =(const Emulator &) = delete;
 };
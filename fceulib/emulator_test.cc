@@ -1,5 +1,10 @@
 
 #include "emulator.h"
+#include "emulator-batch.h"
+#include "transition-cache.h"
+#include "fc.h"
+#include "fceu.h"
+#include "x6502.h"
 
 #ifdef __MINGW32__
 // For setting priority.
@@ -8,11 +13,13 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <memory>
 #include <sys/time.h>
 #include <sstream>
 #include <unistd.h>
 #include <cstdio>
+#include <cstring>
 
 // XXX hack
 #define BASE_INT_TYPES_H_
@@ -53,6 +60,8 @@ static constexpr uint64 kEveryGameUponLoad =
 static bool FULL = false;
 static bool COMPREHENSIVE = false;
 static bool MAKE_COMPREHENSIVE = false;
+// Use ahead-of-time compiled code, for games that have it linked in.
+static bool AOT = false;
 
 struct Game {
   string cart;
@@ -351,6 +360,9 @@ static SerialResult RunGameSerially(std::function<void(const string &)> Update_,
   }
 
   CHECK(emu.get() != nullptr) << game.cart.c_str();
+  if (AOT && !emu->SetAOT(true)) {
+    fprintf(stderr, "(No AOT code for %s.)\n", game.cart.c_str());
+  }
   CHECK_RAM(game.after_load);
   TRACEF("after_load %llu.", emu->RamChecksum());
 
@@ -483,6 +495,303 @@ static SerialResult RunGameSerially(std::function<void(const string &)> Update_,
     DoSeekSpan(seekto, dist);
   }
 
+  Update("Random seeks (delta).");
+  for (int i = 0; i < 200; i++) {
+    const int seekto = Rand(saves.size());
+    const int parent = std::max(0, seekto - (int)Rand(8));
+    emu->LoadUncompressed(saves[seekto]);
+    const vector<uint8> full = emu->SaveUncompressed();
+    const vector<uint8> delta = emu->SaveDelta(saves[parent]);
+    // Go somewhere else, then restore from the delta.
+    emu->LoadUncompressed(saves[Rand(saves.size())]);
+    emu->LoadDelta(saves[parent], delta);
+    CHECK_RAM(checksums[seekto]);
+    CHECK(emu->SaveUncompressed() == full) << seekto;
+    if (seekto + 1 < saves.size()) {
+      StepMaybeTraced(inputs[seekto]);
+      CHECK_RAM(checksums[seekto + 1]);
+    }
+  }
+
+  Update("Clones.");
+  for (int i = 0; i < 10; i++) {
+    const int seekto = Rand(saves.size());
+    emu->LoadUncompressed(saves[seekto]);
+    std::unique_ptr<Emulator> clone{emu->Clone()};
+    CHECK_EQ(checksums[seekto], clone->RamChecksum()) << seekto;
+    for (int j = 0; j < 5 && seekto + j + 1 < saves.size(); j++) {
+      clone->Step(inputs[seekto + j], 0);
+      CHECK_EQ(checksums[seekto + j + 1], clone->RamChecksum()) << seekto;
+    }
+    // Stepping the clone doesn't affect the original.
+    CHECK_RAM(checksums[seekto]);
+  }
+
+  Update("Batch.");
+  {
+    EmulatorBatch batch(game.cart, 6, 3);
+    // Sequences of different lengths from random starting points,
+    // then one more frame for everyone.
+    vector<int> ends;
+    vector<vector<uint16>> seqs;
+    for (int i = 0; i < batch.Size(); i++) {
+      const int seekto = Rand(saves.size() - 1);
+      const int len = std::min((int)Rand(10), (int)saves.size() - 2 - seekto);
+      batch.Get(i)->LoadUncompressed(saves[seekto]);
+      seqs.emplace_back(inputs.begin() + seekto,
+                        inputs.begin() + seekto + len);
+      ends.push_back(seekto + len);
+    }
+    batch.StepSequences(seqs);
+    vector<uint16> next;
+    for (int i = 0; i < batch.Size(); i++) {
+      CHECK_EQ(checksums[ends[i]], batch.Get(i)->RamChecksum()) << i;
+      next.push_back(inputs[ends[i]]);
+    }
+    batch.StepAll(next.data(), next.size());
+    for (int i = 0; i < batch.Size(); i++)
+      CHECK_EQ(checksums[ends[i] + 1], batch.Get(i)->RamChecksum()) << i;
+  }
+
+  Update("Save codecs.");
+  for (int i = 0; i < 40; i++) {
+    const int seekto = Rand(saves.size());
+    const Emulator::SaveCodec codec =
+      (i & 1) ? Emulator::CODEC_FAST : Emulator::CODEC_ZLIB;
+    const vector<uint8> *b = (i & 2) ? &basis : nullptr;
+    emu->LoadUncompressed(saves[seekto]);
+    const vector<uint8> full = emu->SaveUncompressed();
+    vector<uint8> state;
+    emu->SaveEx(b, &state, codec);
+    vector<uint8> compressed;
+    Emulator::CompressState(full, b, &compressed, codec);
+    CHECK(compressed == state) << seekto << " " << i;
+    emu->LoadUncompressed(saves[Rand(saves.size())]);
+    emu->LoadEx(b, state);
+    CHECK_RAM(checksums[seekto]);
+    CHECK(emu->SaveUncompressed() == full) << seekto << " " << i;
+  }
+
+  Update("Step sequence.");
+  for (int i = 0; i < 20; i++) {
+    const int seekto = Rand(saves.size() - 1);
+    const int n = std::min(30, (int)saves.size() - 1 - seekto);
+    vector<uint16> seq(inputs.begin() + seekto, inputs.begin() + seekto + n);
+    Emulator::Predicate pred;
+    const int loc1 = Rand(2048), loc2 = Rand(2048);
+    pred.AnyChanged({loc1, loc2}).Decreased(0x75);
+    // Expected result, by stepping one frame at a time.
+    emu->LoadUncompressed(saves[seekto]);
+    int expected = -1;
+    for (int j = 0; j < n && expected < 0; j++) {
+      const vector<uint8> prev = emu->GetMemory();
+      emu->Step16(seq[j]);
+      const vector<uint8> now = emu->GetMemory();
+      if (now[loc1] != prev[loc1] || now[loc2] != prev[loc2] ||
+          now[0x75] < prev[0x75])
+        expected = j;
+    }
+    emu->LoadUncompressed(saves[seekto]);
+    const int idx = emu->StepSequence(seq.data(), n, pred);
+    CHECK_EQ(expected, idx) << seekto;
+    CHECK_RAM(checksums[seekto + (idx < 0 ? n : idx + 1)]);
+
+    // An empty predicate runs the whole thing.
+    emu->LoadUncompressed(saves[seekto]);
+    CHECK_EQ(-1, emu->StepSequence(seq.data(), n, Emulator::Predicate()));
+    CHECK_RAM(checksums[seekto + n]);
+  }
+
+  Update("Transition cache.");
+  {
+    // Small enough that some entries get evicted.
+    TransitionCache cache(saves[0].size() * 64, 4);
+    for (int i = 0; i < 300; i++) {
+      // Revisit a small set of states so that there are hits.
+      const int seekto = Rand(std::min((int)saves.size() - 1, 40));
+      emu->LoadUncompressed(saves[seekto]);
+      emu->CachingStep16(inputs[seekto], &cache);
+      CHECK_RAM(checksums[seekto + 1]);
+    }
+    const TransitionCache::Stats stats = cache.GetStats();
+    CHECK_EQ(stats.hits + stats.misses, 300);
+    CHECK(stats.hits > 0);
+    CHECK(stats.bytes <= (int64)saves[0].size() * 64);
+  }
+
+  Update("AOT vs. interpreter.");
+  {
+    // If compiled code is linked in for this game, it has to agree
+    // with the interpreter, including when the cart switches out the
+    // banks it was compiled from in the middle of a frame. SetAOT
+    // wants the power-on mapping, hence saves[0]. Only RAM, since the
+    // compiled code doesn't keep the data bus (DB) exactly.
+    emu->LoadUncompressed(saves[0]);
+    std::unique_ptr<Emulator> aot{emu->Clone()};
+    std::unique_ptr<Emulator> interp{emu->Clone()};
+    interp->SetAOT(false);
+    if (aot->SetAOT(true)) {
+      for (int i = 0; i < 10; i++) {
+        const int seekto = Rand(saves.size() - 1);
+        aot->LoadUncompressed(saves[seekto]);
+        interp->LoadUncompressed(saves[seekto]);
+        for (int j = 0; j < 100 && seekto + j + 1 < saves.size(); j++) {
+          aot->Step(inputs[seekto + j], 0);
+          interp->Step(inputs[seekto + j], 0);
+          CHECK_EQ(interp->RamChecksum(), aot->RamChecksum())
+            << seekto << " + " << j;
+        }
+      }
+    }
+  }
+
+  Update("Approximate image.");
+  {
+    // This is synthesized from PPU state, so it should not matter
+    // whether the frame was actually rendered. It should also be
+    // close to the real thing, though some effects (like status bars
+    // that change the vertical scroll) aren't reproduced.
+    int64 differing = 0, total = 0;
+    for (int i = 0; i < 20; i++) {
+      const int seekto = Rand(saves.size() - 1);
+      emu->LoadUncompressed(saves[seekto]);
+      emu->Step(inputs[seekto], 0);
+      const vector<uint8> headless = emu->GetApproximateImage();
+      emu->LoadUncompressed(saves[seekto]);
+      emu->StepFull(inputs[seekto], 0);
+      const vector<uint8> approx = emu->GetApproximateImage();
+      CHECK(headless == approx) << seekto;
+      const vector<uint8> actual = emu->GetImage();
+      for (int p = 0; p < 256 * 240; p++)
+        if (memcmp(&approx[p * 4], &actual[p * 4], 4) != 0) differing++;
+      total += 256 * 240;
+    }
+    CHECK(differing * 20 <= total) << differing << " of " << total
+                                   << " pixels differ.";
+  }
+
+  Update("RAM watch.");
+  {
+    // The log has to say exactly what comparing GetMemory before and
+    // after each frame would, with one record per changed location.
+    // Every other address, so that every page (zero page and stack
+    // included) is watched, but not every location on it.
+    vector<uint16> evens;
+    for (int a = 0; a < 0x800; a += 2) evens.push_back(a);
+    vector<RAMWatch::Change> log;
+    for (int i = 0; i < 5; i++) {
+      const int seekto = Rand(saves.size() - 1);
+      emu->LoadUncompressed(saves[seekto]);
+      emu->WatchRAM(evens, 4096);
+      vector<uint8> before = emu->GetMemory();
+      for (int j = 0; j < 50 && seekto + j + 1 < saves.size(); j++) {
+        emu->Step(inputs[seekto + j], 0);
+        CHECK_RAM(checksums[seekto + j + 1]);
+        const vector<uint8> after = emu->GetMemory();
+        log.clear();
+        CHECK_EQ(0, emu->TakeRAMChanges(&log));
+        vector<bool> logged(0x800, false);
+        for (const RAMWatch::Change &c : log) {
+          CHECK(c.addr < 0x800 && c.addr % 2 == 0) << c.addr;
+          CHECK(!logged[c.addr]) << "Not coalesced: " << c.addr;
+          logged[c.addr] = true;
+          CHECK_EQ(j, c.frame);
+          CHECK_EQ(before[c.addr], c.old_value) << c.addr;
+          CHECK_EQ(after[c.addr], c.new_value) << c.addr;
+        }
+        for (uint16 a : evens)
+          CHECK(before[a] == after[a] || logged[a]) << "Missed " << a;
+        before = after;
+      }
+      emu->UnwatchRAM();
+    }
+
+    // Writes through the mirrors at $0800-$1FFF are logged under the
+    // underlying address, and the CPU can't bypass the handler for
+    // them. Several writes to a location in one frame make a single
+    // record, even if the last one puts back the original value.
+    FC *fc = emu->GetFC();
+    emu->LoadUncompressed(saves[Rand(saves.size())]);
+    emu->WatchRAM({0x012, 0x345}, 16);
+    CHECK(fc->fceu->write_fast[0x13] == nullptr);
+    CHECK(fc->fceu->write_fast[0x12] != nullptr);
+    auto CPUWrite = [fc](uint16 a, uint8 v) {
+      fc->fceu->BWrite[a](fc, a, v);
+    };
+    const vector<uint8> mem = emu->GetMemory();
+    CPUWrite(0x0812, mem[0x012] ^ 0x01);
+    CPUWrite(0x1812, mem[0x012] ^ 0x80);
+    CPUWrite(0x0B45, mem[0x345] ^ 0x01);
+    CPUWrite(0x1345, mem[0x345]);
+    CPUWrite(0x0813, mem[0x013] ^ 0x01);
+    log.clear();
+    CHECK_EQ(0, emu->TakeRAMChanges(&log));
+    CHECK_EQ(2, log.size());
+    CHECK_EQ(0x012, log[0].addr);
+    CHECK_EQ(mem[0x012], log[0].old_value);
+    CHECK_EQ(mem[0x012] ^ 0x80, log[0].new_value);
+    CHECK_EQ(0x345, log[1].addr);
+    CHECK_EQ(mem[0x345], log[1].old_value);
+    CHECK_EQ(mem[0x345], log[1].new_value);
+    emu->UnwatchRAM();
+
+    // When the ring overflows, the oldest records are dropped and
+    // counted. Those that remain are the same as without overflow.
+    // (There can be more records in total, because a location whose
+    // record was dropped gets another one if it's written again in
+    // the same frame.)
+    vector<uint16> all;
+    for (int a = 0; a < 0x800; a++) all.push_back(a);
+    const int seekto = Rand(saves.size() - 20);
+    emu->LoadUncompressed(saves[seekto]);
+    emu->WatchRAM(all, 65536);
+    for (int j = 0; j < 20; j++) emu->Step(inputs[seekto + j], 0);
+    vector<RAMWatch::Change> full;
+    CHECK_EQ(0, emu->TakeRAMChanges(&full));
+    CHECK(full.size() > 8) << full.size();
+    emu->LoadUncompressed(saves[seekto]);
+    emu->WatchRAM(all, 8);
+    for (int j = 0; j < 20; j++) emu->Step(inputs[seekto + j], 0);
+    log.clear();
+    const int64 lost = emu->TakeRAMChanges(&log);
+    CHECK_EQ(8, log.size());
+    CHECK(lost + 8 >= full.size()) << lost << " " << full.size();
+    CHECK_EQ(full.back().frame, log.back().frame);
+    for (const RAMWatch::Change &c : log) {
+      auto it = std::find_if(full.begin(), full.end(),
+                             [&c](const RAMWatch::Change &f) {
+                               return f.frame == c.frame && f.addr == c.addr;
+                             });
+      CHECK(it != full.end()) << c.frame << " " << c.addr;
+      CHECK(it->old_value == c.old_value && it->new_value == c.new_value)
+        << c.frame << " " << c.addr;
+    }
+
+    // Compiled code isn't used while watching, but should be again
+    // afterwards. (Only observable with the perf counters, which
+    // don't count instructions that it runs.)
+    emu->UnwatchRAM();
+    CHECK(fc->fceu->write_fast[0x00] == fc->fceu->RAM);
+    if (fc->X->aot != nullptr && Emulator::HasPerfCounters()) {
+      auto Instructions = [&](bool watch) {
+        emu->LoadUncompressed(saves[seekto]);
+        if (watch) emu->WatchRAM(all, 16);
+        emu->ResetPerfCounters();
+        for (int j = 0; j < 20; j++) emu->Step(inputs[seekto + j], 0);
+        emu->UnwatchRAM();
+        return emu->GetPerfCounters().instructions;
+      };
+      const int64 watched = Instructions(true);
+      const int64 unwatched = Instructions(false);
+      CHECK(unwatched < watched) << unwatched << " " << watched;
+    }
+    emu->LoadUncompressed(saves[seekto]);
+    for (int j = 0; j < 20; j++) {
+      emu->Step(inputs[seekto + j], 0);
+      CHECK_RAM(checksums[seekto + j + 1]);
+    }
+  }
+
   if (false && FULL) {
     // fprintf(stderr, "Random seeks (compressed):\n");
     Update("Random seeks (compressed).");
@@ -597,6 +906,8 @@ int main(int argc, char **argv) {
       if (romdir[romdir.size() - 1] != '/') romdir += '/';
     } else if (arg == "--nocollage") {
       write_collage = false;
+    } else if (arg == "--aot") {
+      AOT = true;
     }
   }
   if (COMPREHENSIVE) {
@@ -41,6 +41,7 @@
 #include "palette.h"
 #include "state.h"
 #include "input.h"
+#include "ram-watch.h"
 #include "file.h"
 #include "vsuni.h"
 #include "ines.h"
@@ -110,9 +111,11 @@ void FCEU::SetWriteHandler(int32 start, int32 end, writefunc func) {
   for (int32 x = start; x <= end; x++) {
     BWrite[x] = func;
   }
+  ClassifyPages(start, end);
 }
 
 FCEU::~FCEU() {
+  delete ram_watch;
   free(GameMemBlock);
   free(RAM);
   free(XBuf);
@@ -121,11 +124,16 @@ FCEU::~FCEU() {
 
 
 static DECLFW(WriteRamNoMask) {
-  fc->fceu->RAM[A] = V;
+  uint8 *ram = fc->fceu->RAM;
+  if (RAMWatch *watch = fc->fceu->ram_watch) watch->Write(A, ram[A], V);
+  ram[A] = V;
 }
 
 static DECLFW(WriteRamMask) {
-  fc->fceu->RAM[A & 0x7FF] = V;
+  uint8 *ram = fc->fceu->RAM;
+  A &= 0x7FF;
+  if (RAMWatch *watch = fc->fceu->ram_watch) watch->Write(A, ram[A], V);
+  ram[A] = V;
 }
 
 static DECLFR(ReadRamNoMask) {
@@ -136,6 +144,64 @@ static DECLFR(ReadRamMask) {
   return fc->fceu->RAM[A & 0x7FF];
 }
 
+void FCEU::ClassifyPages(int32 start, int32 end) {
+  for (int32 page = start >> 8; page <= (end >> 8); page++) {
+    const int32 base = page << 8;
+    // Only if the whole page has the same handler.
+    bool same_read = true, same_write = true;
+    for (int32 a = base + 1; a < base + 256; a++) {
+      same_read = same_read && ARead[a] == ARead[base];
+      same_write = same_write && BWrite[a] == BWrite[base];
+    }
+
+    const readfunc r = ARead[base];
+    if (!same_read) read_kind[page] = PAGE_HANDLER;
+    else if (r == ReadRamNoMask || r == ReadRamMask)
+      read_kind[page] = PAGE_RAM;
+    else if (r == Cart::CartBR || r == Cart::CartBROB)
+      read_kind[page] = PAGE_CART;
+    else read_kind[page] = PAGE_HANDLER;
+
+    const writefunc w = BWrite[base];
+    if (!same_write) write_kind[page] = PAGE_HANDLER;
+    else if (w == WriteRamNoMask || w == WriteRamMask)
+      write_kind[page] = PAGE_RAM;
+    else if (w == Cart::CartBW)
+      write_kind[page] = PAGE_CART;
+    else write_kind[page] = PAGE_HANDLER;
+  }
+  UpdateFastPages(start, end);
+}
+
+void FCEU::UpdateFastPages(int32 start, int32 end) {
+  for (int32 page = start >> 8; page <= (end >> 8); page++) {
+    // RAM is mirrored every 0x800 bytes; offset so that
+    // ram_page[A] is RAM[A & 0x7FF].
+    uint8 *ram_page = RAM + ((page & 7) << 8) - (page << 8);
+
+    switch (read_kind[page]) {
+    case PAGE_RAM: read_fast[page] = ram_page; break;
+    // Null (unmapped) pages go through the handler, which knows what
+    // to do with them.
+    case PAGE_CART: read_fast[page] = fc->cart->PageIdentity(page >> 3);
+      break;
+    default: read_fast[page] = nullptr; break;
+    }
+
+    switch (write_kind[page]) {
+    case PAGE_RAM:
+      // Watched pages go through the handler so that it can log.
+      write_fast[page] =
+        (ram_watch != nullptr && ram_watch->WatchesPage(page & 7)) ?
+        nullptr : ram_page;
+      break;
+    // Null unless it's mapped to PRG RAM.
+    case PAGE_CART: write_fast[page] = fc->cart->RAMPage(page >> 3); break;
+    default: write_fast[page] = nullptr; break;
+    }
+  }
+}
+
 void FCEU::ResetGameLoaded() {
   if (GameInfo) FCEU_CloseGame();
   GameStateRestore = nullptr;
@@ -219,25 +285,29 @@ bool FCEU::FCEUI_Initialize() {
 }
 
 // Emulates a single frame.
-// "skip" no longer does anything for PPU; I'm trying to accomplish this
-// with compile-time flags instead. Probably should remove it entirely.
-//  -tom7
-void FCEU::FCEUI_Emulate(int skip) {
+// Without video, the PPU runs headless (see PPU::headless). Without
+// sound, the channels are muted (see Sound::muted) and the sound
+// buffer is not flushed at the end of the frame.
+void FCEU::FCEUI_Emulate(bool video, bool sound) {
   fc->input->UpdateInput();
+  PERFCOUNT(fc->X->perf.frames++);
 
   // fprintf(stderr, "ppu loop..\n");
 
+  fc->ppu->headless = DISABLE_VIDEO || !video;
+  fc->sound->muted = DISABLE_SOUND || !sound;
   fc->ppu->FrameLoop();
 
-  // fprintf(stderr, "sound thing loop skip=%d..\n", skip);
+  // fprintf(stderr, "sound thing loop sound=%d..\n", sound);
 
-  // If skip = 2 we are skipping sound processing
-  if (skip != 2)
+  if (sound)
     (void)fc->sound->FlushEmulateSound();
 
   // This is where cheat list stuff happened.
   timestampbase += fc->X->timestamp;
   fc->X->timestamp = 0;
+
+  if (ram_watch != nullptr) ram_watch->EndFrame();
 }
 
 void FCEU::ResetNES() {
@@ -331,6 +401,7 @@ void FCEU::SetReadHandler(int32 start, int32 end, readfunc func) {
   for (int x = start; x <= end; x++) {
     ARead[x] = func;
   }
+  ClassifyPages(start, end);
 }
 
 // This is kind of silly since it just eta-expands printf with
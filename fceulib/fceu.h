@@ -46,6 +46,7 @@ enum EFCEUI {
 
 struct CartInterface;
 struct MapInterface;
+struct RAMWatch;
 
 struct FCEU {
   explicit FCEU(FC *fc);
@@ -69,8 +70,9 @@ struct FCEU {
   // Weird thing only used in Barcode game, but probably still working.
   int FCEUI_DatachSet(const uint8 *rcode);
 
-  // Emulates a frame.
-  void FCEUI_Emulate(int video_and_sound_flags);
+  // Emulates a frame, producing the video (XBuf) and sound output
+  // only if requested.
+  void FCEUI_Emulate(bool video, bool sound);
 
   void ResetMapping();
   void ResetNES();
@@ -104,6 +106,37 @@ struct FCEU {
   readfunc ARead[0x10000];
   writefunc BWrite[0x10000];
 
+  // Fast paths for the CPU, per 256-byte page. If read_fast[A >> 8]
+  // is non-null, then reading A is the same as read_fast[A >> 8][A]
+  // (note the pointers are offset like Cart::Page, so they are
+  // indexed by the full address), without calling ARead[A]; same for
+  // write_fast and BWrite. This is only the case for pages whose
+  // handlers are all plain RAM or cart reads/writes. These are
+  // derived from the handler tables and the cart's page mapping, so
+  // they are maintained automatically by SetReadHandler,
+  // SetWriteHandler, and the Cart's bank switching functions.
+  const uint8 *read_fast[256] = {};
+  uint8 *write_fast[256] = {};
+
+  // Recompute the fast paths for the pages overlapping addresses
+  // [start, end] (inclusive, like SetReadHandler). ClassifyPages
+  // needs to be called by anything that modifies ARead/BWrite
+  // directly. UpdateFastPages is cheaper and suffices when only
+  // the memory that the handlers map to has changed, as in bank
+  // switching.
+  void ClassifyPages(int32 start, int32 end);
+  void UpdateFastPages(int32 start, int32 end);
+
+  // If non-null, writes to the watched RAM locations are logged
+  // here (see ram-watch.h). Owned. Watched pages don't get a
+  // write_fast path, so UpdateFastPages needs to be called after
+  // changing this.
+  RAMWatch *ram_watch = nullptr;
+  // Bit p is set if ram_watch watches anything in the 256-byte RAM
+  // page p. The CPU's zero page and stack writes store directly
+  // unless their page is watched; see X6502::WrRAM.
+  uint8 ram_watched_pages = 0;
+
   void (*GameInterface)(FC *fc, GI h) = nullptr;
   void (*GameStateRestore)(FC *fc, int version) = nullptr;
 
@@ -138,6 +171,16 @@ struct FCEU {
   MapInterface *mapiface = nullptr;
 
 private:
+  // What the handlers on a 256-byte page do, if it's something the
+  // fast path can do instead.
+  enum PageKind : uint8 {
+    PAGE_HANDLER = 0,
+    PAGE_RAM,
+    PAGE_CART,
+  };
+  PageKind read_kind[256] = {};
+  PageKind write_kind[256] = {};
+
   readfunc *AReadG = nullptr;
   writefunc *BWriteG = nullptr;
 
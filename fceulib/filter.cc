@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include "types.h"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "sound.h"
 #include "x6502.h"
 #include "fceu.h"
@@ -15,6 +19,74 @@
 
 Filter::Filter(FC *fc) : fc(fc) {}
 
+// The FIR inner loop. Computes the sums of (S[1 + m] * D[m]) >> 6 and
+// (S[2 + m] * D[m]) >> 6 for m in [0, n), with the same 32-bit
+// wrapping arithmetic as the scalar code, so the output is identical
+// whichever version is compiled in. (NeoFilterSound walks the
+// coefficients backwards; the tables are symmetric.)
+#if defined(__SSE2__)
+static inline __m128i MulLo32(__m128i a, __m128i b) {
+# if defined(__SSE4_1__)
+  return _mm_mullo_epi32(a, b);
+# else
+  // The low 32 bits of the product are the same for signed and
+  // unsigned, so use the unsigned 32x32->64 multiply on the even
+  // and odd lanes.
+  const __m128i even = _mm_mul_epu32(a, b);
+  const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32),
+                                    _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+# endif
+}
+
+static inline int32 HorizontalSum(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+#endif
+
+static inline void FIR2(const int32 *S, const int32 *D, int n,
+                        int32 *acc_out, int32 *acc2_out) {
+  int m = 0;
+  // Accumulated as uint32 to get wrapping without undefined behavior.
+  uint32 acc = 0, acc2 = 0;
+#if defined(__AVX2__)
+  __m256i vacc = _mm256_setzero_si256(), vacc2 = _mm256_setzero_si256();
+  for (; m + 8 <= n; m += 8) {
+    const __m256i d = _mm256_loadu_si256((const __m256i *)(D + m));
+    const __m256i s1 = _mm256_loadu_si256((const __m256i *)(S + 1 + m));
+    const __m256i s2 = _mm256_loadu_si256((const __m256i *)(S + 2 + m));
+    vacc = _mm256_add_epi32(
+        vacc, _mm256_srai_epi32(_mm256_mullo_epi32(s1, d), 6));
+    vacc2 = _mm256_add_epi32(
+        vacc2, _mm256_srai_epi32(_mm256_mullo_epi32(s2, d), 6));
+  }
+  acc += HorizontalSum(_mm_add_epi32(_mm256_castsi256_si128(vacc),
+                                     _mm256_extracti128_si256(vacc, 1)));
+  acc2 += HorizontalSum(_mm_add_epi32(_mm256_castsi256_si128(vacc2),
+                                      _mm256_extracti128_si256(vacc2, 1)));
+#elif defined(__SSE2__)
+  __m128i vacc = _mm_setzero_si128(), vacc2 = _mm_setzero_si128();
+  for (; m + 4 <= n; m += 4) {
+    const __m128i d = _mm_loadu_si128((const __m128i *)(D + m));
+    const __m128i s1 = _mm_loadu_si128((const __m128i *)(S + 1 + m));
+    const __m128i s2 = _mm_loadu_si128((const __m128i *)(S + 2 + m));
+    vacc = _mm_add_epi32(vacc, _mm_srai_epi32(MulLo32(s1, d), 6));
+    vacc2 = _mm_add_epi32(vacc2, _mm_srai_epi32(MulLo32(s2, d), 6));
+  }
+  acc += HorizontalSum(vacc);
+  acc2 += HorizontalSum(vacc2);
+#endif
+  for (; m < n; m++) {
+    acc += (uint32)((int32)((uint32)S[1 + m] * (uint32)D[m]) >> 6);
+    acc2 += (uint32)((int32)((uint32)S[2 + m] * (uint32)D[m]) >> 6);
+  }
+  *acc_out = (int32)acc;
+  *acc2_out = (int32)acc2;
+}
+
 void Filter::SexyFilter2(int32 *in, int32 count) {
   while (count--) {
     const int64 dropcurrent = ((*in << 16) - sexyfilter2_acc) >> 3;
@@ -75,15 +147,8 @@ int32 Filter::NeoFilterSound(int32 *in, int32 *out, uint32 inlen,
 
   if (FCEUS_SOUNDQ == 2) {
     for (x = mrindex; x < max; x += mrratio) {
-      int32 acc = 0, acc2 = 0;
-      const int32 *S = &in[(x >> 16) - SQ2NCOEFFS];
-      const int32 *D = sq2coeffs;
-
-      for (unsigned int c = SQ2NCOEFFS; c; c--) {
-        acc += (S[c] * *D) >> 6;
-        acc2 += (S[1 + c] * *D) >> 6;
-        D++;
-      }
+      int32 acc, acc2;
+      FIR2(&in[(x >> 16) - SQ2NCOEFFS], sq2coeffs, SQ2NCOEFFS, &acc, &acc2);
 
       acc = ((int64)acc * (65536 - (x & 65535)) + (int64)acc2 * (x & 65535)) >>
             (16 + 11);
@@ -93,15 +158,8 @@ int32 Filter::NeoFilterSound(int32 *in, int32 *out, uint32 inlen,
     }
   } else {
     for (x = mrindex; x < max; x += mrratio) {
-      int32 acc = 0, acc2 = 0;
-      const int32 *S = &in[(x >> 16) - NCOEFFS];
-      const int32 *D = coeffs;
-
-      for (unsigned int c = NCOEFFS; c; c--) {
-        acc += (S[c] * *D) >> 6;
-        acc2 += (S[1 + c] * *D) >> 6;
-        D++;
-      }
+      int32 acc, acc2;
+      FIR2(&in[(x >> 16) - NCOEFFS], coeffs, NCOEFFS, &acc, &acc2);
 
       acc = ((int64)acc * (65536 - (x & 65535)) + (int64)acc2 * (x & 65535)) >>
             (16 + 11);
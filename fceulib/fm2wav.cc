@@ -44,7 +44,9 @@ int main(int argc, char **argv) {
   vector<uint16> samples;
 
   for (const pair<uint8, uint8> input : movie) {
-    emu->StepFull(input.first, input.second);
+    // No need to draw the pixels.
+    emu->StepWith(((uint16)input.second << 8) | input.first,
+                  Emulator::OUTPUT_SOUND);
 
     // Sound.
     vector<int16> sound;
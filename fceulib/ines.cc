@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <memory>
+#include <mutex>
 #include <string>
 
 #include "types.h"
@@ -121,9 +123,12 @@ void INes::iNESGI(GI h) {
     fc->cart->FCEU_SaveGameSave(&iNESCart);
 
     fc->fceu->cartiface->Close();
-    free(ROM);
+    // ROM and CHR ROM belong to the (maybe shared) cart image, but
+    // CHR RAM is our own.
+    cart_image.reset();
     ROM = nullptr;
-    free(VROM);
+    if (CHRRAMSize != -1)
+      free(VROM);
     VROM = nullptr;
 
     if (fc->fceu->mapiface)
@@ -446,7 +451,7 @@ void INes::CheckHInfo() {
       if (ines_correct[x].mapper>=0) {
         if (ines_correct[x].mapper&0x800 && VROM_size) {
           VROM_size=0;
-          free(VROM);
+          // Still owned by cart_image.
           VROM = nullptr;
           tofix|=8;
         }
@@ -801,6 +806,53 @@ static constexpr BoardMapping const board_map[] = {
   {"", 0, nullptr},
 };
 
+INes::CartImage::~CartImage() {
+  free(rom);
+  free(vrom);
+}
+
+// Process-wide, so that every emulator running the same game maps
+// the same ROM pages. Keyed by the image's MD5 and header. The cache
+// only holds weak references; an image is freed when the last
+// emulator using it closes the game.
+namespace {
+struct CartImageCache {
+  std::mutex m;
+  std::map<std::string, std::weak_ptr<const INes::CartImage>> images;
+};
+}  // namespace
+
+static CartImageCache *GetCartImageCache() {
+  // Never destroyed, since emulators may outlive static destructors.
+  static CartImageCache *cache = new CartImageCache;
+  return cache;
+}
+
+std::shared_ptr<const INes::CartImage>
+INes::InternCartImage(CartImage *fresh) {
+  std::shared_ptr<const CartImage> image(fresh);
+  const std::string key =
+    std::string((const char *)fresh->md5, sizeof fresh->md5) +
+    std::string((const char *)fresh->header, sizeof fresh->header);
+
+  CartImageCache *cache = GetCartImageCache();
+  std::lock_guard<std::mutex> ml(cache->m);
+  auto it = cache->images.find(key);
+  if (it != cache->images.end()) {
+    std::shared_ptr<const CartImage> existing = it->second.lock();
+    if (existing.get() != nullptr)
+      return existing;
+  }
+
+  // Don't let dead entries accumulate.
+  for (auto dit = cache->images.begin(); dit != cache->images.end();) {
+    if (dit->second.expired()) dit = cache->images.erase(dit);
+    else ++dit;
+  }
+  cache->images[key] = image;
+  return image;
+}
+
 // moved from utils/general -tom7
 static uint32 uppow2(uint32 n) {
   for (int x = 31; x >= 0; x--) {
@@ -848,6 +900,18 @@ bool INes::iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode) {
   if (memcmp(&head,"NES\x1a",4))
     return false;
 
+  // Can we reuse the image from a previous load (e.g. a clone)?
+  std::shared_ptr<const CartImage> image;
+  if (cart_image.get() != nullptr &&
+      0 == memcmp(cart_image->header, &head, sizeof (head))) {
+    image = cart_image;
+  }
+  cart_image.reset();
+
+  uint8 raw_header[16];
+  static_assert(sizeof (head) == sizeof (raw_header), "iNES header");
+  memcpy(raw_header, &head, sizeof (raw_header));
+
   CleanupHeader(&head);
 
   memset(&iNESCart, 0, sizeof(iNESCart));
@@ -866,22 +930,27 @@ bool INes::iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode) {
   uint32 rom_size_to_read;
   std::tie(ROM_size, rom_size_to_read) = GetRoundedROMSize();
 
-  ROM = (uint8 *)FCEU_malloc(ROM_size << 14);
-  if (ROM == nullptr) return false;
-  memset(ROM, 0xFF, ROM_size << 14);
-
-  if (head.VROM_size) {
-    VROM_size = uppow2(head.VROM_size);
+  VROM_size = head.VROM_size ? uppow2(head.VROM_size) : 0;
 
-    VROM = (uint8 *)FCEU_malloc(VROM_size << 13);
-    if (VROM == nullptr) {
-      free(ROM);
-      ROM = nullptr;
-      return false;
-    }
-    memset(VROM, 0xFF, VROM_size << 13);
+  if (image.get() != nullptr) {
+    ROM = image->rom;
+    VROM = image->vrom;
   } else {
-    VROM_size = 0;
+    ROM = (uint8 *)FCEU_malloc(ROM_size << 14);
+    if (ROM == nullptr) return false;
+    memset(ROM, 0xFF, ROM_size << 14);
+
+    if (VROM_size) {
+      VROM = (uint8 *)FCEU_malloc(VROM_size << 13);
+      if (VROM == nullptr) {
+        free(ROM);
+        ROM = nullptr;
+        return false;
+      }
+      memset(VROM, 0xFF, VROM_size << 13);
+    } else {
+      VROM = nullptr;
+    }
   }
 
   /* Trainer */
@@ -893,28 +962,47 @@ bool INes::iNESLoad(const char *name, FceuFile *fp, int OverwriteVidMode) {
   fc->cart->ResetCartMapping();
   fc->state->ResetExState(nullptr, nullptr);
 
-  // iNES is responsible for setting up the main ROM (chip 0).
-  fc->cart->SetupCartPRGMapping(0, ROM, ROM_size << 14, false);
-  // SetupCartPRGMapping(1,WRAM,8192,1);
-
-  // Read the appropriate number of 16k chunks from the file into
-  // ROM. We may not fill all of ROM here, since it may have been
-  // rounded up.
-  FCEU_fread(ROM, 0x4000, rom_size_to_read, fp);
+  if (image.get() != nullptr) {
+    // Already read and hashed.
+    iNESGameCRC32 = image->crc32;
+    memcpy(iNESCart.MD5, image->md5, sizeof iNESCart.MD5);
+  } else {
+    // Read the appropriate number of 16k chunks from the file into
+    // ROM. We may not fill all of ROM here, since it may have been
+    // rounded up.
+    FCEU_fread(ROM, 0x4000, rom_size_to_read, fp);
 
-  if (VROM_size)
-    FCEU_fread(VROM, 0x2000, head.VROM_size, fp);
+    if (VROM_size)
+      FCEU_fread(VROM, 0x2000, head.VROM_size, fp);
 
-  md5_starts(&md5);
-  md5_update(&md5, ROM, ROM_size << 14);
+    md5_starts(&md5);
+    md5_update(&md5, ROM, ROM_size << 14);
 
-  iNESGameCRC32 = CalcCRC32(0, ROM, ROM_size << 14);
+    iNESGameCRC32 = CalcCRC32(0, ROM, ROM_size << 14);
 
-  if (VROM_size) {
-    iNESGameCRC32 = CalcCRC32(iNESGameCRC32, VROM, VROM_size << 13);
-    md5_update(&md5, VROM, VROM_size << 13);
+    if (VROM_size) {
+      iNESGameCRC32 = CalcCRC32(iNESGameCRC32, VROM, VROM_size << 13);
+      md5_update(&md5, VROM, VROM_size << 13);
+    }
+    md5_finish(&md5, iNESCart.MD5);
+
+    CartImage *fresh = new CartImage;
+    memcpy(fresh->header, raw_header, sizeof (raw_header));
+    fresh->rom = ROM;
+    fresh->vrom = VROM;
+    memcpy(fresh->md5, iNESCart.MD5, sizeof iNESCart.MD5);
+    fresh->crc32 = iNESGameCRC32;
+    // If another emulator already has this cart loaded, this frees
+    // our copy and gives back theirs.
+    image = InternCartImage(fresh);
+    ROM = image->rom;
+    VROM = image->vrom;
   }
-  md5_finish(&md5, iNESCart.MD5);
+  cart_image = std::move(image);
+
+  // iNES is responsible for setting up the main ROM (chip 0).
+  fc->cart->SetupCartPRGMapping(0, ROM, ROM_size << 14, false);
+  // SetupCartPRGMapping(1,WRAM,8192,1);
   memcpy(&fc->fceu->GameInfo->MD5, &iNESCart.MD5, sizeof iNESCart.MD5);
 
   iNESCart.CRC32 = iNESGameCRC32;
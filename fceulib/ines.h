@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include "fceu.h"
@@ -80,10 +81,37 @@ struct INes {
   // Number of 16k blocks (0x4000 bytes). Rounds up
   uint32 ROM_size = 0;
 
-  // Actual ROM and video ROM read directly from file.
+  // Actual ROM and video ROM read directly from file. These point
+  // into cart_image and must not be modified. (If the cart has no
+  // CHR ROM, VROM is instead this instance's CHR RAM.)
   uint8 *ROM = nullptr;
   uint8 *VROM = nullptr;
 
+  // The immutable contents of the cartridge, as read from the file.
+  // This can be shared by reference between emulator instances
+  // running the same game; see Emulator::Clone.
+  struct CartImage {
+    CartImage() {}
+    ~CartImage();
+    // The 16-byte iNES header, before cleanup.
+    uint8 header[16] = {};
+    // Owned. Sizes are as in ROM_size and VROM_size before any
+    // corrections from CheckHInfo.
+    uint8 *rom = nullptr;
+    uint8 *vrom = nullptr;
+    uint8 md5[16] = {};
+    uint32 crc32 = 0;
+   private:
+    CartImage(const CartImage &) = delete;
+    CartImage &operator =(const CartImage &) = delete;
+  };
+  // Set after a successful load. If this is already set to the image
+  // of the same cartridge before calling iNESLoad, then that image is
+  // used instead of reading the ROM from the file again. Otherwise,
+  // images are also shared with any other emulator in the process
+  // that has the same cartridge loaded.
+  std::shared_ptr<const CartImage> cart_image;
+
   // These perform bank switching, but I'm not sure how they're related
   // to the ones in Cart. Perhaps these are only for old-style mappers?
   // TODO: Maybe should be members of INes.
@@ -113,6 +141,11 @@ struct INes {
   Header head;
   void CleanupHeader(Header *h);
 
+  // Takes ownership of a freshly loaded image and returns the
+  // process-wide shared image with the same contents (which may be
+  // the argument). Thread-safe.
+  static std::shared_ptr<const CartImage> InternCartImage(CartImage *fresh);
+
   uint8 *trainerdata = nullptr;
 
   int mapper_number = 0;
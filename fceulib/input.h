@@ -84,6 +84,13 @@ struct Input {
 
   // called from PPU on scanline events.
   void InputScanlineHook(uint8 *bg, uint8 *spr, uint32 linets, int last);
+  // True if an attached device (a light gun) looks at the rendered
+  // pixels passed to InputScanlineHook, so the PPU can't skip
+  // drawing them.
+  bool ScanlineHookNeedsPixels() const {
+    return joyports[0].type == SI_ZAPPER || joyports[1].type == SI_ZAPPER ||
+      portFC.type == SIFC_SHADOW;
+  }
 
   const std::vector<SFORMAT> &FCEUINPUT_STATEINFO() { return stateinfo; }
 
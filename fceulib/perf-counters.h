@@ -0,0 +1,50 @@
+/*
+  Counters for where emulated frames spend their time. Only collected
+  when compiled with FCEU_PERF_COUNTERS=1 (see the makefile); the
+  increments are in the hottest loops of the emulator, so the default
+  build compiles them out entirely. See Emulator::GetPerfCounters.
+*/
+
+#ifndef __PERF_COUNTERS_H
+#define __PERF_COUNTERS_H
+
+#include "types.h"
+
+#ifndef FCEU_PERF_COUNTERS
+#define FCEU_PERF_COUNTERS 0
+#endif
+
+// Wraps a statement that updates a counter, like
+// PERFCOUNT(fc->X->perf.ppu_lines++), so that it disappears when
+// the counters are not compiled in.
+#if FCEU_PERF_COUNTERS
+#define PERFCOUNT(stmt) do { stmt; } while (0)
+#else
+#define PERFCOUNT(stmt) do { } while (0)
+#endif
+
+struct PerfCounters {
+  // Calls to FCEUI_Emulate (any kind of Step).
+  int64 frames = 0;
+  // Instructions executed by the interpreter. Code run by an
+  // ahead-of-time compiled game (Emulator::SetAOT) is not counted.
+  int64 instructions = 0;
+  // Interrupts actually taken by the CPU.
+  int64 irqs = 0;
+  int64 nmis = 0;
+  // CPU cycles stolen for DMA (sprite OAM and DMC sample fetches).
+  int64 dma_cycles = 0;
+  // Calls to PPU::DoLine, i.e. visible scanlines.
+  int64 ppu_lines = 0;
+  // Calls to the mapper's per-instruction IRQ hook (X6502::MapIRQHook)
+  // and per-scanline hook (PPU::GameHBIRQHook).
+  int64 mapper_cpu_hooks = 0;
+  int64 mapper_scanline_hooks = 0;
+  // CPU memory accesses that had to call the ARead/BWrite handler
+  // (rather than using FCEU::read_fast/write_fast), by 256-byte page
+  // of the address. I/O registers and mapper registers end up here.
+  int64 handler_reads[256] = {};
+  int64 handler_writes[256] = {};
+};
+
+#endif
@@ -50,14 +50,8 @@
 #include "driver.h"
 #include "fsettings.h"
 
-// XXX better way of doing this...
-#if ENABLE_AOT
-// XXX get from some generated header...
-extern void contra_Run(FC *fc, int32 cycles);
-#define Run6502(c) contra_Run(fc, c)
-#else
+// X6502::Run dispatches to ahead-of-time compiled code if enabled.
 #define Run6502(c) fc->X->Run(c)
-#endif
 
 #define DEBUGF if (0) fprintf
 // #define DCHECK if (0)
@@ -695,6 +689,9 @@ inline std::pair<uint32, uint8 *> PPU::PPUTile(const int X1, uint8 *P,
   return std::make_pair(refreshaddr_local, P);
 }
 
+// Once rendering gets this far, the vertical scroll is incremented.
+static constexpr int TOFIXNUM = 272 - 0x4;
+
 // lasttile is really "second to last tile."
 void PPU::RefreshLine(int lastpixel) {
   // Not clear why we make a backup copy of this -- probably so that
@@ -727,11 +724,15 @@ void PPU::RefreshLine(int lastpixel) {
 
   if (numtiles <= 0) return;
 
+  if (skip_pixels && sprite_hit_x == 0x100) {
+    SkipLine(lastpixel, lasttile);
+    return;
+  }
+
   uint8 *P = Pline;
 
   uint32 vofs = ((PPU_values[0]&0x10)<<8) | ((refreshaddr_local>>12)&7);
 
-  static constexpr int TOFIXNUM = 272 - 0x4;
   if (!ScreenON && !SpriteON) {
     const uint32 tmp =
       PALRAM[0] | (PALRAM[0] << 8) | (PALRAM[0] << 16) | (PALRAM[0] << 24) |
@@ -891,6 +892,46 @@ void PPU::RefreshLine(int lastpixel) {
   firsttile = lasttile;
 }
 
+// Does the same as RefreshLine up to lastpixel, as far as anything
+// but the pixels is concerned. In particular, we still need to
+// update RefreshAddr, and the background fetch pipeline (pshift,
+// atlatch) which is part of the savestate.
+void PPU::SkipLine(int lastpixel, int lasttile) {
+  const int numtiles = lasttile - firsttile;
+  if (!ScreenON && !SpriteON) {
+    Pline += numtiles * 8;
+  } else {
+    uint32 refreshaddr_local = RefreshAddr;
+    const uint32 vofs =
+      ((PPU_values[0]&0x10)<<8) | ((refreshaddr_local>>12)&7);
+    // Only the last four fetches are still in the pipeline, so the
+    // earlier ones just advance the address.
+    const int fetch_from = std::max(firsttile, lasttile - 4);
+    for (int X1 = firsttile; X1 < fetch_from; X1++) {
+      if ((refreshaddr_local & 0x1f) == 0x1f) {
+        refreshaddr_local ^= 0x41F;
+      } else {
+        refreshaddr_local++;
+      }
+    }
+    for (int X1 = fetch_from; X1 < lasttile; X1++) {
+      // Passing X1 = 0 means it doesn't draw.
+      refreshaddr_local =
+        PPUTile<false, false, false, false>(0, nullptr, vofs,
+                                            refreshaddr_local).first;
+    }
+    RefreshAddr = refreshaddr_local;
+    // Tiles 0 and 1 are not drawn.
+    Pline += std::max(0, lasttile - std::max(firsttile, 2)) * 8;
+  }
+  firsttile = lasttile;
+
+  if (lastpixel >= TOFIXNUM && tofix) {
+    Fixit1();
+    tofix = 0;
+  }
+}
+
 void PPU::Fixit2() {
   if (ScreenON || SpriteON) {
     uint32 rad=RefreshAddr;
@@ -922,10 +963,14 @@ void PPU::Fixit1() {
 }
 
 void PPU::DoLine() {
+  PERFCOUNT(fc->X->perf.ppu_lines++);
   #ifdef TRACK_INTERFRAME_SCROLL
   {
     interframe_x[scanline] = GetXScroll8();
     interframe_y[scanline] = GetYScroll8();
+    interframe_nt[scanline] = (TempAddr >> 10) & 3;
+    interframe_ctrl[scanline] = PPU_values[0];
+    interframe_mask[scanline] = PPU_values[1];
   }
   #endif
 
@@ -951,35 +996,40 @@ void PPU::DoLine() {
     FCEU_dwmemset(target, tmp, 256);
   }
 
-  if (SpriteON)
-    CopySprites(target);
+  if (SpriteON) {
+    if (skip_pixels) any_sprites_on_line = 0;
+    else CopySprites(target);
+  }
 
+  // The rest only modifies the pixels.
+  if (!skip_pixels) {
+    // What is this?? ANDs every byte in the buffer with 0x30 if PPU_values[1]
+    // has its lowest bit set (this indicates monochrome mode -tom7).
 
-  // What is this?? ANDs every byte in the buffer with 0x30 if PPU_values[1]
-  // has its lowest bit set (this indicates monochrome mode -tom7).
+    if (ScreenON || SpriteON) {
+      // Yes, very el-cheapo.
+      if (PPU_values[1] & 0x01) {
+        for (int x = 63; x >= 0; x--)
+          *(uint32 *)&target[x << 2] =
+            (*(uint32*)&target[x << 2]) & 0x30303030;
+      }
+    }
 
-  if (ScreenON || SpriteON) {
-    // Yes, very el-cheapo.
-    if (PPU_values[1] & 0x01) {
+    // This might be NTSC emphasis? Document. -tom7
+    if ((PPU_values[1] >> 5) == 0x7) {
+      for (int x = 63; x >= 0; x--)
+        *(uint32 *)&target[x << 2] =
+          ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0xc0c0c0c0;
+    } else if (PPU_values[1] & 0xE0) {
       for (int x = 63; x >= 0; x--)
-        *(uint32 *)&target[x << 2] = (*(uint32*)&target[x << 2]) & 0x30303030;
+        *(uint32 *)&target[x << 2] = (*(uint32*)&target[x << 2]) | 0x40404040;
+    } else {
+      for (int x = 63; x >= 0; x--)
+        *(uint32 *)&target[x << 2] =
+          ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0x80808080;
     }
   }
 
-  // This might be NTSC emphasis? Document. -tom7
-  if ((PPU_values[1] >> 5) == 0x7) {
-    for (int x = 63; x >= 0; x--)
-      *(uint32 *)&target[x << 2] =
-        ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0xc0c0c0c0;
-  } else if (PPU_values[1] & 0xE0) {
-    for (int x = 63; x >= 0; x--)
-      *(uint32 *)&target[x << 2] = (*(uint32*)&target[x << 2]) | 0x40404040;
-  } else {
-    for (int x = 63; x >= 0; x--)
-      *(uint32 *)&target[x << 2] =
-        ((*(uint32*)&target[x << 2]) & 0x3f3f3f3f) | 0x80808080;
-  }
-
   sprite_hit_x = 0x100;
 
   if (ScreenON || SpriteON)
@@ -990,6 +1040,7 @@ void PPU::DoLine() {
     Run6502(6);
     Fixit2();
     Run6502(4);
+    PERFCOUNT(fc->X->perf.mapper_scanline_hooks++);
     GameHBIRQHook(fc);
     Run6502(85 - 16 - 10);
   } else {
@@ -1000,6 +1051,7 @@ void PPU::DoLine() {
     // A semi-hack for Star Trek: 25th Anniversary
     if (GameHBIRQHook && (ScreenON || SpriteON) &&
 	((PPU_values[0] & 0x38) != 0x18)) {
+      PERFCOUNT(fc->X->perf.mapper_scanline_hooks++);
       GameHBIRQHook(fc);
     }
   }
@@ -1203,6 +1255,21 @@ void PPU::FetchSpriteData() {
   numsprites = ns;
 }
 
+// The bitmask J of non-transparent pixels in a sprite's row, maybe
+// reversed if the sprite is horizontally flipped.
+static inline uint8 SpriteHitMask(uint8 J, uint8 atr) {
+  return (atr & H_FLIP) ?
+    ((J << 7) & 0x80) |
+    ((J << 5) & 0x40) |
+    ((J << 3) & 0x20) |
+    ((J << 1) & 0x10) |
+    ((J >> 1) & 0x08) |
+    ((J >> 3) & 0x04) |
+    ((J >> 5) & 0x02) |
+    ((J >> 7) & 0x01) :
+    J;
+}
+
 // As I understand, this takes the sprites on this line (there are
 // numsprites of them, which have already been prepared and put into
 // SPRBUF -- I during the previous scanline) and writes actual pixel
@@ -1212,11 +1279,25 @@ void PPU::RefreshSprites() {
   any_sprites_on_line = 0;
   if (!numsprites) return;
 
-  // Initialize the line buffer to 0x80, meaning "no pixel here."
-  FCEU_dwmemset(sprlinebuf, 0x80808080, 256);
   // XXX It's weird to modify numsprites here; can we just use
   // numsprites - 1 in the expressions below? -tom7
   numsprites--;
+
+  if (skip_pixels) {
+    // Only the sprite 0 hit test matters. As below.
+    const SPRB *spr = (SPRB*)SPRBUF;
+    const uint8 J = spr->ca[0] | spr->ca[1];
+    if (J && sprite_0_in_sprbuf && !(PPU_status & 0x40)) {
+      sprite_hit_x = spr->x;
+      sprite_hit_mask = SpriteHitMask(J, spr->atr);
+    }
+    sprite_0_in_sprbuf = false;
+    any_sprites_on_line = 1;
+    return;
+  }
+
+  // Initialize the line buffer to 0x80, meaning "no pixel here."
+  FCEU_dwmemset(sprlinebuf, 0x80808080, 256);
   SPRB *spr = (SPRB*)SPRBUF + numsprites;
 
   DEBUGF(stderr, "RefreshSprites @%d with numsprites = %d\n",
@@ -1251,24 +1332,12 @@ void PPU::RefreshSprites() {
       // buffer, it will be at index n == 0.
       if (n == 0 && sprite_0_in_sprbuf && !(PPU_status & 0x40)) {
         sprite_hit_x = x;
-	// bitmask J, maybe reversed if the sprite is horizontally flipped.
-        sprite_hit_mask =
-	  (atr & H_FLIP) ?
-	  ((J << 7) & 0x80) |
-	  ((J << 5) & 0x40) |
-	  ((J << 3) & 0x20) |
-	  ((J << 1) & 0x10) |
-	  ((J >> 1) & 0x08) |
-	  ((J >> 3) & 0x04) |
-	  ((J >> 5) & 0x02) |
-	  ((J >> 7) & 0x01) :
-	  J;
+        sprite_hit_mask = SpriteHitMask(J, atr);
       }
 
-      // PERF If we are in DISABLE_VIDEO we can probably skip
-      // drawing the sprite pixels themselves, since we already
-      // have enough info for the sprite 0 hit test.
-      
+      // (When skip_pixels is set, we're done at this point; see
+      // above.)
+
       // C is destination for the 8 pixels we'll write
       // on this scanline.
       // C is an array of bytes, each corresponding to
@@ -1474,7 +1543,8 @@ void PPU::FCEUPPU_Reset() {
 
   #ifdef TRACK_INTERFRAME_SCROLL
   for (int i = 0; i < 256; i++) {
-    interframe_x[i] = interframe_y[i] = 0;
+    interframe_x[i] = interframe_y[i] = interframe_nt[i] = 0;
+    interframe_ctrl[i] = interframe_mask[i] = 0;
   }
   #endif
 }
@@ -1504,6 +1574,7 @@ void PPU::FCEUPPU_Power() {
     fc->fceu->BWrite[x + 7] = B2007;
   }
   fc->fceu->BWrite[0x4014] = B4014;
+  fc->fceu->ClassifyPages(0x2000, 0x40FF);
 }
 
 void PPU::FrameLoop() {
@@ -1522,6 +1593,9 @@ void PPU::FrameLoop() {
            sprite_hit_mask);
   }
 
+  skip_pixels = headless && !MMC5Hack && !PPU_hook &&
+    !fc->input->ScanlineHookNeedsPixels();
+
   // Needed for Knight Rider, possibly others.
   if (ppudead) {
     memset(fc->fceu->XBuf, 0x80, 256 * 240);
@@ -1551,8 +1625,10 @@ void PPU::FrameLoop() {
     Run6502(256);
 
     if (ScreenON || SpriteON) {
-      if (GameHBIRQHook && (PPU_values[0] & 0x38) != 0x18)
+      if (GameHBIRQHook && (PPU_values[0] & 0x38) != 0x18) {
+        PERFCOUNT(fc->X->perf.mapper_scanline_hooks++);
         GameHBIRQHook(fc);
+      }
       if (PPU_hook) {
         for (int x = 0; x < 42; x++) {
 	  PPU_hook(fc, 0x2000);
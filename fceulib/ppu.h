@@ -19,6 +19,16 @@ struct PPU {
   // Runs one frame. The CPU is driven by the PPU timing.
   void FrameLoop();
 
+  // If true, FrameLoop skips composing the background and sprite
+  // pixels, and only does the work that the CPU can observe: sprite
+  // 0 hit (for which it still renders the lines where sprite 0 is),
+  // the $2002 flags, VRAM address updates, and the mapper hooks that
+  // count scanlines. Lines are still rendered normally for mappers
+  // with PPU_hook or MMC5's extended modes, or when a light gun is
+  // attached. XBuf is garbage afterwards. Set per frame by
+  // FCEU::FCEUI_Emulate.
+  bool headless = false;
+
   void LineUpdate();
   void SetVideoSystem(int w);
 
@@ -100,6 +110,12 @@ struct PPU {
   // in savestates.
   uint8 interframe_x[256] = {};
   uint8 interframe_y[256] = {};
+  // And the table select bits (bit 0 is x, bit 1 is y), and
+  // PPU_values[0] and [1], since games may change the pattern tables
+  // or turn rendering off partway through the frame.
+  uint8 interframe_nt[256] = {};
+  uint8 interframe_ctrl[256] = {};
+  uint8 interframe_mask[256] = {};
   #endif
 
   // TODO: Kill these.
@@ -234,6 +250,12 @@ struct PPU {
   // mappers making PPU calls).
   int norecurse = 0;
 
+  // Whether we are actually skipping pixels this frame; see headless.
+  bool skip_pixels = false;
+  // RefreshLine when skip_pixels is set and there's no sprite 0 hit
+  // to test on this line.
+  void SkipLine(int lastpixel, int lasttile);
+
   FC *fc = nullptr;
 };
 
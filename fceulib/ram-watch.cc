@@ -0,0 +1,40 @@
+
+#include "ram-watch.h"
+
+#include <vector>
+
+#include "base/logging.h"
+
+using namespace std;
+
+RAMWatch::RAMWatch(const vector<uint16> &addrs, int capacity) {
+  CHECK(capacity > 0);
+  uint64 size = 1;
+  while (size < (uint64)capacity) size <<= 1;
+  ring.resize(size);
+  mask = size - 1;
+
+  for (uint16 a : addrs) {
+    CHECK(a < 0x800) << a;
+    watched[a] = true;
+    watched_pages[a >> 8] = true;
+  }
+
+  // No frame matches, so the first change always makes a record.
+  for (int i = 0; i < 0x800; i++) last_frame[i] = ~(uint32)0;
+}
+
+int64 RAMWatch::Take(vector<Change> *out) {
+  // Anything older than the last ring.size() records is gone.
+  const uint64 oldest = total > mask ? total - mask - 1 : 0;
+  int64 lost = 0;
+  if (taken < oldest) {
+    lost = oldest - taken;
+    taken = oldest;
+  }
+  out->reserve(out->size() + (total - taken));
+  for (uint64 i = taken; i < total; i++)
+    out->push_back(ring[i & mask]);
+  taken = total;
+  return lost;
+}
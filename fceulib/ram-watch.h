@@ -0,0 +1,101 @@
+/*
+  Write-watchpoints on the 0x800 bytes of system RAM. Analyses that
+  look for interesting memory locations (timers, lives, positions)
+  used to copy all of RAM after every frame and diff it; with a watch
+  installed, the emulator instead logs the changes to the watched
+  locations as they happen, so the cost scales with the number of
+  writes rather than frames * 2048.
+
+  Pages of RAM containing a watched address are taken off the CPU's
+  fast write path (see FCEU::write_fast), so writes to them go
+  through the RAM write handler, which calls Write. Unwatched pages
+  are not slowed down at all. Installed with Emulator::WatchRAM.
+*/
+
+#ifndef __RAM_WATCH_H
+#define __RAM_WATCH_H
+
+#include <vector>
+
+#include "types.h"
+
+struct RAMWatch {
+  // A change to a watched location during a frame. There is at most
+  // one record per location per frame: old_value is the value at the
+  // start of the frame and new_value the value after the frame's last
+  // write, as if comparing RAM before and after the frame. (So these
+  // can be equal, if it was changed and then changed back.) If the
+  // ring overflows during the frame, a location's record can be lost
+  // and replaced by a later one, which is still like this.
+  struct Change {
+    // Number of frames that were stepped since the watch was
+    // installed before this one, so writes in the first frame have
+    // frame 0.
+    uint32 frame;
+    // In [0, 0x7FF].
+    uint16 addr;
+    uint8 old_value;
+    uint8 new_value;
+  };
+  static_assert(sizeof (Change) == 8, "compact");
+
+  // Addresses are RAM offsets in [0, 0x7FF] (mirrors are included
+  // automatically). The log holds the most recent capacity changes,
+  // rounded up to a power of two.
+  RAMWatch(const std::vector<uint16> &addrs, int capacity);
+
+  // Called for every write to a watched page, before the value is
+  // stored. addr must be in [0, 0x7FF].
+  inline void Write(uint16 addr, uint8 old_value, uint8 new_value) {
+    if (!watched[addr]) return;
+    if (last_frame[addr] == frame) {
+      // Already changed this frame. Just update the record, unless
+      // it has been taken or overwritten; then the new one still
+      // starts from the value at the beginning of the frame.
+      if (last_index[addr] >= taken && total - last_index[addr] <= mask) {
+        ring[last_index[addr] & mask].new_value = new_value;
+        return;
+      }
+      old_value = frame_start_value[addr];
+    } else {
+      if (old_value == new_value) return;
+      last_frame[addr] = frame;
+      frame_start_value[addr] = old_value;
+    }
+    last_index[addr] = total;
+    ring[total & mask] = Change{frame, addr, old_value, new_value};
+    total++;
+  }
+
+  // Called at the end of each emulated frame.
+  void EndFrame() { frame++; }
+
+  // True if any of the 256 bytes of RAM page p (0-7) are watched.
+  bool WatchesPage(int p) const { return watched_pages[p]; }
+
+  // Appends the logged changes to out, oldest first, and clears the
+  // log. Returns the number of changes that were lost because the
+  // ring buffer filled up since the last call.
+  int64 Take(std::vector<Change> *out);
+
+ private:
+  bool watched[0x800] = {};
+  bool watched_pages[8] = {};
+
+  // The ring buffer. total is the number of changes ever recorded;
+  // those in [taken, total) that are also in the last capacity are
+  // still in the ring.
+  std::vector<Change> ring;
+  uint64 mask = 0;
+  uint64 total = 0, taken = 0;
+
+  uint32 frame = 0;
+  // For each address, the frame and absolute index of its most
+  // recent record, to coalesce multiple changes in one frame, and
+  // its value at the start of that frame.
+  uint32 last_frame[0x800];
+  uint64 last_index[0x800] = {};
+  uint8 frame_start_value[0x800] = {};
+};
+
+#endif
@@ -0,0 +1,341 @@
+// Parallel movie replay, for checking a new build against a history
+// recorded with a known-good one.
+//
+//   replay.exe --record game.nes movie.fm2 history.bin [--every N]
+//     Replays the movie serially, writing the RAM checksum after every
+//     frame, and every N frames (default 600) a checkpoint with a
+//     savestate and the RAM, CPU and image checksums.
+//
+//   replay.exe --verify game.nes movie.fm2 history.bin [--threads T]
+//     Replays each span between checkpoints in parallel, starting
+//     from the recorded savestate, and checks all of the checksums.
+//     Reports the first divergence. That span is then replayed again
+//     with a Traces file of per-frame state (replay-span-K.trace) so
+//     that it can be compared with difftrace.exe against the same
+//     trace from the reference build:
+//
+//   replay.exe --trace K game.nes movie.fm2 history.bin out.trace
+//     Writes the trace for span K only.
+//
+// The movie can be .fm2 or .fm7 (both players are used).
+
+#include "emulator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/stringprintf.h"
+#include "simplefm2.h"
+#include "simplefm7.h"
+#include "threadutil.h"
+#include "trace.h"
+
+using namespace std;
+
+using Trace = Traces::Trace;
+
+static constexpr uint32 HISTORY_MAGIC = 0x48524346;  // "FCRH"
+static constexpr uint32 HISTORY_VERSION = 1;
+
+struct Checkpoint {
+  // The state before the input for this frame is given, so frame 0
+  // is right after loading.
+  uint32 frame = 0;
+  uint64 ram = 0, cpu = 0, img = 0;
+  // SaveEx with the fast codec, no basis.
+  vector<uint8> state;
+};
+
+struct History {
+  uint32 every = 0;
+  // ram_after[i] is the RAM checksum after the input for frame i.
+  vector<uint64> ram_after;
+  // Always includes the first and last frames.
+  vector<Checkpoint> checkpoints;
+};
+
+static void Write32(FILE *fp, uint32 w) {
+  for (int i = 0; i < 4; i++) {
+    fputc(w & 255, fp);
+    w >>= 8;
+  }
+}
+
+static void Write64(FILE *fp, uint64 w) {
+  for (int i = 0; i < 8; i++) {
+    fputc(w & 255, fp);
+    w >>= 8;
+  }
+}
+
+static uint32 Read32(FILE *fp) {
+  uint32 w = 0;
+  for (int i = 0; i < 4; i++) {
+    const int c = fgetc(fp);
+    CHECK(c != EOF) << "Truncated history file.";
+    w |= (uint32)c << (8 * i);
+  }
+  return w;
+}
+
+static uint64 Read64(FILE *fp) {
+  const uint64 lo = Read32(fp);
+  const uint64 hi = Read32(fp);
+  return (hi << 32) | lo;
+}
+
+static void WriteHistory(const string &filename, const History &h) {
+  FILE *fp = fopen(filename.c_str(), "wb");
+  CHECK(fp != nullptr) << filename;
+  Write32(fp, HISTORY_MAGIC);
+  Write32(fp, HISTORY_VERSION);
+  Write32(fp, h.every);
+  Write32(fp, h.ram_after.size());
+  for (uint64 r : h.ram_after) Write64(fp, r);
+  Write32(fp, h.checkpoints.size());
+  for (const Checkpoint &c : h.checkpoints) {
+    Write32(fp, c.frame);
+    Write64(fp, c.ram);
+    Write64(fp, c.cpu);
+    Write64(fp, c.img);
+    Write32(fp, c.state.size());
+    CHECK(c.state.size() == fwrite(c.state.data(), 1, c.state.size(), fp));
+  }
+  fclose(fp);
+}
+
+static History ReadHistory(const string &filename) {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  CHECK(fp != nullptr) << filename;
+  CHECK(Read32(fp) == HISTORY_MAGIC) << "Not a history file: " << filename;
+  CHECK(Read32(fp) == HISTORY_VERSION) << "Unsupported version: " << filename;
+  History h;
+  h.every = Read32(fp);
+  h.ram_after.resize(Read32(fp));
+  for (uint64 &r : h.ram_after) r = Read64(fp);
+  h.checkpoints.resize(Read32(fp));
+  for (Checkpoint &c : h.checkpoints) {
+    c.frame = Read32(fp);
+    c.ram = Read64(fp);
+    c.cpu = Read64(fp);
+    c.img = Read64(fp);
+    c.state.resize(Read32(fp));
+    CHECK(c.state.size() == fread(c.state.data(), 1, c.state.size(), fp))
+      << "Truncated history file.";
+  }
+  fclose(fp);
+  CHECK(h.checkpoints.size() >= 2) << filename;
+  return h;
+}
+
+static vector<pair<uint8, uint8>> ReadMovie(const string &filename) {
+  const bool fm7 = filename.size() >= 4 &&
+    filename.substr(filename.size() - 4) == ".fm7";
+  vector<pair<uint8, uint8>> movie = fm7 ?
+    SimpleFM7::ReadInputs2P(filename) :
+    SimpleFM2::ReadInputs2P(filename);
+  CHECK(!movie.empty()) << filename;
+  return movie;
+}
+
+static Checkpoint MakeCheckpoint(Emulator *emu, uint32 frame) {
+  Checkpoint c;
+  c.frame = frame;
+  c.ram = emu->RamChecksum();
+  c.cpu = emu->CPUStateChecksum();
+  c.img = emu->ImageChecksum();
+  emu->SaveEx(nullptr, &c.state, Emulator::CODEC_FAST);
+  return c;
+}
+
+static int Record(const string &romfile, const string &moviefile,
+                  const string &historyfile, int every) {
+  CHECK(every > 0);
+  const vector<pair<uint8, uint8>> movie = ReadMovie(moviefile);
+  std::unique_ptr<Emulator> emu(Emulator::Create(romfile));
+  CHECK(emu.get() != nullptr) << romfile;
+
+  History h;
+  h.every = every;
+  h.ram_after.reserve(movie.size());
+  for (int i = 0; i < (int)movie.size(); i++) {
+    if (i % every == 0)
+      h.checkpoints.push_back(MakeCheckpoint(emu.get(), i));
+    emu->StepFull(movie[i].first, movie[i].second);
+    h.ram_after.push_back(emu->RamChecksum());
+  }
+  h.checkpoints.push_back(MakeCheckpoint(emu.get(), movie.size()));
+
+  WriteHistory(historyfile, h);
+  printf("Wrote %d frames and %d checkpoints to %s.\n",
+         (int)movie.size(), (int)h.checkpoints.size(),
+         historyfile.c_str());
+  return 0;
+}
+
+// Put the emulator at the start of span k.
+static void StartSpan(Emulator *emu, const History &h, int k) {
+  // The first span starts from power-on, which also checks that
+  // loading the game works the same way.
+  if (k > 0) emu->LoadEx(nullptr, h.checkpoints[k].state);
+}
+
+struct Divergence {
+  // Frame after which the divergence was seen; -1 if none.
+  int frame = -1;
+  string what;
+  uint64 expected = 0, actual = 0;
+};
+
+static Divergence ReplaySpan(Emulator *emu, const History &h,
+                             const vector<pair<uint8, uint8>> &movie,
+                             int k) {
+  StartSpan(emu, h, k);
+  const Checkpoint &end = h.checkpoints[k + 1];
+  Divergence d;
+  for (int f = h.checkpoints[k].frame; f < (int)end.frame; f++) {
+    emu->StepFull(movie[f].first, movie[f].second);
+    const uint64 ram = emu->RamChecksum();
+    if (ram != h.ram_after[f]) {
+      d.frame = f;
+      d.what = "RAM";
+      d.expected = h.ram_after[f];
+      d.actual = ram;
+      return d;
+    }
+  }
+
+  // Only the checkpoints have these.
+  const uint64 cpu = emu->CPUStateChecksum();
+  const uint64 img = emu->ImageChecksum();
+  if (cpu != end.cpu) {
+    d.what = "CPU state";
+    d.expected = end.cpu;
+    d.actual = cpu;
+  } else if (img != end.img) {
+    d.what = "image";
+    d.expected = end.img;
+    d.actual = img;
+  } else {
+    return d;
+  }
+  d.frame = (int)end.frame - 1;
+  return d;
+}
+
+static void TraceSpan(Emulator *emu, const History &h,
+                      const vector<pair<uint8, uint8>> &movie,
+                      int k, const string &tracefile) {
+  Traces traces;
+  traces.SwitchTraceFile(tracefile);
+  StartSpan(emu, h, k);
+  for (int f = h.checkpoints[k].frame;
+       f < (int)h.checkpoints[k + 1].frame; f++) {
+    emu->StepFull(movie[f].first, movie[f].second);
+    traces.TraceString(StringPrintf("after frame %d", f));
+    traces.TraceNumber(emu->Registers());
+    traces.TraceMemory(emu->GetMemory());
+    traces.TraceNumber(emu->CPUStateChecksum());
+  }
+  traces.TraceNumber(emu->ImageChecksum());
+}
+
+static int Verify(const string &romfile, const string &moviefile,
+                  const string &historyfile, int threads) {
+  const vector<pair<uint8, uint8>> movie = ReadMovie(moviefile);
+  const History h = ReadHistory(historyfile);
+  CHECK(h.ram_after.size() == movie.size())
+    << "History is for a movie of a different length.";
+  std::unique_ptr<Emulator> base(Emulator::Create(romfile));
+  CHECK(base.get() != nullptr) << romfile;
+
+  const int num_spans = h.checkpoints.size() - 1;
+  vector<Divergence> results(num_spans);
+  ParallelComp(num_spans,
+               [&base, &h, &movie, &results](int k) {
+                 // Cloning gives a power-on state too.
+                 std::unique_ptr<Emulator> emu(base->Clone());
+                 results[k] = ReplaySpan(emu.get(), h, movie, k);
+               },
+               threads);
+
+  for (int k = 0; k < num_spans; k++) {
+    const Divergence &d = results[k];
+    if (d.frame < 0) continue;
+
+    Trace expected(Traces::NUMBER), actual(Traces::NUMBER);
+    expected.data_number = d.expected;
+    actual.data_number = d.actual;
+    printf("Diverged in span %d (frames %d-%d): %s checksum after "
+           "frame %d:\n%s\n",
+           k, h.checkpoints[k].frame, h.checkpoints[k + 1].frame,
+           d.what.c_str(), d.frame,
+           Traces::Difference(expected, actual).c_str());
+
+    const string tracefile = StringPrintf("replay-span-%d.trace", k);
+    TraceSpan(base.get(), h, movie, k, tracefile);
+    printf("Wrote %s. To find the first difference, run\n"
+           "  replay.exe --trace %d %s %s %s ref.trace\n"
+           "with the reference build, then\n"
+           "  difftrace.exe ref.trace %s\n",
+           tracefile.c_str(), k, romfile.c_str(), moviefile.c_str(),
+           historyfile.c_str(), tracefile.c_str());
+    return 1;
+  }
+
+  printf("All %d frames (%d spans) agree.\n", (int)movie.size(), num_spans);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  vector<string> args;
+  int every = 600;
+  int threads = std::max(1, (int)std::thread::hardware_concurrency());
+  int trace_span = -1;
+  string mode;
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    if (arg == "--record" || arg == "--verify") {
+      mode = arg;
+    } else if (arg == "--trace") {
+      mode = arg;
+      CHECK(i + 1 < argc);
+      trace_span = atoi(argv[++i]);
+    } else if (arg == "--every") {
+      CHECK(i + 1 < argc);
+      every = atoi(argv[++i]);
+    } else if (arg == "--threads") {
+      CHECK(i + 1 < argc);
+      threads = atoi(argv[++i]);
+    } else {
+      args.push_back(arg);
+    }
+  }
+
+  if (mode == "--record" && args.size() == 3) {
+    return Record(args[0], args[1], args[2], every);
+  } else if (mode == "--verify" && args.size() == 3) {
+    return Verify(args[0], args[1], args[2], threads);
+  } else if (mode == "--trace" && args.size() == 4) {
+    const vector<pair<uint8, uint8>> movie = ReadMovie(args[1]);
+    const History h = ReadHistory(args[2]);
+    CHECK(trace_span >= 0 && trace_span + 1 < (int)h.checkpoints.size());
+    std::unique_ptr<Emulator> emu(Emulator::Create(args[0]));
+    CHECK(emu.get() != nullptr) << args[0];
+    TraceSpan(emu.get(), h, movie, trace_span, args[3]);
+    return 0;
+  }
+
+  fprintf(stderr,
+          "replay.exe --record game.nes movie.fm2 history.bin [--every N]\n"
+          "replay.exe --verify game.nes movie.fm2 history.bin "
+          "[--threads T]\n"
+          "replay.exe --trace K game.nes movie.fm2 history.bin out.trace\n");
+  return -1;
+}
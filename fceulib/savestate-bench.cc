@@ -0,0 +1,151 @@
+// Compares the SaveEx codecs on size and speed.
+//
+//   savestate-bench.exe game.nes movie.fm2 [game2.nes movie2.fm2 ...]
+//
+// or, with no movies, uses the games listed in the comprehensive
+// test's roms.txt (in --romdir, default roms/), driven by random
+// inputs as in that test.
+
+#include "emulator.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <sys/time.h>
+#include <cstdio>
+
+#include "base/logging.h"
+#include "test-util.h"
+#include "arcfour.h"
+#include "simplefm2.h"
+#include "base/stringprintf.h"
+
+static int64 TimeUsec() {
+  timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Frames to run before taking the basis.
+static constexpr int BASIS_FRAMES = 60;
+// Frames of random input for games without a movie.
+static constexpr int RANDOM_FRAMES = 2000;
+
+struct CodecStats {
+  int64 states = 0;
+  int64 bytes = 0;
+  int64 save_usec = 0;
+  int64 load_usec = 0;
+};
+
+static const char *const CODEC_NAMES[] = { "raw", "zlib", "fast" };
+static constexpr int NUM_CODECS = 3;
+
+static void RunGame(const string &romfile, const vector<uint8> &movie,
+                    CodecStats *stats) {
+  std::unique_ptr<Emulator> emu(Emulator::Create(romfile));
+  if (emu.get() == nullptr) {
+    fprintf(stderr, "Couldn't load %s; skipping.\n", romfile.c_str());
+    return;
+  }
+
+  vector<uint8> basis;
+  for (int i = 0; i < (int)movie.size(); i++) {
+    emu->Step(movie[i], 0);
+    if (i == BASIS_FRAMES) emu->GetBasis(&basis);
+    if (i < BASIS_FRAMES) continue;
+
+    const vector<uint8> expected = emu->SaveUncompressed();
+    for (int c = 0; c < NUM_CODECS; c++) {
+      vector<uint8> state;
+      const int64 save_start = TimeUsec();
+      if (c == 0) {
+        emu->SaveUncompressed(&state);
+      } else {
+        emu->SaveEx(&basis, &state,
+                    c == 1 ? Emulator::CODEC_ZLIB : Emulator::CODEC_FAST);
+      }
+      const int64 load_start = TimeUsec();
+      if (c == 0) {
+        emu->LoadUncompressed(state);
+      } else {
+        emu->LoadEx(&basis, state);
+      }
+      const int64 load_end = TimeUsec();
+
+      stats[c].states++;
+      stats[c].bytes += state.size();
+      stats[c].save_usec += load_start - save_start;
+      stats[c].load_usec += load_end - load_start;
+    }
+    CHECK(emu->SaveUncompressed() == expected) << romfile << " @" << i;
+  }
+}
+
+static vector<uint8> RandomInputs(const string &seed, int length) {
+  vector<uint8> v;
+  v.reserve(length);
+  ArcFour rc(seed);
+  rc.Discard(1024);
+  uint8 b = 0;
+  for (int i = 0; i < length; i++) {
+    // Hold buttons for a while, like a player would.
+    if (rc.Byte() >= 210) b = rc.Byte();
+    v.push_back(b);
+  }
+  return v;
+}
+
+int main(int argc, char **argv) {
+  string romdir = "roms/";
+  vector<pair<string, vector<uint8>>> games;
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    if (arg == "--romdir") {
+      i++;
+      CHECK(i < argc);
+      romdir = argv[i];
+      if (!romdir.empty() && romdir.back() != '/') romdir += '/';
+    } else {
+      i++;
+      CHECK(i < argc) << "Expected game.nes movie.fm2 pairs.";
+      vector<uint8> movie = SimpleFM2::ReadInputs(argv[i]);
+      CHECK(!movie.empty()) << argv[i];
+      games.emplace_back(arg, std::move(movie));
+    }
+  }
+
+  if (games.empty()) {
+    for (const string &orig_line : ReadFileToLines(romdir + "roms.txt")) {
+      string line = LoseWhiteL(orig_line);
+      if (line.empty() || line[0] == '#') continue;
+      // Skip the six expected checksums.
+      for (int j = 0; j < 6; j++) Chop(line);
+      const string filename = LoseWhiteL(line);
+      if (filename.empty()) continue;
+      games.emplace_back(romdir + filename,
+                         RandomInputs(filename, RANDOM_FRAMES));
+    }
+  }
+  CHECK(!games.empty()) << "No games. Give game.nes movie.fm2 pairs, or "
+    "a --romdir containing roms.txt.";
+
+  CodecStats stats[NUM_CODECS];
+  for (const auto &game : games) {
+    printf("%s (%d frames)...\n", game.first.c_str(), (int)game.second.size());
+    fflush(stdout);
+    RunGame(game.first, game.second, stats);
+  }
+
+  printf("\n%-6s %10s %12s %12s\n", "codec", "bytes/state",
+         "us/save", "us/load");
+  for (int c = 0; c < NUM_CODECS; c++) {
+    const CodecStats &s = stats[c];
+    if (s.states == 0) continue;
+    printf("%-6s %10.1f %12.2f %12.2f\n", CODEC_NAMES[c],
+           s.bytes / (double)s.states,
+           s.save_usec / (double)s.states,
+           s.load_usec / (double)s.states);
+  }
+  return 0;
+}
@@ -23,6 +23,12 @@
 
 #include <string.h>
 
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "types.h"
 #include "x6502.h"
 
@@ -34,6 +40,52 @@
 
 static constexpr int RectDuties[4] = {1, 2, 4, 6};
 
+// The low-quality synthesis loops add a channel's output to
+// wave[v >> 4] for each of the 16 sub-steps v of an output sample.
+// This does the same for v in [start, end), a sample at a time, with
+// the same (wrapping) result as adding value one step at a time.
+static inline void AccumulateSpan(int32 *wave, int32 start, int32 end,
+                                  int32 value) {
+  if (start >= end) return;
+  const int32 first = start >> 4, last = (end - 1) >> 4;
+  uint32 *w = (uint32 *)wave;
+  if (first == last) {
+    w[first] += (uint32)value * (uint32)(end - start);
+    return;
+  }
+  w[first] += (uint32)value * (uint32)(16 - (start & 15));
+  w[last] += (uint32)value * (uint32)(((end - 1) & 15) + 1);
+
+  // Whole samples in between.
+  const uint32 whole = (uint32)value * 16;
+  int32 i = first + 1;
+#if defined(__AVX2__)
+  const __m256i v8 = _mm256_set1_epi32(whole);
+  for (; i + 8 <= last; i += 8) {
+    __m256i *p = (__m256i *)(w + i);
+    _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), v8));
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i v4 = _mm_set1_epi32(whole);
+  for (; i + 4 <= last; i += 4) {
+    __m128i *p = (__m128i *)(w + i);
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), v4));
+  }
+#endif
+  for (; i < last; i++) w[i] += whole;
+}
+
+// The number of steps, counting the current one, until an accumulator
+// that is decremented by inc on each step reaches zero or below. This
+// lets the synthesis loops skip directly to the next step where some
+// channel changes its output.
+static inline int64 StepsUntilEvent(int32 acc, int32 inc) {
+  if (acc <= 0) return 1;
+  if (inc <= 0) return 0x7FFFFFFF;
+  return ((int64)acc + inc - 1) / inc;
+}
+
 static constexpr uint8 lengthtable[0x20] = {
     10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
     12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
@@ -486,9 +538,13 @@ void Sound::SoundCPUHook(int cycles) {
 
 void Sound::RDoPCM() {
 #if !DISABLE_SOUND
-  for (uint32 V = ChannelBC[4]; V < SoundTS(); V++) {
-    // TODO get rid of floating calculations to binary. set log volume scaling.
-    WaveHi[V] += (((RawDALatch << 16) / 256) * FCEUS_PCMVOLUME) & (~0xFFFF);
+  if (!muted) {
+    for (uint32 V = ChannelBC[4]; V < SoundTS(); V++) {
+      // TODO get rid of floating calculations to binary. set log
+      // volume scaling.
+      WaveHi[V] += (((RawDALatch << 16) / 256) * FCEUS_PCMVOLUME) &
+        (~0xFFFF);
+    }
   }
 #endif
   ChannelBC[4] = SoundTS();
@@ -634,17 +690,22 @@ void Sound::RDoSQLQ() {
   
   if (!inie[0] && !inie[1]) {
 #if !DISABLE_SOUND
-    for (int32 V = start; V < end; V++) Wave[V >> 4] += totalout;
+    if (!muted) AccumulateSpan(Wave, start, end, totalout);
 #endif
   } else {
-    for (int32 V = start; V < end; V++) {
-
+    for (int32 V = start; V < end; /* in loop */) {
+      // Both channels stay the same until one of them has an event.
+      const int32 n =
+        std::min<int64>(end - V,
+                        std::min(StepsUntilEvent(sqacc[0], inie[0]),
+                                 StepsUntilEvent(sqacc[1], inie[1])));
 #if !DISABLE_SOUND
-      Wave[V >> 4] += totalout;  // tmpamp;
+      if (!muted) AccumulateSpan(Wave, V, V + n, totalout);  // tmpamp;
 #endif
-      
-      sqacc[0] -= inie[0];
-      sqacc[1] -= inie[1];
+      V += n;
+
+      sqacc[0] -= n * inie[0];
+      sqacc[1] -= n * inie[1];
 
       if (sqacc[0] <= 0) {
         do {
@@ -746,13 +807,20 @@ void Sound::RDoTriangleNoisePCMLQ() {
   (void)totalout;
   
   if (inie[0] && inie[1]) {
-    for (int32 V = start; V < end; V++) {
+    for (int32 V = start; V < end; /* in loop */) {
+      const int32 n =
+        std::min<int64>(end - V,
+                        std::min(StepsUntilEvent(triangle_noise_triacc,
+                                                 inie[0]),
+                                 StepsUntilEvent(triangle_noise_noiseacc,
+                                                 inie[1])));
       #if !DISABLE_SOUND
-      Wave[V >> 4] += totalout;
+      if (!muted) AccumulateSpan(Wave, V, V + n, totalout);
       #endif
-      
-      triangle_noise_triacc -= inie[0];
-      triangle_noise_noiseacc -= inie[1];
+      V += n;
+
+      triangle_noise_triacc -= n * inie[0];
+      triangle_noise_noiseacc -= n * inie[1];
 
       if (triangle_noise_triacc <= 0) {
         do {
@@ -783,12 +851,16 @@ void Sound::RDoTriangleNoisePCMLQ() {
       } /* triangle_noise_noiseacc<=0 */
     } /* for (V=... */
   } else if (inie[0]) {
-    for (int32 V = start; V < end; V++) {
+    for (int32 V = start; V < end; /* in loop */) {
+      const int32 n =
+        std::min<int64>(end - V,
+                        StepsUntilEvent(triangle_noise_triacc, inie[0]));
       #if !DISABLE_SOUND
-      Wave[V >> 4] += totalout;
+      if (!muted) AccumulateSpan(Wave, V, V + n, totalout);
       #endif
-      
-      triangle_noise_triacc -= inie[0];
+      V += n;
+
+      triangle_noise_triacc -= n * inie[0];
 
       if (triangle_noise_triacc <= 0) {
         do {
@@ -802,11 +874,16 @@ void Sound::RDoTriangleNoisePCMLQ() {
       }
     }
   } else if (inie[1]) {
-    for (int32 V = start; V < end; V++) {
+    for (int32 V = start; V < end; /* in loop */) {
+      const int32 n =
+        std::min<int64>(end - V,
+                        StepsUntilEvent(triangle_noise_noiseacc, inie[1]));
       #if !DISABLE_SOUND
-      Wave[V >> 4] += totalout;
+      if (!muted) AccumulateSpan(Wave, V, V + n, totalout);
       #endif
-      triangle_noise_noiseacc -= inie[1];
+      V += n;
+
+      triangle_noise_noiseacc -= n * inie[1];
       if (triangle_noise_noiseacc <= 0) {
         do {
           // used to be added <<(16+2) when the noise table
@@ -826,7 +903,7 @@ void Sound::RDoTriangleNoisePCMLQ() {
     }
   } else {
     #if !DISABLE_SOUND
-    for (int32 V = start; V < end; V++) Wave[V >> 4] += totalout;
+    if (!muted) AccumulateSpan(Wave, start, end, totalout);
     #endif
   }
 }
@@ -65,6 +65,12 @@ struct Sound {
   int GetSoundBuffer(int32 **bufptr);
   int FlushEmulateSound();
 
+  // If true, the low-quality channel synthesis still advances the
+  // channels' sequencers (this is part of the save state) but does
+  // not add their output into Wave, which is not. Set per frame by
+  // FCEU::FCEUI_Emulate when the frame's sound will not be flushed.
+  bool muted = false;
+
   uint32 soundtsinc = 0;
   uint32 soundtsoffs = 0;
 
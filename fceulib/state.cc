@@ -28,6 +28,7 @@
 #include <vector>
 #include <fstream>
 #include <map>
+#include <algorithm>
 
 #include "version.h"
 #include "types.h"
@@ -150,20 +151,16 @@ int State::WriteStateChunk(EmuFile *os, int type,
 }
 
 // Find the SFORMAT structure with the name 'desc', if any.
-const SFORMAT *State::CheckS(const vector<SFORMAT> &sf,
+const SFORMAT *State::CheckS(const SIndex &index,
                              uint32 tsize, SKEY desc) {
-  for (const SFORMAT &f : sf) {
-    CHECK(f.s != ~0);
-    if (f.desc == desc) {
-      if (tsize != (f.s & (~FCEUSTATE_FLAGS))) return nullptr;
-      return &f;
-    }
-  }
-  return nullptr;
+  auto it = index.find(desc);
+  if (it == index.end()) return nullptr;
+  const SFORMAT *f = it->second;
+  if (tsize != (f->s & (~FCEUSTATE_FLAGS))) return nullptr;
+  return f;
 }
 
-bool State::ReadStateChunk(EmuFile *is,
-                           const vector<SFORMAT> &sf, int size) {
+bool State::ReadStateChunk(EmuFile *is, const SIndex &index, int size) {
   int temp = is->ftell();
 
   while (is->ftell() < temp + size) {
@@ -173,7 +170,7 @@ bool State::ReadStateChunk(EmuFile *is,
 
     read32le(&tsize, is);
 
-    if (const SFORMAT *tmp = CheckS(sf, tsize, toa)) {
+    if (const SFORMAT *tmp = CheckS(index, tsize, toa)) {
       is->fread((char *)tmp->v, tmp->s & (~FCEUSTATE_FLAGS));
 
 #ifndef LSB_FIRST
@@ -188,7 +185,7 @@ bool State::ReadStateChunk(EmuFile *is,
 }
 
 bool State::ReadStateChunks(EmuFile *is, int32 totalsize) {
-  InitState();
+  InitLayout();
   uint32 size;
   bool ret = true;
   bool warned = false;
@@ -199,29 +196,24 @@ bool State::ReadStateChunks(EmuFile *is, int32 totalsize) {
     if (!read32le(&size, is)) break;
     totalsize -= size + 5;
 
-    switch (t) {
-      case 1:
-        if (!ReadStateChunk(is, sfcpu, size)) ret = false;
-        break;
-      case 3:
-        if (!ReadStateChunk(is, fc->ppu->FCEUPPU_STATEINFO(), size))
-          ret = false;
-        break;
-      case 4:
-        if (!ReadStateChunk(is, fc->input->FCEUINPUT_STATEINFO(), size))
-          ret = false;
+    const StateChunk *chunk = nullptr;
+    for (const StateChunk &c : chunks) {
+      if (c.type == t) {
+        chunk = &c;
         break;
+      }
+    }
+
+    if (chunk != nullptr) {
+      if (!ReadStateChunk(is, chunk->index, size)) ret = false;
+      continue;
+    }
+
+    switch (t) {
       case 7:
         fprintf(stderr, "This used to be mid-movie recording. -tom7.\n");
         abort();
         break;
-      case 0x10:
-        if (!ReadStateChunk(is, sfmdata, size)) ret = false;
-        break;
-      case 5:
-        if (!ReadStateChunk(is, fc->sound->FCEUSND_STATEINFO(), size))
-          ret = false;
-        break;
       case 6: is->fseek(size, SEEK_CUR); break;
       case 8:
         // load back buffer
@@ -229,9 +221,6 @@ bool State::ReadStateChunks(EmuFile *is, int32 totalsize) {
           if (is->fread((char *)fc->fceu->XBackBuf, size) != size) ret = false;
         }
         break;
-      case 2:
-        if (!ReadStateChunk(is, sfcpuc, size)) ret = false;
-        break;
       default:
         // for somebody's sanity's sake, at least warn about it:
         // XXX should probably just abort here since we don't try to provide
@@ -303,7 +292,21 @@ bool State::FCEUSS_LoadRAW(const std::vector<uint8> &in) {
   // Assume current version; memory only.
   int stateversion = FCEU_VERSION_NUMERIC;
 
-  bool success = (ReadStateChunks(&is, totalsize) != 0);
+  bool success = true;
+  InitLayout();
+  if (LayoutMatches(in)) {
+    // Fast path: Same layout we'd write, so we don't need to
+    // look at the tags.
+    for (const StateField &field : fields) {
+      memcpy(field.v, &in[field.offset], field.size);
+#ifndef LSB_FIRST
+      if (field.rlsb)
+        FlipByteOrder(field.v, field.size);
+#endif
+    }
+  } else {
+    success = ReadStateChunks(&is, totalsize);
+  }
 
   if (fc->fceu->GameStateRestore != nullptr) {
     fc->fceu->GameStateRestore(fc, stateversion);
@@ -318,6 +321,174 @@ bool State::FCEUSS_LoadRAW(const std::vector<uint8> &in) {
   }
 }
 
+void State::AddChunk(int type, const vector<SFORMAT> &sf, uint32 *offset) {
+  StateChunk chunk;
+  chunk.type = type;
+  chunk.sf = &sf;
+  chunk.offset = *offset;
+  // Chunk header is a type byte and 32-bit size.
+  *offset += 5;
+  for (const SFORMAT &f : sf) {
+    const uint32 size = f.s & (~FCEUSTATE_FLAGS);
+    const bool rlsb = !!(f.s & FCEUSTATE_RLSB);
+    // (Like the old linear search, the first one wins if keys are
+    // duplicated.)
+    chunk.index.emplace(f.desc, &f);
+    // Tag and size.
+    *offset += 8;
+    fields.push_back(StateField{(uint8 *)f.v, size, *offset, f.desc, rlsb});
+    if (rlsb) {
+      // These are small multibyte integers, stored byte-swapped;
+      // keep them in a single page.
+      pages.push_back(StatePage{(uint8 *)f.v, size, *offset, true});
+    } else {
+      for (uint32 start = 0; start < size; start += DELTA_PAGE_SIZE) {
+        const uint32 len = std::min(size - start, (uint32)DELTA_PAGE_SIZE);
+        pages.push_back(StatePage{(uint8 *)f.v + start, len,
+                                  *offset + start, false});
+      }
+    }
+    *offset += size;
+  }
+  chunk.size = *offset - chunk.offset - 5;
+  chunks.push_back(std::move(chunk));
+}
+
+void State::InitLayout() {
+  if (layout_initialized) return;
+  InitState();
+  chunks.clear();
+  fields.clear();
+  pages.clear();
+  // Same order as FCEUSS_SaveRAW.
+  uint32 offset = 0;
+  AddChunk(1, sfcpu, &offset);
+  AddChunk(2, sfcpuc, &offset);
+  AddChunk(3, fc->ppu->FCEUPPU_STATEINFO(), &offset);
+  AddChunk(4, fc->input->FCEUINPUT_STATEINFO(), &offset);
+  AddChunk(5, fc->sound->FCEUSND_STATEINFO(), &offset);
+  AddChunk(0x10, sfmdata, &offset);
+  raw_size = offset;
+  layout_initialized = true;
+}
+
+// The values are little-endian in the RAW format; see write32le.
+static inline uint32 Read32LE(const uint8 *p) {
+  return (uint32)p[0] | ((uint32)p[1] << 8) |
+    ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+bool State::LayoutMatches(const std::vector<uint8> &in) const {
+  if (in.size() != raw_size) return false;
+  for (const StateChunk &chunk : chunks) {
+    if (in[chunk.offset] != chunk.type ||
+        Read32LE(&in[chunk.offset + 1]) != chunk.size)
+      return false;
+  }
+  for (const StateField &field : fields) {
+    const uint8 *hdr = &in[field.offset - 8];
+    if (memcmp(hdr, field.desc.data(), 4) != 0 ||
+        Read32LE(hdr + 4) != field.size)
+      return false;
+  }
+  return true;
+}
+
+// Get the page's current contents as they would appear in a RAW
+// save. Usually this is just the pointer itself, but byte-swapped
+// fields are copied into the scratch buffer.
+static inline const uint8 *PageBytes(uint8 *v, uint32 size, bool rlsb,
+                                     uint8 scratch[8]) {
+#ifndef LSB_FIRST
+  if (rlsb) {
+    CHECK(size <= 8);
+    memcpy(scratch, v, size);
+    FlipByteOrder(scratch, size);
+    return scratch;
+  }
+#endif
+  return v;
+}
+
+bool State::FCEUSS_SaveDelta(const std::vector<uint8> &parent,
+                             std::vector<uint8> *out) {
+  InitLayout();
+  if (parent.size() != raw_size) {
+    FCEUD_PrintError("SaveDelta: parent is not a RAW state for this game");
+    return false;
+  }
+
+  fc->ppu->FCEUPPU_SaveState();
+  fc->sound->FCEUSND_SaveState();
+  if (SPreSave) SPreSave(fc);
+
+  // Header is the size of the RAW state, then a sequence of
+  // (page index, page contents) in increasing order.
+  out->resize(4);
+  *(uint32 *)out->data() = raw_size;
+  uint8 scratch[8];
+  for (uint32 i = 0; i < pages.size(); i++) {
+    const StatePage &page = pages[i];
+    const uint8 *cur = PageBytes(page.v, page.size, page.rlsb, scratch);
+    if (memcmp(cur, &parent[page.offset], page.size) != 0) {
+      const size_t pos = out->size();
+      out->resize(pos + 4 + page.size);
+      memcpy(&(*out)[pos], &i, 4);
+      memcpy(&(*out)[pos + 4], cur, page.size);
+    }
+  }
+
+  if (SPreSave && SPostSave) SPostSave(fc);
+  return true;
+}
+
+bool State::FCEUSS_LoadDelta(const std::vector<uint8> &parent,
+                             const std::vector<uint8> &delta) {
+  InitLayout();
+  if (parent.size() != raw_size || delta.size() < 4 ||
+      *(const uint32 *)delta.data() != raw_size) {
+    FCEUD_PrintError("LoadDelta: delta/parent don't match this game");
+    return false;
+  }
+
+  size_t pos = 4;
+  uint8 scratch[8];
+  for (uint32 i = 0; i < pages.size(); i++) {
+    const StatePage &page = pages[i];
+    const uint8 *src = &parent[page.offset];
+    if (pos + 4 <= delta.size()) {
+      uint32 idx;
+      memcpy(&idx, &delta[pos], 4);
+      if (idx == i) {
+        if (pos + 4 + page.size > delta.size()) return false;
+        src = &delta[pos + 4];
+        pos += 4 + page.size;
+      }
+    }
+
+    // Most pages are unchanged from the current state; don't
+    // write to them.
+    const uint8 *cur = PageBytes(page.v, page.size, page.rlsb, scratch);
+    if (memcmp(cur, src, page.size) != 0) {
+      memcpy(page.v, src, page.size);
+#ifndef LSB_FIRST
+      if (page.rlsb)
+        FlipByteOrder(page.v, page.size);
+#endif
+    }
+  }
+  // Every record should have been consumed.
+  if (pos != delta.size()) return false;
+
+  const int stateversion = FCEU_VERSION_NUMERIC;
+  if (fc->fceu->GameStateRestore != nullptr) {
+    fc->fceu->GameStateRestore(fc, stateversion);
+  }
+  fc->ppu->FCEUPPU_LoadState(stateversion);
+  fc->sound->FCEUSND_LoadState(stateversion);
+  return true;
+}
+
 void State::ResetExState(void (*PreSave)(FC *), void (*PostSave)(FC *)) {
 
   // If this needs to happen, it's a bug in the way the savestate
@@ -335,6 +506,8 @@ void State::ResetExState(void (*PreSave)(FC *), void (*PostSave)(FC *)) {
   SPreSave = PreSave;
   SPostSave = PostSave;
   sfmdata.clear();
+  used_keys.clear();
+  layout_initialized = false;
 }
 
 void State::AddExVec(const vector<SFORMAT> &vec) {
@@ -347,15 +520,12 @@ void State::AddExVec(const vector<SFORMAT> &vec) {
 
 void State::AddExStateReal(void *v, uint32 s, int type, SKEY desc,
                            const char *src) {
-  // PERF: n^2. Use a map/set.
-  for (const SFORMAT &sf : sfmdata) {
-    if (sf.desc == desc) {
-      fprintf(stderr, "SFORMAT with duplicate key: %c%c%c%c\n"
-              "Second called from %s\n",
-              desc[0], desc[1], desc[2], desc[3],
-              src);
-      abort();
-    }
+  if (!used_keys.insert(desc).second) {
+    fprintf(stderr, "SFORMAT with duplicate key: %c%c%c%c\n"
+            "Second called from %s\n",
+            desc[0], desc[1], desc[2], desc[3],
+            src);
+    abort();
   }
 
   CHECK(s != ~0);
@@ -363,6 +533,7 @@ void State::AddExStateReal(void *v, uint32 s, int type, SKEY desc,
   SFORMAT sf{v, s, desc};
   if (type) sf.s |= FCEUSTATE_RLSB;
   sfmdata.push_back(sf);
+  layout_initialized = false;
 }
 
 State::State(FC *fc) : fc(fc) {}
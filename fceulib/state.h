@@ -23,6 +23,7 @@
 
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
 #include <array>
 
 #include <string.h>
@@ -101,6 +102,19 @@ struct State {
   bool FCEUSS_SaveRAW(std::vector<uint8> *out);
   bool FCEUSS_LoadRAW(const std::vector<uint8> &in);
 
+  // Incremental savestates. The output of FCEUSS_SaveRAW has a fixed
+  // layout for a given cartridge, so we divide each saved field into
+  // pages of (at most) DELTA_PAGE_SIZE bytes. A delta records only
+  // the pages that differ from the parent, which must be a state
+  // produced by FCEUSS_SaveRAW for the same game. Loading a delta
+  // only writes pages that differ from the current state. Like the
+  // RAW versions, in-memory use only.
+  static constexpr int DELTA_PAGE_SIZE = 256;
+  bool FCEUSS_SaveDelta(const std::vector<uint8> &parent,
+                        std::vector<uint8> *out);
+  bool FCEUSS_LoadDelta(const std::vector<uint8> &parent,
+                        const std::vector<uint8> &delta);
+
   // I think these add additional locations to the set of saved memories.
   void ResetExState(void (*PreSave)(FC *),void (*PostSave)(FC *));
 
@@ -120,11 +134,56 @@ struct State {
 
   int WriteStateChunk(EmuFile *os, int type, const std::vector<SFORMAT> &sf);
 
-  const SFORMAT *CheckS(const std::vector<SFORMAT> &sf,
-                        uint32 tsize, SKEY desc);
-  bool ReadStateChunk(EmuFile *is, const std::vector<SFORMAT> &sf, int size);
+  using SIndex = std::unordered_map<SKEY, const SFORMAT *, HashDesc, EqDesc>;
+  const SFORMAT *CheckS(const SIndex &index, uint32 tsize, SKEY desc);
+  bool ReadStateChunk(EmuFile *is, const SIndex &index, int size);
   bool ReadStateChunks(EmuFile *is, int32 totalsize);
 
+  // The output of FCEUSS_SaveRAW has a fixed layout for a given
+  // cartridge. This describes it so that we can skip tag parsing
+  // when loading a state with the expected layout, and for the
+  // page-based delta states.
+  //
+  // One of the chunks written by FCEUSS_SaveRAW, in order.
+  struct StateChunk {
+    int type;
+    const std::vector<SFORMAT> *sf;
+    // Offset of the chunk header, and size of the chunk's data
+    // (not including the header).
+    uint32 offset;
+    uint32 size;
+    // Fields by key, for loading tagged states.
+    SIndex index;
+  };
+  // A saved field, and where its data lives in the RAW state.
+  struct StateField {
+    uint8 *v;
+    uint32 size;
+    uint32 offset;
+    SKEY desc;
+    bool rlsb;
+  };
+  // A page of some saved field. Like StateField, but large fields
+  // are split into multiple pages.
+  struct StatePage {
+    uint8 *v;
+    uint32 size;
+    uint32 offset;
+    bool rlsb;
+  };
+  // Computes the layout from the current SFORMAT vectors if it is
+  // stale. Mappers can add fields at any time before the game
+  // starts, so this is done lazily.
+  void InitLayout();
+  void AddChunk(int type, const std::vector<SFORMAT> &sf, uint32 *offset);
+  // True if the RAW state's headers are exactly the ones we'd write.
+  bool LayoutMatches(const std::vector<uint8> &in) const;
+  std::vector<StateChunk> chunks;
+  std::vector<StateField> fields;
+  std::vector<StatePage> pages;
+  uint32 raw_size = 0;
+  bool layout_initialized = false;
+
   void (*SPreSave)(FC *) = nullptr;
   void (*SPostSave)(FC *) = nullptr;
 
@@ -136,8 +195,6 @@ struct State {
   std::vector<SFORMAT> sfmdata;
   // This is just to prevent duplicate keys, which would be
   // disastrous.
-  // PERF: If all of the data were in a hash map, we could
-  // avoid the linear time CheckS.
   std::unordered_set<SKEY, HashDesc, EqDesc> used_keys;
 
   // XXX Can probably init in constructor?
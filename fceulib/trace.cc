@@ -5,8 +5,16 @@
 #include <stdarg.h>
 
 #include <cstdio>
+#include <cstring>
 #include <utility>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace std;
 
 using uint8 = uint8_t;
@@ -171,6 +179,65 @@ bool RLE::DecompressEx(const vector<uint8> &in,
 
 }  // namespace
 
+// File format. Everything is little-endian.
+//
+// The file starts with FILE_MAGIC, the digest interval (uint32), and
+// four bytes of padding. Then a sequence of records, each with a
+// header of type (uint32), payload length in bytes (uint32) and a
+// number (uint64), followed by the payload, padded with zeroes to a
+// multiple of 8 bytes:
+//   STRING: the number is 0 and the payload is the string.
+//   MEMORY: the number is the size of the memory, and the payload
+//           is the memory after RLE compression.
+//   NUMBER: the number, and no payload.
+//   REC_DIGEST: the running digest of every trace record (header
+//           and unpadded payload) so far, and no payload.
+//   REC_INDEX: the number of digests, and their offsets (uint64).
+// REC_INDEX is the last record, followed by the footer: the offset
+// of the REC_INDEX record (uint64), then FOOTER_MAGIC. A file without
+// the footer (e.g. because the program crashed) can still be read.
+static constexpr char FILE_MAGIC[8] = {'F', 'C', 'T', 'R', 'A', 'C', 'E', 2};
+static constexpr char FOOTER_MAGIC[8] = {'F', 'C', 'T', 'I', 'N', 'D', 'E', 'X'};
+static constexpr int FILE_HEADER_SIZE = 16;
+static constexpr int RECORD_HEADER_SIZE = 16;
+static constexpr int FOOTER_SIZE = 16;
+static constexpr uint32 REC_DIGEST = 100;
+static constexpr uint32 REC_INDEX = 101;
+
+static uint32 Padded(uint32 len) { return (len + 7) & ~7; }
+
+static void Put32(uint8 *p, uint32 w) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = w & 255;
+    w >>= 8;
+  }
+}
+
+static void Put64(uint8 *p, uint64 w) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = w & 255;
+    w >>= 8;
+  }
+}
+
+static uint32 Get32(const uint8 *p) {
+  return (uint32)p[0] | ((uint32)p[1] << 8) |
+    ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+static uint64 Get64(const uint8 *p) {
+  return (uint64)Get32(p) | ((uint64)Get32(p + 4) << 32);
+}
+
+// Not cryptographic, but every bit of the input affects the result.
+static uint64 DigestBytes(uint64 h, const uint8 *p, uint32 len) {
+  for (uint32 i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 0x100000001B3ULL;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
 void Traces::SetEnabled(bool b) {
   enabled = b;
 }
@@ -207,24 +274,49 @@ void Traces::TraceNumber(uint64 n) {
 }
 
 Traces::Traces() {
-  fp = fopen("trace.bin", "wb");
+  Open("trace.bin");
+  fprintf(stderr, "Tracing is enabled!\n");
+}
+
+Traces::~Traces() {
+  Close();
+}
+
+void Traces::Open(const string &filename) {
+  fp = fopen(filename.c_str(), "wb");
   if (fp == nullptr) {
-    fprintf(stderr, "Unable to open trace file.\n");
+    fprintf(stderr, "Unable to open trace file %s.\n", filename.c_str());
     abort();
-  } else {
-    fprintf(stderr, "Tracing is enabled!\n");
   }
+  uint8 header[FILE_HEADER_SIZE] = {};
+  memcpy(header, FILE_MAGIC, 8);
+  Put32(header + 8, DIGEST_INTERVAL);
+  fwrite(header, 1, FILE_HEADER_SIZE, fp);
+  offset = FILE_HEADER_SIZE;
+  digest = 0ULL;
+  since_digest = 0;
+  digest_offsets.clear();
 }
 
-void Traces::SwitchTraceFile(const string &s) {
-  fflush(fp);
+void Traces::Close() {
+  if (fp == nullptr) return;
+  // The index of digests, and then a footer that points to it.
+  const uint64 index_offset = offset;
+  vector<uint8> index(digest_offsets.size() * 8);
+  for (int i = 0; i < (int)digest_offsets.size(); i++)
+    Put64(&index[i * 8], digest_offsets[i]);
+  WriteRecord(REC_INDEX, digest_offsets.size(), index.data(), index.size());
+  uint8 footer[FOOTER_SIZE];
+  Put64(footer, index_offset);
+  memcpy(footer + 8, FOOTER_MAGIC, 8);
+  fwrite(footer, 1, FOOTER_SIZE, fp);
   fclose(fp);
-  fp = fopen(s.c_str(), "wb");
-  if (fp == nullptr) {
-    fprintf(stderr, "Unable to switch to trace file %s.\n",
-            s.c_str());
-    abort();
-  }
+  fp = nullptr;
+}
+
+void Traces::SwitchTraceFile(const string &s) {
+  Close();
+  Open(s);
 }
 
 bool Traces::Equal(const Trace &l, const Trace &r) {
@@ -342,62 +434,69 @@ string Traces::LineString(const Trace &t) {
  return "??";
 }
 
+void Traces::WriteRecord(uint32 type, uint64 number,
+                         const uint8 *payload, uint32 len) {
+  uint8 header[RECORD_HEADER_SIZE];
+  Put32(header, type);
+  Put32(header + 4, len);
+  Put64(header + 8, number);
+  fwrite(header, 1, RECORD_HEADER_SIZE, fp);
+  if (len > 0) fwrite(payload, 1, len, fp);
+  static constexpr uint8 zeroes[8] = {};
+  const uint32 padded = Padded(len);
+  if (padded > len) fwrite(zeroes, 1, padded - len, fp);
+  offset += RECORD_HEADER_SIZE + padded;
+
+  if (type != REC_DIGEST && type != REC_INDEX) {
+    digest = DigestBytes(digest, header, RECORD_HEADER_SIZE);
+    digest = DigestBytes(digest, payload, len);
+  }
+}
+
 void Traces::Write(const Trace &t) {
   // TODO: Maybe could count the number of ignored traces and only
   // log that, once tracing is enabled again? Or checksum?
   if (!enabled) return;
 
-  auto Write32 = [this](uint32 w) {
-    for (int i = 0; i < 4; i++) {
-      fputc(w & 255, this->fp);
-      w >>= 8;
-    }
-  };
-
-  auto Write64 = [this](uint64 w) {
-    for (int i = 0; i < 8; i++) {
-      fputc(w & 255, this->fp);
-      w >>= 8;
-    }
-  };
-
-  auto Write8 = [this](uint8 w) {
-    fputc(w, this->fp);
-  };
-
-  // Each record starts with a tag byte.
-  Write8(t.type);
   switch (t.type) {
   case STRING:
-    Write32(t.data_string.size());
-    for (char c : t.data_string)
-      Write8((uint8)c);
+    WriteRecord(STRING, 0, (const uint8 *)t.data_string.data(),
+                t.data_string.size());
     break;
   case MEMORY: {
+    // The number is the uncompressed size.
     vector<uint8> encoded = RLE::Compress(t.data_memory);
-    Write32(encoded.size());
-    for (uint8 w : encoded)
-      Write8(w);
+    WriteRecord(MEMORY, t.data_memory.size(), encoded.data(),
+                encoded.size());
     break;
   }
   case NUMBER:
-    Write64(t.data_number);
+    WriteRecord(NUMBER, t.data_number, nullptr, 0);
     break;
   default:
     fprintf(stderr, "Can't write unknown trace type %d\n", (int)t.type);
     abort();
   }
-  // We also always have a newline, just to make paging through the
-  // (binary) file simpler.
-  Write8('\n');
+
+  if (++since_digest == DIGEST_INTERVAL) {
+    digest_offsets.push_back(offset);
+    WriteRecord(REC_DIGEST, digest, nullptr, 0);
+    since_digest = 0;
+  }
   fflush(fp);
 }
 
-// static
-vector<Traces::Trace> Traces::ReadFromFile(const string &filename) {
+// The format before digests: tag byte, then the (variable-length)
+// data, then a newline.
+static vector<Traces::Trace> ReadOldFormat(const string &filename) {
+  using Trace = Traces::Trace;
   vector<Trace> out;
   out.reserve(100000);
   FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == nullptr) {
+    fprintf(stderr, "Couldn't open %s.\n", filename.c_str());
+    abort();
+  }
 
   auto Read8 = [&fp](uint8 *w) -> bool {
     int c = fgetc(fp);
@@ -432,9 +531,9 @@ vector<Traces::Trace> Traces::ReadFromFile(const string &filename) {
                 "Assumed in this code.");
   uint8 tag;
   while (Read8(&tag)) {
-    Trace t((TraceType)tag);
+    Trace t((Traces::TraceType)tag);
     switch (tag) {
-    case STRING: {
+    case Traces::STRING: {
       uint32 len;
       if (!Read32(&len)) {
         fprintf(stderr, "Incomplete string record.\n");
@@ -450,7 +549,7 @@ vector<Traces::Trace> Traces::ReadFromFile(const string &filename) {
       }
       break;
     }
-    case MEMORY: {
+    case Traces::MEMORY: {
       uint32 len;
       if (!Read32(&len)) {
         fprintf(stderr, "Incomplete memory record.\n");
@@ -467,7 +566,7 @@ vector<Traces::Trace> Traces::ReadFromFile(const string &filename) {
       t.data_memory = RLE::Decompress(compressed);
       break;
     }
-    case NUMBER:
+    case Traces::NUMBER:
       if (!Read64(&t.data_number)) {
         fprintf(stderr, "Incomplete number.\n");
         abort();
@@ -484,5 +583,183 @@ vector<Traces::Trace> Traces::ReadFromFile(const string &filename) {
     out.push_back(std::move(t));
   }
 
+  fclose(fp);
   return out;
 }
+
+// static
+vector<Traces::Trace> Traces::ReadFromFile(const string &filename) {
+  TraceFile tf(filename);
+  if (!tf.Valid()) return ReadOldFormat(filename);
+  vector<Trace> out;
+  for (TraceFile::Pos pos = tf.Begin(); pos != tf.End(); pos = tf.Next(pos))
+    out.push_back(tf.Get(pos));
+  return out;
+}
+
+
+TraceFile::TraceFile(const string &filename) {
+#ifndef _WIN32
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Couldn't open %s.\n", filename.c_str());
+    abort();
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "Couldn't stat %s.\n", filename.c_str());
+    abort();
+  }
+  size = st.st_size;
+  if (size > 0) {
+    void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      data = (const uint8 *)m;
+      mapped = true;
+      // Mostly read front to back.
+      madvise(m, size, MADV_SEQUENTIAL);
+    }
+  }
+  close(fd);
+#endif
+  if (!mapped && size > 0) {
+    // Fall back to reading the whole thing.
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr) {
+      fprintf(stderr, "Couldn't open %s.\n", filename.c_str());
+      abort();
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    contents.resize(size);
+    if (size != fread(contents.data(), 1, size, fp)) {
+      fprintf(stderr, "Couldn't read %s.\n", filename.c_str());
+      abort();
+    }
+    fclose(fp);
+    data = contents.data();
+  }
+
+  if (size < FILE_HEADER_SIZE || 0 != memcmp(data, FILE_MAGIC, 8))
+    return;
+  valid = true;
+  digest_interval = Get32(data + 8);
+
+  // Use the index if the file was closed properly.
+  if (size >= FILE_HEADER_SIZE + RECORD_HEADER_SIZE + FOOTER_SIZE &&
+      0 == memcmp(data + size - 8, FOOTER_MAGIC, 8)) {
+    const uint64 index_offset = Get64(data + size - FOOTER_SIZE);
+    if (index_offset >= FILE_HEADER_SIZE &&
+        index_offset <= size - RECORD_HEADER_SIZE &&
+        Get32(data + index_offset) == REC_INDEX) {
+      const uint8 *rec = data + index_offset;
+      const uint64 num = Get64(rec + 8);
+      // Don't trust the count or offsets of a damaged index; the
+      // header scan below still works.
+      bool ok = num <= (size - index_offset - RECORD_HEADER_SIZE) / 8;
+      for (uint64 i = 0; ok && i < num; i++) {
+        const uint64 d = Get64(rec + RECORD_HEADER_SIZE + i * 8);
+        ok = d >= FILE_HEADER_SIZE && d + RECORD_HEADER_SIZE <= index_offset;
+        digests.push_back(d);
+      }
+      if (ok) {
+        end = index_offset;
+        return;
+      }
+      digests.clear();
+    }
+  }
+
+  // Otherwise, scan the headers, stopping at any incomplete record.
+  Pos pos = FILE_HEADER_SIZE;
+  while (pos + RECORD_HEADER_SIZE <= size) {
+    const uint32 type = Get32(data + pos);
+    const uint64 next =
+      pos + RECORD_HEADER_SIZE + Padded(Get32(data + pos + 4));
+    if (type == REC_INDEX || next > size) break;
+    if (type == REC_DIGEST) digests.push_back(pos);
+    pos = next;
+  }
+  end = pos;
+}
+
+TraceFile::~TraceFile() {
+#ifndef _WIN32
+  if (mapped) munmap((void *)data, size);
+#endif
+}
+
+bool TraceFile::Fits(Pos pos) const {
+  return pos + RECORD_HEADER_SIZE <= end &&
+    pos + RECORD_HEADER_SIZE + Padded(Get32(data + pos + 4)) <= end;
+}
+
+TraceFile::Pos TraceFile::SkipInternal(Pos pos) const {
+  while (pos < end) {
+    // The header scan never gets here with a bad length, but the
+    // index only vouches for the digest records. Treat a record that
+    // runs past the end like the scan does: as the end of the file.
+    if (!Fits(pos)) return end;
+    if (Get32(data + pos) != REC_DIGEST) break;
+    pos += RECORD_HEADER_SIZE;
+  }
+  return pos;
+}
+
+TraceFile::Pos TraceFile::Begin() const {
+  return SkipInternal(FILE_HEADER_SIZE);
+}
+
+TraceFile::Pos TraceFile::Next(Pos pos) const {
+  return SkipInternal(pos + RECORD_HEADER_SIZE +
+                      Padded(Get32(data + pos + 4)));
+}
+
+Traces::Trace TraceFile::Get(Pos pos) const {
+  if (pos >= end || !Fits(pos)) {
+    fprintf(stderr, "Bad trace record position %llu.\n",
+            (unsigned long long)pos);
+    abort();
+  }
+  const uint8 *rec = data + pos;
+  const uint32 type = Get32(rec);
+  const uint32 len = Get32(rec + 4);
+  const uint8 *payload = rec + RECORD_HEADER_SIZE;
+  Traces::Trace t((Traces::TraceType)type);
+  switch (type) {
+  case Traces::STRING:
+    t.data_string.assign((const char *)payload, len);
+    break;
+  case Traces::MEMORY:
+    t.data_memory =
+      RLE::Decompress(vector<uint8>(payload, payload + len));
+    break;
+  case Traces::NUMBER:
+    t.data_number = Get64(rec + 8);
+    break;
+  default:
+    fprintf(stderr, "Bad trace record type %u.\n", type);
+    abort();
+  }
+  return t;
+}
+
+bool TraceFile::Equal(const TraceFile &l, Pos lpos,
+                      const TraceFile &r, Pos rpos) {
+  const uint8 *lrec = l.data + lpos, *rrec = r.data + rpos;
+  // Since compression is deterministic, the records are equal
+  // exactly when their bytes are.
+  if (0 != memcmp(lrec, rrec, RECORD_HEADER_SIZE)) return false;
+  const uint32 len = Get32(lrec + 4);
+  return 0 == memcmp(lrec + RECORD_HEADER_SIZE,
+                     rrec + RECORD_HEADER_SIZE, len);
+}
+
+uint64 TraceFile::Digest(int i) const {
+  return Get64(data + digests[i] + 8);
+}
+
+TraceFile::Pos TraceFile::AfterDigest(int i) const {
+  return SkipInternal(digests[i] + RECORD_HEADER_SIZE);
+}
@@ -13,6 +13,14 @@
 // a history of execution that should agree byte-for-byte between two
 // versions that bookend the regression. Diffing the trace lets us semi-
 // automatically narrow in on the moment that they diverge.
+//
+// Trace files are append-only sequences of records, each with a
+// fixed-size header. After every DIGEST_INTERVAL traces there is a
+// digest of all the traces so far, and when the file is closed, an
+// index of the digests is appended. Two traces can then be compared
+// (see TraceFile, difftrace.cc) by binary searching for the first
+// digest that differs and only looking at traces after that, so the
+// files never need to be loaded.
 
 struct Traces {
   // Value semantics; when this is running, all performance bets are off.
@@ -63,13 +71,78 @@ struct Traces {
 
   // Note that this opens the file (clobbering it).
   Traces();
+  // Finishes the file (writing the digest index).
+  ~Traces();
 
-  // To compare traces, use this.
+  // Loads all of the traces into memory. This also reads files in
+  // the old format (before digests and the fixed-size headers). For
+  // large files, use TraceFile.
   static std::vector<Trace> ReadFromFile(const std::string &filename);
 
+  // Number of traces between digests.
+  static constexpr int DIGEST_INTERVAL = 4096;
+
  private:
+  void Open(const std::string &filename);
+  // Write the digest index and close the file.
+  void Close();
+  void WriteRecord(uint32_t type, uint64_t number,
+                   const uint8_t *payload, uint32_t len);
+
   bool enabled = true;
   FILE *fp = nullptr;
+  // Bytes written to the current file.
+  uint64_t offset = 0ULL;
+  // Running digest of the traces (not including digest records).
+  uint64_t digest = 0ULL;
+  int since_digest = 0;
+  // Offsets of the digest records.
+  std::vector<uint64_t> digest_offsets;
+};
+
+// Read-only, memory-mapped view of a trace file.
+struct TraceFile {
+  // Aborts if the file can't be read.
+  explicit TraceFile(const std::string &filename);
+  ~TraceFile();
+
+  // False if the file is in the old format, in which case it can
+  // only be read with Traces::ReadFromFile.
+  bool Valid() const { return valid; }
+
+  // Positions of trace records are byte offsets. Digest and index
+  // records are skipped. Next(pos) is End() after the last trace.
+  using Pos = uint64_t;
+  Pos Begin() const;
+  Pos End() const { return end; }
+  Pos Next(Pos pos) const;
+  Traces::Trace Get(Pos pos) const;
+  // Whether the traces are exactly the same. Much cheaper than Get.
+  static bool Equal(const TraceFile &l, Pos lpos,
+                    const TraceFile &r, Pos rpos);
+
+  // Digest i covers the first (i + 1) * DigestInterval() traces.
+  int DigestInterval() const { return digest_interval; }
+  int NumDigests() const { return (int)digests.size(); }
+  uint64_t Digest(int i) const;
+  // Position of the first trace after digest i.
+  Pos AfterDigest(int i) const;
+
+ private:
+  // Skip digest and index records.
+  Pos SkipInternal(Pos pos) const;
+  // Whether the record at pos, including its payload, is before end.
+  bool Fits(Pos pos) const;
+  bool valid = false;
+  const uint8_t *data = nullptr;
+  uint64_t size = 0;
+  // End of the records (excluding any index and footer).
+  Pos end = 0;
+  int digest_interval = 0;
+  std::vector<uint64_t> digests;
+  // Only used if the file could not be mapped.
+  std::vector<uint8_t> contents;
+  bool mapped = false;
 };
 
 #endif  // __TRACE_H
@@ -0,0 +1,138 @@
+
+#include "transition-cache.h"
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "city/city.h"
+#include "base/logging.h"
+
+using namespace std;
+
+TransitionCache::TransitionCache(int64 max_bytes, int num_shards)
+  : num_shards(num_shards),
+    shard_bytes(max_bytes / num_shards),
+    shards(new Shard[num_shards]) {
+  CHECK(num_shards > 0);
+  CHECK(max_bytes >= 0);
+}
+
+TransitionCache::Key TransitionCache::MakeKey(const vector<uint8> &start,
+                                              uint16 controllers) {
+  const uint128 h =
+    CityHash128WithSeed((const char *)start.data(), start.size(),
+                        uint128(controllers, 0x5EED5EED5EED5EEDULL));
+  return Key{Uint128Low64(h), Uint128High64(h)};
+}
+
+bool TransitionCache::Lookup(const vector<uint8> &start,
+                             uint16 controllers,
+                             vector<uint8> *result) {
+  const Key key = MakeKey(start, controllers);
+  Shard *shard = GetShard(key);
+  {
+    lock_guard<mutex> ml(shard->m);
+    auto it = shard->index.find(key);
+    if (it != shard->index.end()) {
+      Entry *entry = &shard->entries[it->second];
+      entry->referenced = true;
+      *result = entry->result;
+      hits++;
+      return true;
+    }
+  }
+  misses++;
+  return false;
+}
+
+void TransitionCache::EvictOne(Shard *shard) {
+  const size_t n = shard->entries.size();
+  DCHECK(n > 0);
+  // Terminates within two passes, since every entry we skip has its
+  // bit cleared.
+  for (;;) {
+    if (shard->hand >= n) shard->hand = 0;
+    Entry *entry = &shard->entries[shard->hand];
+    if (entry->referenced) {
+      entry->referenced = false;
+      shard->hand++;
+    } else {
+      break;
+    }
+  }
+
+  // Remove the victim by moving the last entry into its slot. The
+  // hand stays put, so the moved entry is considered next.
+  const int victim = shard->hand;
+  shard->index.erase(shard->entries[victim].key);
+  shard->bytes -= shard->entries[victim].result.size();
+  const int last = (int)n - 1;
+  if (victim != last) {
+    shard->entries[victim] = std::move(shard->entries[last]);
+    shard->index[shard->entries[victim].key] = victim;
+  }
+  shard->entries.pop_back();
+  evictions++;
+}
+
+void TransitionCache::Remember(const vector<uint8> &start,
+                               uint16 controllers,
+                               const vector<uint8> &result) {
+  const int64 size = result.size();
+  // Would never fit.
+  if (size > shard_bytes) return;
+
+  const Key key = MakeKey(start, controllers);
+  Shard *shard = GetShard(key);
+  lock_guard<mutex> ml(shard->m);
+  if (shard->index.find(key) != shard->index.end()) return;
+
+  while (shard->bytes + size > shard_bytes)
+    EvictOne(shard);
+
+  // New entries start unreferenced, so that something used only
+  // once is the first to go.
+  shard->index[key] = (int)shard->entries.size();
+  shard->entries.push_back(Entry{key, result, false});
+  shard->bytes += size;
+}
+
+void TransitionCache::Clear() {
+  for (int i = 0; i < num_shards; i++) {
+    Shard *shard = &shards[i];
+    lock_guard<mutex> ml(shard->m);
+    shard->index.clear();
+    shard->entries.clear();
+    shard->entries.shrink_to_fit();
+    shard->hand = 0;
+    shard->bytes = 0;
+  }
+}
+
+TransitionCache::Stats TransitionCache::GetStats() {
+  Stats stats;
+  stats.hits = hits.load();
+  stats.misses = misses.load();
+  stats.evictions = evictions.load();
+  for (int i = 0; i < num_shards; i++) {
+    Shard *shard = &shards[i];
+    lock_guard<mutex> ml(shard->m);
+    stats.entries += shard->entries.size();
+    stats.bytes += shard->bytes;
+  }
+  return stats;
+}
+
+void TransitionCache::PrintStats() {
+  const Stats stats = GetStats();
+  const int64 lookups = stats.hits + stats.misses;
+  printf("Transition cache: %lld entries, %.2f MB (limit %.2f MB)\n"
+         "%lld hits, %lld misses (%.2f%% hit rate), %lld evictions\n",
+         (long long)stats.entries,
+         stats.bytes / (1024.0 * 1024.0),
+         (shard_bytes * num_shards) / (1024.0 * 1024.0),
+         (long long)stats.hits, (long long)stats.misses,
+         lookups > 0 ? (100.0 * stats.hits) / lookups : 0.0,
+         (long long)stats.evictions);
+}
@@ -0,0 +1,100 @@
+/*
+  Memoizes emulator transitions (state, input) -> state. Search
+  procedures replay the same inputs from the same states over and
+  over; when they do, restoring the remembered result is much cheaper
+  than emulating the frame again. Safe to share between threads (and
+  emulators of the same game); the table is split into shards that
+  each have their own lock.
+
+  Entries are keyed by a 128-bit hash of the uncompressed start state
+  and the input, so the start state itself is not stored. Memory is
+  bounded by the size of the stored result states, with CLOCK
+  (second-chance) eviction within each shard.
+*/
+
+#ifndef __TRANSITION_CACHE_H
+#define __TRANSITION_CACHE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+struct TransitionCache {
+  // The cache will use about max_bytes for result states (plus some
+  // bookkeeping overhead per entry). num_shards should be comfortably
+  // larger than the number of threads using the cache.
+  explicit TransitionCache(int64 max_bytes, int num_shards = 64);
+
+  // See Emulator::CachingStep16 for the typical use. start and
+  // result are uncompressed save states. Returns true and copies the
+  // result state if the transition is known.
+  bool Lookup(const std::vector<uint8> &start, uint16 controllers,
+              std::vector<uint8> *result);
+  // Remembers a transition, possibly evicting others. Does nothing
+  // if it is already present.
+  void Remember(const std::vector<uint8> &start, uint16 controllers,
+                const std::vector<uint8> &result);
+
+  // Discard all entries. Does not reset the counters.
+  void Clear();
+
+  struct Stats {
+    int64 hits = 0;
+    int64 misses = 0;
+    int64 evictions = 0;
+    // Current contents.
+    int64 entries = 0;
+    int64 bytes = 0;
+  };
+  // The counters are updated without stopping the world, so this is
+  // only a consistent snapshot when the cache is not in use.
+  Stats GetStats();
+  void PrintStats();
+
+ private:
+  struct Key {
+    uint64 lo, hi;
+    bool operator ==(const Key &other) const {
+      return lo == other.lo && hi == other.hi;
+    }
+  };
+  struct KeyHash {
+    // The key is already a good hash.
+    size_t operator ()(const Key &k) const { return (size_t)k.lo; }
+  };
+  struct Entry {
+    Key key;
+    std::vector<uint8> result;
+    // Set when used; cleared as the clock hand passes.
+    bool referenced;
+  };
+  struct Shard {
+    std::mutex m;
+    // Index into entries.
+    std::unordered_map<Key, int, KeyHash> index;
+    std::vector<Entry> entries;
+    // Clock hand; index into entries.
+    size_t hand = 0;
+    int64 bytes = 0;
+  };
+
+  static Key MakeKey(const std::vector<uint8> &start, uint16 controllers);
+  Shard *GetShard(const Key &key) {
+    return &shards[(key.hi >> 32) % num_shards];
+  }
+  // Remove one entry by running the clock. Shard must be locked and
+  // nonempty.
+  void EvictOne(Shard *shard);
+
+  const int num_shards;
+  const int64 shard_bytes;
+  std::unique_ptr<Shard[]> shards;
+
+  std::atomic<int64> hits{0}, misses{0}, evictions{0};
+};
+
+#endif
@@ -22,6 +22,8 @@
 #include "types.h"
 #include "x6502.h"
 #include "fceu.h"
+#include "cart.h"
+#include "aot-runtime.h"
 #include "sound.h"
 
 #include "tracing.h"
@@ -50,12 +52,14 @@ X6502::X6502(FC *fc) : fc(fc) {
 
 uint8 X6502::DMR(uint32 A) {
   ADDCYC(1);
-  return (DB = fc->fceu->ARead[A](fc, A));
+  PERFCOUNT(perf.dma_cycles++);
+  return RdMem(A);
 }
 
 void X6502::DMW(uint32 A, uint8 V) {
   ADDCYC(1);
-  fc->fceu->BWrite[A](fc, A, V);
+  PERFCOUNT(perf.dma_cycles++);
+  WrMem(A, V);
 }
 
 #define PUSH(V)              \
@@ -655,6 +659,15 @@ void X6502::Run(int32 cycles) {
   cycles_histo[std::max(0, std::min(cycles, 1023))]++;
   #endif
   
+  // Compiled code writes RAM directly, so it can't be used while
+  // RAM is watched.
+  if (aot != nullptr && fc->fceu->ram_watch == nullptr && AOTPagesMapped()) {
+    aot_stale = false;
+    // Does its own cycle accounting.
+    aot->run(fc, cycles);
+    return;
+  }
+
   if (fc->fceu->PAL) {
     cycles *= 15;  // 15*4=60
   } else {
@@ -666,7 +679,45 @@ void X6502::Run(int32 cycles) {
   RunLoop();
 }
 
+bool X6502::AOTPagesMapped() const {
+  for (uint32 p = aot->code_start >> 11;
+       p <= (aot->code_past_end - 1) >> 11;
+       p++) {
+    if (fc->cart->PageIdentity(p) != aot_pages[p])
+      return false;
+  }
+  return true;
+}
+
+// Opcode dispatch. With GCC's "labels as values" extension, each
+// opcode also gets a label, and RunLoop jumps straight to it through
+// its own table. This is the same as the switch, but skips the range
+// check and gives each opcode its own indirect jump, which the branch
+// predictor does much better with. Define X6502_SWITCH_DISPATCH to
+// use the plain switch.
+#if defined(__GNUC__) && !defined(X6502_SWITCH_DISPATCH)
+# define X6502_COMPUTED_GOTO 1
+# define OPCODE(h) case 0x##h: op_##h:
+# define OPCODE_ROW(r) \
+  &&op_##r##0, &&op_##r##1, &&op_##r##2, &&op_##r##3, \
+  &&op_##r##4, &&op_##r##5, &&op_##r##6, &&op_##r##7, \
+  &&op_##r##8, &&op_##r##9, &&op_##r##A, &&op_##r##B, \
+  &&op_##r##C, &&op_##r##D, &&op_##r##E, &&op_##r##F
+#else
+# define X6502_COMPUTED_GOTO 0
+# define OPCODE(h) case 0x##h:
+#endif
+
 void X6502::RunLoop() {
+#if X6502_COMPUTED_GOTO
+  static const void *const opcode_labels[256] = {
+    OPCODE_ROW(0), OPCODE_ROW(1), OPCODE_ROW(2), OPCODE_ROW(3),
+    OPCODE_ROW(4), OPCODE_ROW(5), OPCODE_ROW(6), OPCODE_ROW(7),
+    OPCODE_ROW(8), OPCODE_ROW(9), OPCODE_ROW(A), OPCODE_ROW(B),
+    OPCODE_ROW(C), OPCODE_ROW(D), OPCODE_ROW(E), OPCODE_ROW(F),
+  };
+#endif
+
   while (count > 0) {
     TRACE_SCOPED_STAY_ENABLED_IF(false);
     TRACEF("while " TRACE_MACHINEFMT, TRACE_MACHINEARGS);
@@ -685,6 +736,7 @@ void X6502::RunLoop() {
         IRQlow |= FCEU_IQNMI;
       } else if (IRQlow & FCEU_IQNMI) {
         if (!jammed) {
+          PERFCOUNT(perf.nmis++);
           ADDCYC(7);
           PUSH(reg_PC >> 8);
           PUSH(reg_PC);
@@ -696,6 +748,7 @@ void X6502::RunLoop() {
         }
       } else {
         if (!(reg_PI & I_FLAG) && !jammed) {
+          PERFCOUNT(perf.irqs++);
           ADDCYC(7);
           PUSH(reg_PC >> 8);
           PUSH(reg_PC);
@@ -723,17 +776,25 @@ void X6502::RunLoop() {
     
     const uint8 b1 = RdMem(reg_PC);
     // printf("Read %x -> opcode %02x\n", reg_PC, b1);
+    PERFCOUNT(perf.instructions++);
 
     ADDCYC(CycTable[b1]);
 
     int32 temp = tcount;
     tcount = 0;
-    if (MapIRQHook) MapIRQHook(fc, temp);
+    if (MapIRQHook) {
+      PERFCOUNT(perf.mapper_cpu_hooks++);
+      MapIRQHook(fc, temp);
+    }
     fc->sound->SoundCPUHook(temp);
     reg_PC++;
     TRACEN(b1);
+#if X6502_COMPUTED_GOTO
+    // Jump into the switch body; "break" still leaves it as usual.
+    goto *opcode_labels[b1];
+#endif
     switch (b1) {
-      case 0x00: /* BRK */
+      OPCODE(00) /* BRK */
         reg_PC++;
         PUSH(reg_PC >> 8);
         PUSH(reg_PC);
@@ -744,7 +805,7 @@ void X6502::RunLoop() {
         reg_PC |= RdMem(0xFFFF) << 8;
         break;
 
-      case 0x40: /* RTI */
+      OPCODE(40) /* RTI */
         reg_P = POP();
         /* reg_PI=reg_P; This is probably incorrect, so it's commented out. */
         reg_PI = reg_P;
@@ -752,20 +813,20 @@ void X6502::RunLoop() {
         reg_PC |= POP() << 8;
         break;
 
-      case 0x60: /* RTS */
+      OPCODE(60) /* RTS */
         reg_PC = POP();
         reg_PC |= POP() << 8;
         reg_PC++;
         break;
 
-      case 0x48: /* PHA */ PUSH(reg_A); break;
-      case 0x08: /* PHP */ PUSH(reg_P | U_FLAG | B_FLAG); break;
-      case 0x68: /* PLA */
+      OPCODE(48) /* PHA */ PUSH(reg_A); break;
+      OPCODE(08) /* PHP */ PUSH(reg_P | U_FLAG | B_FLAG); break;
+      OPCODE(68) /* PLA */
         reg_A = POP();
         X_ZN(reg_A);
         break;
-      case 0x28: /* PLP */ reg_P = POP(); break;
-      case 0x4C: {
+      OPCODE(28) /* PLP */ reg_P = POP(); break;
+      OPCODE(4C) {
         /* JMP ABSOLUTE */
         uint16 ptmp = reg_PC;
         unsigned int npc;
@@ -775,7 +836,7 @@ void X6502::RunLoop() {
         npc |= RdMem(ptmp) << 8;
         reg_PC = npc;
       } break;
-      case 0x6C: {
+      OPCODE(6C) {
         /* JMP INDIRECT */
         uint32 tmp;
         GetAB(tmp);
@@ -783,7 +844,7 @@ void X6502::RunLoop() {
         reg_PC |= RdMem(((tmp + 1) & 0x00FF) | (tmp & 0xFF00)) << 8;
         break;
       }
-      case 0x20: /* JSR */
+      OPCODE(20) /* JSR */
       {
         uint8 npc;
         npc = RdMem(reg_PC);
@@ -794,237 +855,237 @@ void X6502::RunLoop() {
         reg_PC |= npc;
         break;
       }
-      case 0xAA: /* TAX */
+      OPCODE(AA) /* TAX */
         reg_X = reg_A;
         X_ZN(reg_A);
         break;
 
-      case 0x8A: /* TXA */
+      OPCODE(8A) /* TXA */
         reg_A = reg_X;
         X_ZN(reg_A);
         break;
 
-      case 0xA8: /* TAY */
+      OPCODE(A8) /* TAY */
         reg_Y = reg_A;
         X_ZN(reg_A);
         break;
-      case 0x98: /* TYA */
+      OPCODE(98) /* TYA */
         reg_A = reg_Y;
         X_ZN(reg_A);
         break;
 
-      case 0xBA: /* TSX */
+      OPCODE(BA) /* TSX */
         reg_X = reg_S;
         X_ZN(reg_X);
         break;
-      case 0x9A: /* TXS */
+      OPCODE(9A) /* TXS */
         reg_S = reg_X;
         break;
 
-      case 0xCA: /* DEX */
+      OPCODE(CA) /* DEX */
         reg_X--;
         X_ZN(reg_X);
         break;
-      case 0x88: /* DEY */
+      OPCODE(88) /* DEY */
         reg_Y--;
         X_ZN(reg_Y);
         break;
 
-      case 0xE8: /* INX */
+      OPCODE(E8) /* INX */
         reg_X++;
         X_ZN(reg_X);
         break;
-      case 0xC8: /* INY */
+      OPCODE(C8) /* INY */
         reg_Y++;
         X_ZN(reg_Y);
         break;
 
-      case 0x18: /* CLC */ reg_P &= ~C_FLAG; break;
-      case 0xD8: /* CLD */ reg_P &= ~D_FLAG; break;
-      case 0x58: /* CLI */ reg_P &= ~I_FLAG; break;
-      case 0xB8: /* CLV */ reg_P &= ~V_FLAG; break;
-
-      case 0x38: /* SEC */ reg_P |= C_FLAG; break;
-      case 0xF8: /* SED */ reg_P |= D_FLAG; break;
-      case 0x78: /* SEI */ reg_P |= I_FLAG; break;
-
-      case 0xEA: /* NOP */ break;
-
-      case 0x0A: RMW_A(ASL);
-      case 0x06: RMW_ZP(ASL);
-      case 0x16: RMW_ZPX(ASL);
-      case 0x0E: RMW_AB(ASL);
-      case 0x1E: RMW_ABX(ASL);
-
-      case 0xC6: RMW_ZP(DEC);
-      case 0xD6: RMW_ZPX(DEC);
-      case 0xCE: RMW_AB(DEC);
-      case 0xDE: RMW_ABX(DEC);
-
-      case 0xE6: RMW_ZP(INC);
-      case 0xF6: RMW_ZPX(INC);
-      case 0xEE: RMW_AB(INC);
-      case 0xFE: RMW_ABX(INC);
-
-      case 0x4A: RMW_A(LSR);
-      case 0x46: RMW_ZP(LSR);
-      case 0x56: RMW_ZPX(LSR);
-      case 0x4E: RMW_AB(LSR);
-      case 0x5E: RMW_ABX(LSR);
-
-      case 0x2A: RMW_A(ROL);
-      case 0x26: RMW_ZP(ROL);
-      case 0x36: RMW_ZPX(ROL);
-      case 0x2E: RMW_AB(ROL);
-      case 0x3E: RMW_ABX(ROL);
-
-      case 0x6A: RMW_A(ROR);
-      case 0x66: RMW_ZP(ROR);
-      case 0x76: RMW_ZPX(ROR);
-      case 0x6E: RMW_AB(ROR);
-      case 0x7E: RMW_ABX(ROR);
-
-      case 0x69: LD_IM(ADC);
-      case 0x65: LD_ZP(ADC);
-      case 0x75: LD_ZPX(ADC);
-      case 0x6D: LD_AB(ADC);
-      case 0x7D: LD_ABX(ADC);
-      case 0x79: LD_ABY(ADC);
-      case 0x61: LD_IX(ADC);
-      case 0x71: LD_IY(ADC);
-
-      case 0x29: LD_IM(AND);
-      case 0x25: LD_ZP(AND);
-      case 0x35: LD_ZPX(AND);
-      case 0x2D: LD_AB(AND);
-      case 0x3D: LD_ABX(AND);
-      case 0x39: LD_ABY(AND);
-      case 0x21: LD_IX(AND);
-      case 0x31: LD_IY(AND);
-
-      case 0x24: LD_ZP(BIT);
-      case 0x2C: LD_AB(BIT);
-
-      case 0xC9: LD_IM(CMP);
-      case 0xC5: LD_ZP(CMP);
-      case 0xD5: LD_ZPX(CMP);
-      case 0xCD: LD_AB(CMP);
-      case 0xDD: LD_ABX(CMP);
-      case 0xD9: LD_ABY(CMP);
-      case 0xC1: LD_IX(CMP);
-      case 0xD1: LD_IY(CMP);
-
-      case 0xE0: LD_IM(CPX);
-      case 0xE4: LD_ZP(CPX);
-      case 0xEC: LD_AB(CPX);
-
-      case 0xC0: LD_IM(CPY);
-      case 0xC4: LD_ZP(CPY);
-      case 0xCC: LD_AB(CPY);
-
-      case 0x49: LD_IM(EOR);
-      case 0x45: LD_ZP(EOR);
-      case 0x55: LD_ZPX(EOR);
-      case 0x4D: LD_AB(EOR);
-      case 0x5D: LD_ABX(EOR);
-      case 0x59: LD_ABY(EOR);
-      case 0x41: LD_IX(EOR);
-      case 0x51: LD_IY(EOR);
-
-      case 0xA9: LD_IM(LDA);
-      case 0xA5: LD_ZP(LDA);
-      case 0xB5: LD_ZPX(LDA);
-      case 0xAD: LD_AB(LDA);
-      case 0xBD: LD_ABX(LDA);
-      case 0xB9: LD_ABY(LDA);
-      case 0xA1: LD_IX(LDA);
-      case 0xB1: LD_IY(LDA);
-
-      case 0xA2: LD_IM(LDX);
-      case 0xA6: LD_ZP(LDX);
-      case 0xB6: LD_ZPY(LDX);
-      case 0xAE: LD_AB(LDX);
-      case 0xBE: LD_ABY(LDX);
-
-      case 0xA0: LD_IM(LDY);
-      case 0xA4: LD_ZP(LDY);
-      case 0xB4: LD_ZPX(LDY);
-      case 0xAC: LD_AB(LDY);
-      case 0xBC: LD_ABX(LDY);
-
-      case 0x09: LD_IM(ORA);
-      case 0x05: LD_ZP(ORA);
-      case 0x15: LD_ZPX(ORA);
-      case 0x0D: LD_AB(ORA);
-      case 0x1D: LD_ABX(ORA);
-      case 0x19: LD_ABY(ORA);
-      case 0x01: LD_IX(ORA);
-      case 0x11: LD_IY(ORA);
-
-      case 0xEB: /* (undocumented) */
-      case 0xE9: LD_IM(SBC);
-      case 0xE5: LD_ZP(SBC);
-      case 0xF5: LD_ZPX(SBC);
-      case 0xED: LD_AB(SBC);
-      case 0xFD: LD_ABX(SBC);
-      case 0xF9: LD_ABY(SBC);
-      case 0xE1: LD_IX(SBC);
-      case 0xF1: LD_IY(SBC);
-
-      case 0x85: ST_ZP(reg_A);
-      case 0x95: ST_ZPX(reg_A);
-      case 0x8D: ST_AB(reg_A);
-      case 0x9D: ST_ABX(reg_A);
-      case 0x99: ST_ABY(reg_A);
-      case 0x81: ST_IX(reg_A);
-      case 0x91: ST_IY(reg_A);
-
-      case 0x86: ST_ZP(reg_X);
-      case 0x96: ST_ZPY(reg_X);
-      case 0x8E: ST_AB(reg_X);
-
-      case 0x84: ST_ZP(reg_Y);
-      case 0x94: ST_ZPX(reg_Y);
-      case 0x8C:
+      OPCODE(18) /* CLC */ reg_P &= ~C_FLAG; break;
+      OPCODE(D8) /* CLD */ reg_P &= ~D_FLAG; break;
+      OPCODE(58) /* CLI */ reg_P &= ~I_FLAG; break;
+      OPCODE(B8) /* CLV */ reg_P &= ~V_FLAG; break;
+
+      OPCODE(38) /* SEC */ reg_P |= C_FLAG; break;
+      OPCODE(F8) /* SED */ reg_P |= D_FLAG; break;
+      OPCODE(78) /* SEI */ reg_P |= I_FLAG; break;
+
+      OPCODE(EA) /* NOP */ break;
+
+      OPCODE(0A) RMW_A(ASL);
+      OPCODE(06) RMW_ZP(ASL);
+      OPCODE(16) RMW_ZPX(ASL);
+      OPCODE(0E) RMW_AB(ASL);
+      OPCODE(1E) RMW_ABX(ASL);
+
+      OPCODE(C6) RMW_ZP(DEC);
+      OPCODE(D6) RMW_ZPX(DEC);
+      OPCODE(CE) RMW_AB(DEC);
+      OPCODE(DE) RMW_ABX(DEC);
+
+      OPCODE(E6) RMW_ZP(INC);
+      OPCODE(F6) RMW_ZPX(INC);
+      OPCODE(EE) RMW_AB(INC);
+      OPCODE(FE) RMW_ABX(INC);
+
+      OPCODE(4A) RMW_A(LSR);
+      OPCODE(46) RMW_ZP(LSR);
+      OPCODE(56) RMW_ZPX(LSR);
+      OPCODE(4E) RMW_AB(LSR);
+      OPCODE(5E) RMW_ABX(LSR);
+
+      OPCODE(2A) RMW_A(ROL);
+      OPCODE(26) RMW_ZP(ROL);
+      OPCODE(36) RMW_ZPX(ROL);
+      OPCODE(2E) RMW_AB(ROL);
+      OPCODE(3E) RMW_ABX(ROL);
+
+      OPCODE(6A) RMW_A(ROR);
+      OPCODE(66) RMW_ZP(ROR);
+      OPCODE(76) RMW_ZPX(ROR);
+      OPCODE(6E) RMW_AB(ROR);
+      OPCODE(7E) RMW_ABX(ROR);
+
+      OPCODE(69) LD_IM(ADC);
+      OPCODE(65) LD_ZP(ADC);
+      OPCODE(75) LD_ZPX(ADC);
+      OPCODE(6D) LD_AB(ADC);
+      OPCODE(7D) LD_ABX(ADC);
+      OPCODE(79) LD_ABY(ADC);
+      OPCODE(61) LD_IX(ADC);
+      OPCODE(71) LD_IY(ADC);
+
+      OPCODE(29) LD_IM(AND);
+      OPCODE(25) LD_ZP(AND);
+      OPCODE(35) LD_ZPX(AND);
+      OPCODE(2D) LD_AB(AND);
+      OPCODE(3D) LD_ABX(AND);
+      OPCODE(39) LD_ABY(AND);
+      OPCODE(21) LD_IX(AND);
+      OPCODE(31) LD_IY(AND);
+
+      OPCODE(24) LD_ZP(BIT);
+      OPCODE(2C) LD_AB(BIT);
+
+      OPCODE(C9) LD_IM(CMP);
+      OPCODE(C5) LD_ZP(CMP);
+      OPCODE(D5) LD_ZPX(CMP);
+      OPCODE(CD) LD_AB(CMP);
+      OPCODE(DD) LD_ABX(CMP);
+      OPCODE(D9) LD_ABY(CMP);
+      OPCODE(C1) LD_IX(CMP);
+      OPCODE(D1) LD_IY(CMP);
+
+      OPCODE(E0) LD_IM(CPX);
+      OPCODE(E4) LD_ZP(CPX);
+      OPCODE(EC) LD_AB(CPX);
+
+      OPCODE(C0) LD_IM(CPY);
+      OPCODE(C4) LD_ZP(CPY);
+      OPCODE(CC) LD_AB(CPY);
+
+      OPCODE(49) LD_IM(EOR);
+      OPCODE(45) LD_ZP(EOR);
+      OPCODE(55) LD_ZPX(EOR);
+      OPCODE(4D) LD_AB(EOR);
+      OPCODE(5D) LD_ABX(EOR);
+      OPCODE(59) LD_ABY(EOR);
+      OPCODE(41) LD_IX(EOR);
+      OPCODE(51) LD_IY(EOR);
+
+      OPCODE(A9) LD_IM(LDA);
+      OPCODE(A5) LD_ZP(LDA);
+      OPCODE(B5) LD_ZPX(LDA);
+      OPCODE(AD) LD_AB(LDA);
+      OPCODE(BD) LD_ABX(LDA);
+      OPCODE(B9) LD_ABY(LDA);
+      OPCODE(A1) LD_IX(LDA);
+      OPCODE(B1) LD_IY(LDA);
+
+      OPCODE(A2) LD_IM(LDX);
+      OPCODE(A6) LD_ZP(LDX);
+      OPCODE(B6) LD_ZPY(LDX);
+      OPCODE(AE) LD_AB(LDX);
+      OPCODE(BE) LD_ABY(LDX);
+
+      OPCODE(A0) LD_IM(LDY);
+      OPCODE(A4) LD_ZP(LDY);
+      OPCODE(B4) LD_ZPX(LDY);
+      OPCODE(AC) LD_AB(LDY);
+      OPCODE(BC) LD_ABX(LDY);
+
+      OPCODE(09) LD_IM(ORA);
+      OPCODE(05) LD_ZP(ORA);
+      OPCODE(15) LD_ZPX(ORA);
+      OPCODE(0D) LD_AB(ORA);
+      OPCODE(1D) LD_ABX(ORA);
+      OPCODE(19) LD_ABY(ORA);
+      OPCODE(01) LD_IX(ORA);
+      OPCODE(11) LD_IY(ORA);
+
+      OPCODE(EB) /* (undocumented) */
+      OPCODE(E9) LD_IM(SBC);
+      OPCODE(E5) LD_ZP(SBC);
+      OPCODE(F5) LD_ZPX(SBC);
+      OPCODE(ED) LD_AB(SBC);
+      OPCODE(FD) LD_ABX(SBC);
+      OPCODE(F9) LD_ABY(SBC);
+      OPCODE(E1) LD_IX(SBC);
+      OPCODE(F1) LD_IY(SBC);
+
+      OPCODE(85) ST_ZP(reg_A);
+      OPCODE(95) ST_ZPX(reg_A);
+      OPCODE(8D) ST_AB(reg_A);
+      OPCODE(9D) ST_ABX(reg_A);
+      OPCODE(99) ST_ABY(reg_A);
+      OPCODE(81) ST_IX(reg_A);
+      OPCODE(91) ST_IY(reg_A);
+
+      OPCODE(86) ST_ZP(reg_X);
+      OPCODE(96) ST_ZPY(reg_X);
+      OPCODE(8E) ST_AB(reg_X);
+
+      OPCODE(84) ST_ZP(reg_Y);
+      OPCODE(94) ST_ZPX(reg_Y);
+      OPCODE(8C)
         ST_AB(reg_Y);
 
       /* BCC */
-      case 0x90:
+      OPCODE(90)
         JR(!(reg_P & C_FLAG));
         break;
 
       /* BCS */
-      case 0xB0:
+      OPCODE(B0)
         JR(reg_P & C_FLAG);
         break;
 
       /* BEQ */
-      case 0xF0:
+      OPCODE(F0)
         JR(reg_P & Z_FLAG);
         break;
 
       /* BNE */
-      case 0xD0:
+      OPCODE(D0)
         JR(!(reg_P & Z_FLAG));
         break;
 
       /* BMI */
-      case 0x30:
+      OPCODE(30)
         JR(reg_P & N_FLAG);
         break;
 
       /* BPL */
-      case 0x10:
+      OPCODE(10)
         JR(!(reg_P & N_FLAG));
         break;
 
       /* BVC */
-      case 0x50:
+      OPCODE(50)
         JR(!(reg_P & V_FLAG));
         break;
 
       /* BVS */
-      case 0x70:
+      OPCODE(70)
         JR(reg_P & V_FLAG);
         break;
 
@@ -1034,178 +1095,178 @@ void X6502::RunLoop() {
       */
 
       /* AAC */
-      case 0x2B:
-      case 0x0B:
+      OPCODE(2B)
+      OPCODE(0B)
         LD_IM(AND; reg_P &= ~C_FLAG; reg_P |= reg_A >> 7);
 
       /* AAX */
-      case 0x87: ST_ZP(reg_A & reg_X);
-      case 0x97: ST_ZPY(reg_A & reg_X);
-      case 0x8F: ST_AB(reg_A & reg_X);
-      case 0x83:
+      OPCODE(87) ST_ZP(reg_A & reg_X);
+      OPCODE(97) ST_ZPY(reg_A & reg_X);
+      OPCODE(8F) ST_AB(reg_A & reg_X);
+      OPCODE(83)
         ST_IX(reg_A & reg_X);
 
       /* ARR - ARGH, MATEY! */
-      case 0x6B: {
+      OPCODE(6B) {
         uint8 arrtmp;
         LD_IM(AND; reg_P &= ~V_FLAG; reg_P |= (reg_A ^ (reg_A >> 1)) & 0x40;
               arrtmp = reg_A >> 7; reg_A >>= 1; reg_A |= (reg_P & C_FLAG) << 7;
               reg_P &= ~C_FLAG; reg_P |= arrtmp; X_ZN(reg_A));
       }
       /* ASR */
-      case 0x4B:
+      OPCODE(4B)
         LD_IM(AND; LSRA);
 
       /* ATX(OAL) Is this(OR with $EE) correct? Blargg did some test
          and found the constant to be OR with is $FF for NES */
-      case 0xAB:
+      OPCODE(AB)
         LD_IM(reg_A |= 0xFF; AND; reg_X = reg_A);
 
       /* AXS */
-      case 0xCB:
+      OPCODE(CB)
         LD_IM(AXS);
 
       /* DCP */
-      case 0xC7: RMW_ZP(DEC; CMP);
-      case 0xD7: RMW_ZPX(DEC; CMP);
-      case 0xCF: RMW_AB(DEC; CMP);
-      case 0xDF: RMW_ABX(DEC; CMP);
-      case 0xDB: RMW_ABY(DEC; CMP);
-      case 0xC3: RMW_IX(DEC; CMP);
-      case 0xD3: RMW_IY(DEC; CMP);
+      OPCODE(C7) RMW_ZP(DEC; CMP);
+      OPCODE(D7) RMW_ZPX(DEC; CMP);
+      OPCODE(CF) RMW_AB(DEC; CMP);
+      OPCODE(DF) RMW_ABX(DEC; CMP);
+      OPCODE(DB) RMW_ABY(DEC; CMP);
+      OPCODE(C3) RMW_IX(DEC; CMP);
+      OPCODE(D3) RMW_IY(DEC; CMP);
 
       /* ISB */
-      case 0xE7: RMW_ZP(INC; SBC);
-      case 0xF7: RMW_ZPX(INC; SBC);
-      case 0xEF: RMW_AB(INC; SBC);
-      case 0xFF: RMW_ABX(INC; SBC);
-      case 0xFB: RMW_ABY(INC; SBC);
-      case 0xE3: RMW_IX(INC; SBC);
-      case 0xF3: RMW_IY(INC; SBC);
+      OPCODE(E7) RMW_ZP(INC; SBC);
+      OPCODE(F7) RMW_ZPX(INC; SBC);
+      OPCODE(EF) RMW_AB(INC; SBC);
+      OPCODE(FF) RMW_ABX(INC; SBC);
+      OPCODE(FB) RMW_ABY(INC; SBC);
+      OPCODE(E3) RMW_IX(INC; SBC);
+      OPCODE(F3) RMW_IY(INC; SBC);
 
       /* DOP */
-      case 0x04: reg_PC++; break;
-      case 0x14: reg_PC++; break;
-      case 0x34: reg_PC++; break;
-      case 0x44: reg_PC++; break;
-      case 0x54: reg_PC++; break;
-      case 0x64: reg_PC++; break;
-      case 0x74: reg_PC++; break;
-
-      case 0x80: reg_PC++; break;
-      case 0x82: reg_PC++; break;
-      case 0x89: reg_PC++; break;
-      case 0xC2: reg_PC++; break;
-      case 0xD4: reg_PC++; break;
-      case 0xE2: reg_PC++; break;
-      case 0xF4: reg_PC++; break;
+      OPCODE(04) reg_PC++; break;
+      OPCODE(14) reg_PC++; break;
+      OPCODE(34) reg_PC++; break;
+      OPCODE(44) reg_PC++; break;
+      OPCODE(54) reg_PC++; break;
+      OPCODE(64) reg_PC++; break;
+      OPCODE(74) reg_PC++; break;
+
+      OPCODE(80) reg_PC++; break;
+      OPCODE(82) reg_PC++; break;
+      OPCODE(89) reg_PC++; break;
+      OPCODE(C2) reg_PC++; break;
+      OPCODE(D4) reg_PC++; break;
+      OPCODE(E2) reg_PC++; break;
+      OPCODE(F4) reg_PC++; break;
 
       /* KIL */
 
-      case 0x02:
-      case 0x12:
-      case 0x22:
-      case 0x32:
-      case 0x42:
-      case 0x52:
-      case 0x62:
-      case 0x72:
-      case 0x92:
-      case 0xB2:
-      case 0xD2:
-      case 0xF2:
+      OPCODE(02)
+      OPCODE(12)
+      OPCODE(22)
+      OPCODE(32)
+      OPCODE(42)
+      OPCODE(52)
+      OPCODE(62)
+      OPCODE(72)
+      OPCODE(92)
+      OPCODE(B2)
+      OPCODE(D2)
+      OPCODE(F2)
         ADDCYC(0xFF);
         jammed = 1;
         reg_PC--;
         break;
 
       /* LAR */
-      case 0xBB:
+      OPCODE(BB)
         RMW_ABY(reg_S &= x; reg_A = reg_X = reg_S; X_ZN(reg_X));
 
       /* LAX */
-      case 0xA7: LD_ZP(LDA; LDX);
-      case 0xB7: LD_ZPY(LDA; LDX);
-      case 0xAF: LD_AB(LDA; LDX);
-      case 0xBF: LD_ABY(LDA; LDX);
-      case 0xA3: LD_IX(LDA; LDX);
-      case 0xB3: LD_IY(LDA; LDX);
+      OPCODE(A7) LD_ZP(LDA; LDX);
+      OPCODE(B7) LD_ZPY(LDA; LDX);
+      OPCODE(AF) LD_AB(LDA; LDX);
+      OPCODE(BF) LD_ABY(LDA; LDX);
+      OPCODE(A3) LD_IX(LDA; LDX);
+      OPCODE(B3) LD_IY(LDA; LDX);
 
       /* NOP */
-      case 0x1A:
-      case 0x3A:
-      case 0x5A:
-      case 0x7A:
-      case 0xDA:
-      case 0xFA:
+      OPCODE(1A)
+      OPCODE(3A)
+      OPCODE(5A)
+      OPCODE(7A)
+      OPCODE(DA)
+      OPCODE(FA)
         break;
 
       /* RLA */
-      case 0x27: RMW_ZP(ROL; AND);
-      case 0x37: RMW_ZPX(ROL; AND);
-      case 0x2F: RMW_AB(ROL; AND);
-      case 0x3F: RMW_ABX(ROL; AND);
-      case 0x3B: RMW_ABY(ROL; AND);
-      case 0x23: RMW_IX(ROL; AND);
-      case 0x33: RMW_IY(ROL; AND);
+      OPCODE(27) RMW_ZP(ROL; AND);
+      OPCODE(37) RMW_ZPX(ROL; AND);
+      OPCODE(2F) RMW_AB(ROL; AND);
+      OPCODE(3F) RMW_ABX(ROL; AND);
+      OPCODE(3B) RMW_ABY(ROL; AND);
+      OPCODE(23) RMW_IX(ROL; AND);
+      OPCODE(33) RMW_IY(ROL; AND);
 
       /* RRA */
-      case 0x67: RMW_ZP(ROR; ADC);
-      case 0x77: RMW_ZPX(ROR; ADC);
-      case 0x6F: RMW_AB(ROR; ADC);
-      case 0x7F: RMW_ABX(ROR; ADC);
-      case 0x7B: RMW_ABY(ROR; ADC);
-      case 0x63: RMW_IX(ROR; ADC);
-      case 0x73: RMW_IY(ROR; ADC);
+      OPCODE(67) RMW_ZP(ROR; ADC);
+      OPCODE(77) RMW_ZPX(ROR; ADC);
+      OPCODE(6F) RMW_AB(ROR; ADC);
+      OPCODE(7F) RMW_ABX(ROR; ADC);
+      OPCODE(7B) RMW_ABY(ROR; ADC);
+      OPCODE(63) RMW_IX(ROR; ADC);
+      OPCODE(73) RMW_IY(ROR; ADC);
 
       /* SLO */
-      case 0x07: RMW_ZP(ASL; ORA);
-      case 0x17: RMW_ZPX(ASL; ORA);
-      case 0x0F: RMW_AB(ASL; ORA);
-      case 0x1F: RMW_ABX(ASL; ORA);
-      case 0x1B: RMW_ABY(ASL; ORA);
-      case 0x03: RMW_IX(ASL; ORA);
-      case 0x13: RMW_IY(ASL; ORA);
+      OPCODE(07) RMW_ZP(ASL; ORA);
+      OPCODE(17) RMW_ZPX(ASL; ORA);
+      OPCODE(0F) RMW_AB(ASL; ORA);
+      OPCODE(1F) RMW_ABX(ASL; ORA);
+      OPCODE(1B) RMW_ABY(ASL; ORA);
+      OPCODE(03) RMW_IX(ASL; ORA);
+      OPCODE(13) RMW_IY(ASL; ORA);
 
       /* SRE */
-      case 0x47: RMW_ZP(LSR; EOR);
-      case 0x57: RMW_ZPX(LSR; EOR);
-      case 0x4F: RMW_AB(LSR; EOR);
-      case 0x5F: RMW_ABX(LSR; EOR);
-      case 0x5B: RMW_ABY(LSR; EOR);
-      case 0x43: RMW_IX(LSR; EOR);
-      case 0x53: RMW_IY(LSR; EOR);
+      OPCODE(47) RMW_ZP(LSR; EOR);
+      OPCODE(57) RMW_ZPX(LSR; EOR);
+      OPCODE(4F) RMW_AB(LSR; EOR);
+      OPCODE(5F) RMW_ABX(LSR; EOR);
+      OPCODE(5B) RMW_ABY(LSR; EOR);
+      OPCODE(43) RMW_IX(LSR; EOR);
+      OPCODE(53) RMW_IY(LSR; EOR);
 
       /* AXA - SHA */
-      case 0x93: ST_IY(reg_A & reg_X & (((AA - reg_Y) >> 8) + 1));
-      case 0x9F: ST_ABY(reg_A & reg_X & (((AA - reg_Y) >> 8) + 1));
+      OPCODE(93) ST_IY(reg_A & reg_X & (((AA - reg_Y) >> 8) + 1));
+      OPCODE(9F) ST_ABY(reg_A & reg_X & (((AA - reg_Y) >> 8) + 1));
 
       /* SYA */
-      case 0x9C:
+      OPCODE(9C)
         ST_ABX(reg_Y & (((AA - reg_X) >> 8) + 1));
 
       /* SXA */
-      case 0x9E:
+      OPCODE(9E)
         ST_ABY(reg_X & (((AA - reg_Y) >> 8) + 1));
 
       /* XAS */
-      case 0x9B:
+      OPCODE(9B)
         reg_S = reg_A & reg_X;
         ST_ABY(reg_S & (((AA - reg_Y) >> 8) + 1));
 
       /* TOP */
-      case 0x0C:
+      OPCODE(0C)
         LD_AB(;);
-      case 0x1C:
-      case 0x3C:
-      case 0x5C:
-      case 0x7C:
-      case 0xDC:
-      case 0xFC:
+      OPCODE(1C)
+      OPCODE(3C)
+      OPCODE(5C)
+      OPCODE(7C)
+      OPCODE(DC)
+      OPCODE(FC)
         LD_ABX(;);
 
       /* XAA - BIG QUESTION MARK HERE */
-      case 0x8B:
+      OPCODE(8B)
         reg_A |= 0xEE;
         reg_A &= reg_X;
         LD_IM(AND);
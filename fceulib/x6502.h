@@ -24,10 +24,13 @@
 #include "tracing.h"
 #include "fceu.h"
 #include "fc.h"
+#include "perf-counters.h"
 
 // XXX
 #include "base/logging.h"
 
+struct AOTGame;
+
 struct X6502 {
   // Initialize with fc pointer, since memory reads/writes
   // trigger callbacks.
@@ -43,6 +46,12 @@ struct X6502 {
   #endif
   // int64 entered_aot[0x10000] = {};
 
+  #if FCEU_PERF_COUNTERS
+  // Counters for the whole emulator live here, since the CPU is what
+  // everything else hangs off of. See perf-counters.h.
+  PerfCounters perf;
+  #endif
+
   /* Temporary cycle counter */
   int32 tcount;
 
@@ -91,28 +100,54 @@ struct X6502 {
 
   void (*MapIRQHook)(FC *, int) = nullptr;
 
+  // If non-null, Run uses this ahead-of-time compiled code instead of
+  // the interpreter, as long as the cartridge pages covering its code
+  // are still mapped as they were in aot_pages (set when enabling it;
+  // see Emulator::SetAOT). Otherwise, for example after bank switching
+  // in that range, Run falls back to the interpreter.
+  const AOTGame *aot = nullptr;
+  const uint8 *aot_pages[32] = {};
+  // Set by Cart when it remaps any of aot_pages. Compiled code checks
+  // this before every instruction (and the dispatcher before every
+  // entry), finishing the slice in the interpreter if it's set, since
+  // the code it would run came from the old bank. Cleared by Run when
+  // the original mapping is back.
+  bool aot_stale = false;
+
 private:
-  // normal memory read
+  bool AOTPagesMapped() const;
+
+  // normal memory read. Plain RAM and ROM pages are read directly;
+  // see FCEU::read_fast.
   inline uint8 RdMem(unsigned int A) {
+    const uint8 *page = fc->fceu->read_fast[A >> 8];
+    if (page != nullptr) return DB = page[A];
+    PERFCOUNT(perf.handler_reads[A >> 8]++);
     return DB = fc->fceu->ARead[A](fc, A);
   }
 
   // normal memory write
   inline void WrMem(unsigned int A, uint8 V) {
-    fc->fceu->BWrite[A](fc, A, V);
+    uint8 *page = fc->fceu->write_fast[A >> 8];
+    if (page != nullptr) {
+      page[A] = V;
+    } else {
+      PERFCOUNT(perf.handler_writes[A >> 8]++);
+      fc->fceu->BWrite[A](fc, A, V);
+    }
   }
 
+  // Zero page and stack. These are basically always RAM, but we
+  // still read through the page table in case a mapper hooks them.
   inline uint8 RdRAM(unsigned int A) {
-    // PERF: We should read directly from ram in this case (and
-    // see what other ones are possible); cheats at this level
-    // are not important. -tom7
-    //bbit edited: this was changed so cheat substitution would work
-    return (DB = fc->fceu->ARead[A](fc, A));
-    // return (DB=RAM[A]);
+    return RdMem(A);
   }
 
+  // Writes store directly, unless the page is being watched (see
+  // FCEU::ram_watch), in which case the handler logs them.
   inline void WrRAM(unsigned int A, uint8 V) {
-    fc->fceu->RAM[A] = V;
+    if (fc->fceu->ram_watched_pages & (1 << (A >> 8))) WrMem(A, V);
+    else fc->fceu->RAM[A] = V;
   }
 
   FC *fc = nullptr;
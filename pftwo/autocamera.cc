@@ -202,8 +202,11 @@ struct InputGenerator {
 AutoCamera::AutoCamera(const string &game,
 		       bool first_player) : first_player(first_player) {
   printf("Creating %d emulators for AutoCamera...\n", NUM_EMULATORS);
-  for (int i = 0; i < NUM_EMULATORS; i++) {
-    emus.push_back(Emulator::Create(game));
+  emus.push_back(Emulator::Create(game));
+  CHECK(emus[0] != nullptr) << game;
+  // The rest share the ROM with the first.
+  for (int i = 1; i < NUM_EMULATORS; i++) {
+    emus.push_back(emus[0]->Clone());
   }
 }
 
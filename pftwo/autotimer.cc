@@ -76,27 +76,46 @@ vector<AutoTimer::TimerLoc> AutoTimer::FindTimers(const vector<uint8> &save) {
 
   // Start back at the beginning.
   emu->LoadUncompressed(save);
-  vector<uint8> mem_prev = emu->GetMemory();
+  // Rather than copying and comparing all of RAM after each frame,
+  // have the emulator log the changes. There's at most one change per
+  // location per frame, so a capacity of 2048 never loses any.
+  // Watching is not free (writes to a watched page don't take the
+  // emulator's fast path), so only watch locations that could still
+  // be timers; this narrows as they are disqualified.
+  auto WatchCandidates = [emu, &candidates]() {
+    vector<uint16> addrs;
+    for (int i = 0; i < 2048; i++) {
+      auto it = candidates.find(i);
+      if (it == candidates.end() || !it->second.disqualified)
+	addrs.push_back(i);
+    }
+    emu->WatchRAM(addrs, 2048);
+  };
+  WatchCandidates();
+  vector<RAMWatch::Change> changes;
   for (int f = 0; f < EXPERIMENT_FRAMES; f++) {
     // The "safest" thing is often just to stay still, so that's what
     // we do. TODO: It would also be pretty reasonable to compare what
     // happens in the training movie if we have one.
     emu->Step16(0);
-    vector<uint8> mem_now = emu->GetMemory();
+    changes.clear();
+    (void)emu->TakeRAMChanges(&changes);
 
-    for (int i = 0; i < 2048; i++) {
-      if (mem_now[i] != mem_prev[i]) {
+    for (const RAMWatch::Change &change : changes) {
+      const int i = change.addr;
+      const uint8 prev = change.old_value, now = change.new_value;
+      if (now != prev) {
 	TimerInfo *info = &candidates[i];
 	if (info->disqualified) continue;
 
 	if (VERBOSE)
 	  printf("%04x @%d %02x -> %02x",
-		 i, f, mem_prev[i], mem_now[i]);
+		 i, f, prev, now);
 	
 	bool incrementing = false;
-	if (Decremented(1, mem_prev[i], mem_now[i])) {
+	if (Decremented(1, prev, now)) {
 	  incrementing = false;
-	} else if (Decremented(1, mem_now[i], mem_prev[i])) {
+	} else if (Decremented(1, now, prev)) {
 	  incrementing = true;
 	} else {
 	  info->disqualified = true;
@@ -160,8 +179,17 @@ vector<AutoTimer::TimerLoc> AutoTimer::FindTimers(const vector<uint8> &save) {
 	}
       }
     }
-    mem_prev = std::move(mem_now);
+
+    // Stop watching anything that was just disqualified.
+    for (const RAMWatch::Change &change : changes) {
+      auto it = candidates.find(change.addr);
+      if (it != candidates.end() && it->second.disqualified) {
+	WatchCandidates();
+	break;
+      }
+    }
   }
+  emu->UnwatchRAM();
 
   // Now that we've reached the end of the experiment, disqualify or
   // downweight anything that hasn't decremented but should have!
@@ -43,7 +43,7 @@ static string Rtos(double d) {
 }
 
 void TreeDumping::DumpTree(TreeSearch *search) {
-  MutexLock ml(&search->tree_m);
+  TreeSearch::TreeWriteLock ml(search->tree_m);
   Printf("Dumping tree.");
   Util::MakeDir("tree");
 
@@ -82,7 +82,8 @@ void TreeDumping::DumpTree(TreeSearch *search) {
     ret += StringPrintf(",s:%s", Rtos(score).c_str());
 
     if (node->chosen > 0) {
-      ret += StringPrintf(",e:%d,w:%d", node->chosen, node->was_loss);
+      ret += StringPrintf(",e:%d,w:%d",
+			  node->chosen.load(), node->was_loss.load());
     }
 
     if (node->chosen > cutoff) {
@@ -1,6 +1,7 @@
 
 #include "emulator-pool.h"
 
+#include <memory>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -20,10 +21,13 @@ EmulatorPool::EmulatorPool(const string &romfile, int initial_size) :
   }
 }
 
-Emulator *EmulatorPool::CreateNew() const {
-  Emulator *emu = Emulator::Create(romfile);
-  CHECK(emu != nullptr) << "EmulatorPool failed to create: " << romfile;
-  return emu;
+Emulator *EmulatorPool::CreateNew() {
+  if (prototype.get() == nullptr) {
+    prototype.reset(Emulator::Create(romfile));
+    CHECK(prototype.get() != nullptr)
+      << "EmulatorPool failed to create: " << romfile;
+  }
+  return prototype->Clone();
 }
 
 EmulatorPool::~EmulatorPool() {
@@ -2,6 +2,7 @@
 #ifndef __EMULATOR_POOL_H
 #define __EMULATOR_POOL_H
 
+#include <memory>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -38,8 +39,12 @@ struct EmulatorPool {
   
  private:
   const std::string romfile;
-  Emulator *CreateNew() const;
+  // Must hold sets_m, except in the constructor.
+  Emulator *CreateNew();
   std::mutex sets_m;
+  // Never handed out; new emulators are cloned from this one so that
+  // they share its ROM. Protected by sets_m.
+  std::unique_ptr<Emulator> prototype;
   std::unordered_set<Emulator *> claimed;
   std::vector<Emulator *> ready;
 };
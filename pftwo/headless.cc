@@ -62,12 +62,13 @@ struct ConsoleThread {
 	if (!Util::copy(filename, "latest.fm2")) {
 	  printf("Couldn't copy to latest.fm2?\n");
 	}
+	search->SaveCheckpoint();
 	last_wrote = elapsed;
       }
 
       int64 total_nes_frames = 0LL;
       {
-	MutexLock ml(&search->tree_m);
+	TreeSearch::TreeReadLock ml(search->tree_m);
 	vector<Worker *> workers = search->WorkersWithLock();
 	for (const Worker *w : workers) {
 	  total_nes_frames += w->nes_frames.load(std::memory_order_relaxed);
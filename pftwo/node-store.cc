@@ -0,0 +1,283 @@
+
+#include "node-store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __MINGW32__
+#include <windows.h>
+#undef ARRAYSIZE
+#endif
+
+#include "../cc-lib/base/logging.h"
+#include "../cc-lib/util.h"
+
+using namespace std;
+
+// The file starts with MAGIC. Each record is its handle as a
+// little-endian int64, then its length as a little-endian uint32,
+// followed by the bytes.
+
+#ifdef __MINGW32__
+# define fseek64 fseeko64
+# define ftell64 ftello64
+#else
+# define fseek64 fseeko
+# define ftell64 ftello
+#endif
+
+// Change this whenever the format changes.
+static constexpr char MAGIC[8] = {'p', 'f', 'n', 's', 't', 'o', 'r', '2'};
+static constexpr int64 HEADER_SIZE = sizeof (int64) + sizeof (uint32);
+
+// Replace dest with src in one step, if the platform allows it.
+static void ReplaceFile(const string &src, const string &dest) {
+  #ifdef __MINGW32__
+  // Windows rename fails if the destination exists.
+  CHECK(MoveFileEx(src.c_str(), dest.c_str(),
+		   MOVEFILE_REPLACE_EXISTING)) << src;
+  #else
+  CHECK(0 == rename(src.c_str(), dest.c_str())) << src;
+  #endif
+}
+
+NodeStore::NodeStore(const string &filename, bool truncate,
+		     int64 cache_bytes) :
+  filename(filename), max_cache_bytes(cache_bytes) {
+  if (!truncate) {
+    // Interrupted while replacing the file with a compacted one
+    // (MoveFileEx isn't guaranteed to be atomic), so the new one is
+    // still under the temporary name.
+    const string tmp = filename + ".tmp";
+    if (!Util::ExistsFile(filename) && Util::ExistsFile(tmp)) {
+      printf("Node store %s is missing, but %s exists.\n",
+	     filename.c_str(), tmp.c_str());
+      ReplaceFile(tmp, filename);
+    }
+    f = fopen(filename.c_str(), "r+b");
+  }
+  // Either truncating, or the file doesn't exist yet.
+  if (f == nullptr) f = fopen(filename.c_str(), "w+b");
+  CHECK(f != nullptr) << "Couldn't open node store " << filename;
+  CHECK(fseek64(f, 0, SEEK_END) == 0) << filename;
+  const int64 size = ftell64(f);
+  CHECK(size >= 0) << filename;
+
+  if (size == 0) {
+    CHECK(fwrite(MAGIC, 1, sizeof MAGIC, f) == sizeof MAGIC) << filename;
+    end = sizeof MAGIC;
+  } else {
+    char magic[sizeof MAGIC] = {};
+    CHECK(SeekWithLock(0) &&
+	  fread(magic, 1, sizeof MAGIC, f) == sizeof MAGIC &&
+	  0 == memcmp(magic, MAGIC, sizeof MAGIC))
+      << filename << " is not a node store, or is from a different "
+      "version.";
+
+    // Find the records. If the last one is incomplete (because we
+    // were interrupted while appending it), the next record
+    // overwrites it.
+    int64 pos = sizeof MAGIC;
+    while (pos + HEADER_SIZE <= size) {
+      int64 handle = 0;
+      uint32 len = 0;
+      CHECK(SeekWithLock(pos) &&
+	    fread(&handle, sizeof handle, 1, f) == 1 &&
+	    fread(&len, sizeof len, 1, f) == 1) << filename;
+      if (pos + HEADER_SIZE + len > size) break;
+      offsets[handle] = pos;
+      next_handle = std::max(next_handle, handle + 1);
+      pos += HEADER_SIZE + len;
+    }
+    end = pos;
+  }
+  printf("Node store %s has %lld records (%lld bytes).\n",
+	 filename.c_str(), (int64)offsets.size(), end);
+}
+
+NodeStore::~NodeStore() {
+  if (compact != nullptr) fclose(compact);
+  fclose(f);
+}
+
+bool NodeStore::SeekWithLock(int64 pos) {
+  return fseek64(f, pos, SEEK_SET) == 0;
+}
+
+void NodeStore::CacheWithLock(int64 handle, const vector<uint8> &bytes) {
+  lru.emplace_front(handle, bytes);
+  cached[handle] = lru.begin();
+  cache_bytes += bytes.size();
+  // Always keep at least the one just added.
+  while (cache_bytes > max_cache_bytes && lru.size() > 1) {
+    cache_bytes -= lru.back().second.size();
+    cached.erase(lru.back().first);
+    lru.pop_back();
+  }
+}
+
+int64 NodeStore::Append(const vector<uint8> &bytes) {
+  MutexLock ml(&m);
+  const int64 handle = next_handle++;
+  CHECK(bytes.size() <= 0xFFFFFFFFULL) << bytes.size();
+  const uint32 len = bytes.size();
+  CHECK(SeekWithLock(end)) << filename;
+  CHECK(fwrite(&handle, sizeof handle, 1, f) == 1) << filename;
+  CHECK(fwrite(&len, sizeof len, 1, f) == 1) << filename;
+  CHECK(fwrite(bytes.data(), 1, len, f) == len) << filename;
+  offsets[handle] = end;
+  end += HEADER_SIZE + len;
+
+  // Recently created nodes are likely to be expanded soon.
+  CacheWithLock(handle, bytes);
+  return handle;
+}
+
+vector<uint8> NodeStore::Read(int64 handle) {
+  MutexLock ml(&m);
+  auto it = cached.find(handle);
+  if (it != cached.end()) {
+    // Move to front.
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+  }
+
+  auto oit = offsets.find(handle);
+  CHECK(oit != offsets.end()) << "No record " << handle << " in "
+			      << filename;
+  const int64 pos = oit->second;
+  int64 h = 0;
+  uint32 len = 0;
+  CHECK(SeekWithLock(pos)) << filename;
+  CHECK(fread(&h, sizeof h, 1, f) == 1 &&
+	fread(&len, sizeof len, 1, f) == 1) << handle << " " << filename;
+  CHECK(h == handle) << handle << " " << h << " " << filename;
+  CHECK(pos + HEADER_SIZE + len <= end) << handle << " " << filename;
+  vector<uint8> bytes(len);
+  CHECK(fread(bytes.data(), 1, len, f) == len) << handle << " " << filename;
+  CacheWithLock(handle, bytes);
+  return bytes;
+}
+
+bool NodeStore::Has(int64 handle) {
+  MutexLock ml(&m);
+  return offsets.find(handle) != offsets.end();
+}
+
+void NodeStore::Flush() {
+  MutexLock ml(&m);
+  CHECK(fflush(f) == 0) << filename;
+}
+
+int64 NodeStore::Size() {
+  MutexLock ml(&m);
+  return end;
+}
+
+void NodeStore::StartCompaction(const vector<int64> &live) {
+  MutexLock ml(&m);
+  CHECK(!compacting) << "Already compacting " << filename;
+  compacting = true;
+  // WriteCompaction reads these with its own FILE.
+  CHECK(fflush(f) == 0) << filename;
+  compact_todo.clear();
+  compact_todo.reserve(live.size());
+  for (const int64 handle : live) {
+    auto it = offsets.find(handle);
+    CHECK(it != offsets.end()) << "No record " << handle << " in "
+			       << filename;
+    compact_todo.emplace_back(it->second, handle);
+  }
+  compact_from = end;
+}
+
+int64 NodeStore::CopyRecord(FILE *src, int64 pos, int64 *size) {
+  int64 handle = 0;
+  uint32 len = 0;
+  CHECK(fseek64(src, pos, SEEK_SET) == 0 &&
+	fread(&handle, sizeof handle, 1, src) == 1 &&
+	fread(&len, sizeof len, 1, src) == 1) << pos << " " << filename;
+  vector<uint8> bytes(len);
+  CHECK(fread(bytes.data(), 1, len, src) == len) << pos << " " << filename;
+
+  CHECK(fwrite(&handle, sizeof handle, 1, compact) == 1 &&
+	fwrite(&len, sizeof len, 1, compact) == 1 &&
+	fwrite(bytes.data(), 1, len, compact) == len) << filename << ".tmp";
+  compact_offsets[handle] = compact_end;
+  *size = HEADER_SIZE + len;
+  compact_end += *size;
+  return handle;
+}
+
+void NodeStore::WriteCompaction() {
+  CHECK(compacting && compact == nullptr) << "StartCompaction first.";
+  // Read in file order, and the same state can be live more than
+  // once (e.g. copies in the explore queue).
+  std::sort(compact_todo.begin(), compact_todo.end());
+  compact_todo.erase(std::unique(compact_todo.begin(), compact_todo.end()),
+		     compact_todo.end());
+
+  // The records before compact_from don't change, so they can be
+  // read without the lock.
+  FILE *src = fopen(filename.c_str(), "rb");
+  CHECK(src != nullptr) << filename;
+  const string tmp = filename + ".tmp";
+  compact = fopen(tmp.c_str(), "w+b");
+  CHECK(compact != nullptr) << tmp;
+  CHECK(fwrite(MAGIC, 1, sizeof MAGIC, compact) == sizeof MAGIC) << tmp;
+  compact_end = sizeof MAGIC;
+  compact_offsets.clear();
+  for (const auto &p : compact_todo) {
+    int64 size = 0LL;
+    CHECK(CopyRecord(src, p.first, &size) == p.second) << p.first;
+  }
+  fclose(src);
+  compact_todo.clear();
+}
+
+void NodeStore::FinishCompaction() {
+  MutexLock ml(&m);
+  CHECK(compacting && compact != nullptr) << "WriteCompaction first.";
+  // Everything appended since StartCompaction is new, so keep it.
+  CHECK(fflush(f) == 0) << filename;
+  for (int64 pos = compact_from; pos < end;) {
+    int64 size = 0LL;
+    CopyRecord(f, pos, &size);
+    pos += size;
+  }
+  const string tmp = filename + ".tmp";
+  CHECK(fclose(compact) == 0) << tmp;
+  compact = nullptr;
+
+  // (Windows can't replace a file that's open.)
+  fclose(f);
+  ReplaceFile(tmp, filename);
+  f = fopen(filename.c_str(), "r+b");
+  CHECK(f != nullptr) << "Couldn't reopen node store " << filename;
+
+  const int64 old_size = end;
+  end = compact_end;
+  offsets = std::move(compact_offsets);
+  compact_offsets.clear();
+  // Dropped records can't be read any more, so don't cache them.
+  for (auto it = lru.begin(); it != lru.end(); ) {
+    if (offsets.find(it->first) == offsets.end()) {
+      cache_bytes -= it->second.size();
+      cached.erase(it->first);
+      it = lru.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  compacting = false;
+  printf("Compacted node store %s from %lld to %lld bytes "
+	 "(%lld records).\n", filename.c_str(), old_size, end,
+	 (int64)offsets.size());
+}
@@ -0,0 +1,112 @@
+// File of emulator savestates, so that the tree doesn't need to keep
+// every node's savestate (a few kilobytes each, even compressed) in
+// memory. Nodes only need their savestate when a worker restores
+// them, which is rare compared to scoring (see State::mem), and is
+// concentrated on the few nodes near the top of the heap; those are
+// kept in an LRU cache.
+//
+// Records are appended, and only removed by compaction, which
+// rewrites the file with just the records that are still needed.
+// A handle is a record number rather than a position in the file,
+// so it stays valid across compaction (if the record is kept) and
+// across runs. This is what lets a checkpoint refer to savestates by
+// handle: see TreeSearch::SaveCheckpoint.
+
+#ifndef __NODE_STORE_H
+#define __NODE_STORE_H
+
+#include <cstdio>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pftwo.h"
+
+struct NodeStore {
+  // If truncate is false, the existing records in the file are kept,
+  // e.g. to resume from a checkpoint that refers to them. Keeps up to
+  // about cache_bytes of records in memory.
+  NodeStore(const string &filename, bool truncate, int64 cache_bytes);
+  ~NodeStore();
+
+  // Write the bytes to the end of the file and return a handle to
+  // them. Handles are never reused. Thread-safe.
+  int64 Append(const vector<uint8> &bytes);
+
+  // Read the bytes that were appended with this handle. Thread-safe.
+  vector<uint8> Read(int64 handle);
+
+  // Whether there's a record for the handle. Thread-safe.
+  bool Has(int64 handle);
+
+  // Make sure everything appended so far is written to disk.
+  void Flush();
+
+  // Size of the file in bytes.
+  int64 Size();
+
+  // Compaction happens in three steps, so that the caller can write
+  // a checkpoint that refers to the compacted file in between, and
+  // so that only the first step needs to stop the world.
+  //
+  // StartCompaction takes the handles that are still needed. Any
+  // other record that exists at this point will be dropped, so the
+  // caller must make sure that nothing can be about to use one
+  // (TreeSearch calls it with tree_m held exclusively). Records
+  // appended after this are all kept.
+  void StartCompaction(const vector<int64> &live);
+  // Write the kept records to filename.tmp. This is the slow part,
+  // but Append and Read can proceed while it runs.
+  void WriteCompaction();
+  // Replace the file with the compacted one (including anything
+  // appended since StartCompaction). After this, the dropped handles
+  // are invalid.
+  void FinishCompaction();
+
+ private:
+  // Must hold m.
+  void CacheWithLock(int64 handle, const vector<uint8> &bytes);
+  bool SeekWithLock(int64 pos);
+  // Copy the record at pos in src (including its header) to the end
+  // of compact. Returns the record's handle and sets *size to the
+  // number of bytes copied.
+  int64 CopyRecord(FILE *src, int64 pos, int64 *size);
+
+  const string filename;
+  const int64 max_cache_bytes;
+
+  std::mutex m;
+  // Everything below is protected by m.
+  FILE *f = nullptr;
+  // Current end of the file, which is where the next record goes.
+  int64 end = 0LL;
+  // The next handle to give out.
+  int64 next_handle = 0LL;
+  // Position of each record in the file, by handle.
+  std::unordered_map<int64, int64> offsets;
+
+  // Most recently used at the front.
+  std::list<std::pair<int64, vector<uint8>>> lru;
+  std::unordered_map<int64,
+		     std::list<std::pair<int64, vector<uint8>>>::iterator>
+    cached;
+  int64 cache_bytes = 0LL;
+
+  // Compaction in progress (see StartCompaction). The kept records
+  // and where they are in the current file; everything from
+  // compact_from to end is also kept. compact and compact_offsets
+  // are only used by the compacting thread until FinishCompaction,
+  // which takes m.
+  bool compacting = false;
+  vector<std::pair<int64, int64>> compact_todo;
+  int64 compact_from = 0LL;
+  FILE *compact = nullptr;
+  int64 compact_end = 0LL;
+  std::unordered_map<int64, int64> compact_offsets;
+
+  NOT_COPYABLE(NodeStore);
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "node-store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../cc-lib/base/logging.h"
+#include "../cc-lib/util.h"
+
+using namespace std;
+
+static constexpr char FILENAME[] = "node-store_test.tmp";
+
+// A record of n bytes that's different for each seed.
+static vector<uint8> Record(int seed, int n) {
+  vector<uint8> v;
+  for (int i = 0; i < n; i++) v.push_back(seed * 31 + i * 7);
+  return v;
+}
+
+// Overwrite the start of these records' payloads in the file with
+// junk, behind the store's back, so that we can tell whether a read
+// came from the cache or the file.
+static void Clobber(const vector<vector<uint8>> &records) {
+  vector<uint8> bytes = Util::ReadFileBytes(FILENAME);
+  for (const vector<uint8> &rec : records) {
+    auto it = std::search(bytes.begin(), bytes.end(), rec.begin(), rec.end());
+    CHECK(it != bytes.end());
+    for (int i = 0; i < 4; i++) it[i] = 0xDE + i;
+  }
+  CHECK(Util::WriteFileBytes(FILENAME, bytes));
+}
+
+static void RoundTrip() {
+  NodeStore store(FILENAME, true, 1 << 20);
+  // Just the magic.
+  CHECK(store.Size() == 8);
+  vector<int64> handles;
+  for (int i = 0; i < 50; i++)
+    handles.push_back(store.Append(Record(i, i * 13)));
+  // Including the empty one.
+  for (int i = 0; i < 50; i++)
+    CHECK(store.Read(handles[i]) == Record(i, i * 13)) << i;
+}
+
+static void Eviction() {
+  // Room for two of these records, but not three.
+  NodeStore store(FILENAME, true, 250);
+  const int64 a = store.Append(Record(1, 100));
+  const int64 b = store.Append(Record(2, 100));
+  const int64 c = store.Append(Record(3, 100));
+  store.Flush();
+  Clobber({Record(1, 100), Record(2, 100), Record(3, 100)});
+
+  // a was evicted when c was appended.
+  CHECK(store.Read(b) == Record(2, 100));
+  CHECK(store.Read(a) != Record(1, 100));
+  // Reading a made it most recently used, so c (the least recent)
+  // was evicted, but b was not.
+  CHECK(store.Read(b) == Record(2, 100));
+  CHECK(store.Read(c) != Record(3, 100));
+}
+
+static void Reopen() {
+  vector<int64> handles;
+  int64 size = 0;
+  {
+    NodeStore store(FILENAME, true, 1 << 20);
+    for (int i = 0; i < 10; i++)
+      handles.push_back(store.Append(Record(i, 100 + i)));
+    size = store.Size();
+  }
+
+  {
+    // Existing records are kept, and new ones go after them.
+    NodeStore store(FILENAME, false, 1 << 20);
+    CHECK(store.Size() == size);
+    for (int i = 0; i < 10; i++)
+      CHECK(store.Read(handles[i]) == Record(i, 100 + i)) << i;
+    const int64 h = store.Append(Record(10, 5));
+    CHECK(store.Size() > size);
+    for (int i = 0; i < 10; i++) CHECK(h != handles[i]);
+    CHECK(store.Read(h) == Record(10, 5));
+  }
+
+  {
+    NodeStore store(FILENAME, true, 1 << 20);
+    CHECK(store.Size() == 8);
+  }
+}
+
+static void Compaction() {
+  vector<int64> handles;
+  int64 size = 0;
+  {
+    NodeStore store(FILENAME, true, 1 << 20);
+    for (int i = 0; i < 20; i++)
+      handles.push_back(store.Append(Record(i, 1000)));
+    size = store.Size();
+
+    // Keep the even ones.
+    vector<int64> live;
+    for (int i = 0; i < 20; i += 2) live.push_back(handles[i]);
+    store.StartCompaction(live);
+    // Appended during compaction, so kept.
+    const int64 late = store.Append(Record(100, 1000));
+    store.WriteCompaction();
+    // Still readable from the old file.
+    CHECK(store.Read(handles[1]) == Record(1, 1000));
+    store.FinishCompaction();
+
+    CHECK(store.Size() < size);
+    for (int i = 0; i < 20; i++)
+      CHECK(store.Has(handles[i]) == (i % 2 == 0)) << i;
+    CHECK(store.Read(late) == Record(100, 1000));
+    handles.push_back(late);
+  }
+
+  // Not from the cache.
+  NodeStore store(FILENAME, false, 1);
+  for (int i = 0; i < 20; i += 2)
+    CHECK(store.Read(handles[i]) == Record(i, 1000)) << i;
+  CHECK(!store.Has(handles[1]));
+  CHECK(store.Read(handles[20]) == Record(100, 1000));
+  // Handles aren't reused.
+  const int64 h = store.Append(Record(101, 10));
+  for (int64 old : handles) CHECK(h != old);
+}
+
+int main(int argc, char **argv) {
+  RoundTrip();
+  Eviction();
+  Reopen();
+  Compaction();
+  remove(FILENAME);
+  printf("OK\n");
+  return 0;
+}
@@ -138,7 +138,7 @@ struct UIThread {
     (void)frame;
 
     const int num_workers = [&]() {
-      MutexLock ml(&search->tree_m);
+      TreeSearch::TreeReadLock ml(search->tree_m);
       return search->WorkersWithLock().size();
     }();
     vector<vector<uint8>> screenshots;
@@ -190,6 +190,7 @@ struct UIThread {
 	if (!Util::copy(filename, "latest.fm2")) {
 	  printf("Couldn't copy to latest.fm2?\n");
 	}
+	search->SaveCheckpoint();
 	last_saved = now;
       }
 
@@ -199,8 +200,7 @@ struct UIThread {
       
       sdlutil::clearsurface(screen, 0x11111111);
 
-      const int64 tree_size =
-	ReadWithLock(&search->tree_m, &search->tree->num_nodes);
+      const int64 tree_size = search->tree->num_nodes.load();
 
       const double improvement_pct =
 	(search->stats.sequences_improved.Get() * 100.0) /
@@ -223,7 +223,7 @@ struct UIThread {
       int64 total_steps = 0LL;
       {
 	// XXX This needs to work better when there are like 60 threads
-	MutexLock ml(&search->tree_m);
+	TreeSearch::TreeReadLock ml(search->tree_m);
 	vector<Worker *> workers = search->WorkersWithLock();
 	for (int i = 0; i < workers.size() && i < 10; i++) {
 	  const Worker *w = workers[i];
@@ -243,7 +243,8 @@ struct UIThread {
       
       bool queue_mode = false;
       {
-	MutexLock ml(&search->tree_m);
+	TreeSearch::TreeReadLock ml(search->tree_m);
+	MutexLock mle(&search->tree->explore_m);
 	// Update all screenshots.
 	if (!search->tree->explore_queue.empty()) {
 	  queue_mode = true;
@@ -278,7 +279,11 @@ struct UIThread {
       }
 
       {
-	MutexLock ml(&search->tree_m);
+	// Just reading the heap and grid, so this doesn't need to stop
+	// the workers.
+	TreeSearch::TreeReadLock ml(search->tree_m);
+	MutexLock mlh(&search->tree->heap_m);
+	MutexLock mlg(&search->tree->grid_m);
 	static constexpr int GRIDX = 768;
 	static constexpr int GRIDY = 450;
 	static constexpr int CELLPX = 16;
@@ -335,7 +340,7 @@ struct UIThread {
 
       vector<vector<string>> texts;
       {
-	MutexLock ml(&search->tree_m);
+	TreeSearch::TreeReadLock ml(search->tree_m);
 	vector<Worker *> workers = search->WorkersWithLock();
 	texts.resize(workers.size());
 	for (int i = 0; i < workers.size() && max_screenshots; i++) {
@@ -422,7 +427,7 @@ struct UIThread {
 
       int max_nodes = 0, max_depth = 0;
       {
-	MutexLock ml(&search->tree_m);
+	TreeSearch::TreeWriteLock ml(search->tree_m);
 	GetLevelStats(0, search->tree->root);
 
 	max_depth = search->tree->max_depth;
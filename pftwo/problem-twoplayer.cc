@@ -644,7 +644,8 @@ TPP::TwoPlayerProblem(const map<string, string> &config) {
     objectives->SaveToFile(cached_objectives);
   }
   CHECK(objectives.get());
-  observations.reset(Observations::MixedBaseObservations(*objectives));
+  InitRelevant();
+  observations.reset(Observations::MixedBaseObservations(*packed_objectives));
 
   emu->LoadUncompressed(save_after_warmup);
   printf("Fastforward to %d\n", fastforward);
@@ -653,14 +654,90 @@ TPP::TwoPlayerProblem(const map<string, string> &config) {
 	      original_inputs[i].second);
 
   start_state = 
-    {emu->SaveUncompressed(), emu->GetMemory(),
+    {emu->SaveUncompressed(),
      0,
      markov1->HistoryInDomain(),
      markov2->HistoryInDomain()};
+  start_state.mem = Pack(Emulator::SavedRAM(start_state.save));
 
   pool.Release(emu);
 }
 
+void TPP::InitRelevant() {
+  CHECK(objectives.get());
+  vector<bool> used(2048, false);
+  auto Use = [&used](int loc) {
+    if (loc >= 0) {
+      CHECK(loc < 2048) << loc;
+      used[loc] = true;
+    }
+  };
+  for (const auto &obj : objectives->GetAll())
+    for (int loc : obj.first) Use(loc);
+  for (int loc : protect_loc) Use(loc);
+  Use(x1_loc);
+  Use(y1_loc);
+  Use(x2_loc);
+  Use(y2_loc);
+
+  relevant.clear();
+  for (int loc = 0; loc < 2048; loc++) {
+    if (used[loc]) {
+      dense[loc] = relevant.size();
+      relevant.push_back(loc);
+    } else {
+      dense[loc] = -1;
+    }
+  }
+
+  x1_idx = Dense(x1_loc);
+  y1_idx = Dense(y1_loc);
+  x2_idx = Dense(x2_loc);
+  y2_idx = Dense(y2_loc);
+  protect_idx.clear();
+  for (int loc : protect_loc) protect_idx.push_back(Dense(loc));
+
+  vector<pair<vector<int>, double>> packed;
+  packed.reserve(objectives->Size());
+  for (const auto &obj : objectives->GetAll()) {
+    vector<int> idx;
+    idx.reserve(obj.first.size());
+    for (int loc : obj.first) idx.push_back(Dense(loc));
+    packed.push_back({std::move(idx), obj.second});
+  }
+  packed_objectives.reset(new WeightedObjectives(std::move(packed)));
+
+  printf("States keep %d relevant bytes of RAM.\n", (int)relevant.size());
+}
+
+void TPP::WriteState(const State &state, ByteWriter *w) const {
+  w->Bytes(state.save);
+  w->I64(state.save_handle);
+  w->U32(state.depth);
+  w->U64(state.prev1);
+  w->U64(state.prev2);
+  w->Bytes(state.mem);
+}
+
+TPP::State TPP::ReadState(ByteReader *r) const {
+  State state;
+  state.save = r->Bytes();
+  state.save_handle = r->I64();
+  state.depth = r->U32();
+  state.prev1 = r->U64();
+  state.prev2 = r->U64();
+  state.mem = r->Bytes();
+  CHECK(state.mem.size() == relevant.size()) << "Checkpoint is from "
+    "a different set of objectives?";
+  if (state.save.empty()) {
+    CHECK(node_store != nullptr) << "Checkpoint has spilled states, "
+      "but there's no node store.";
+    CHECK(node_store->Has(state.save_handle)) << "Checkpoint is "
+      "from a different node store? " << state.save_handle;
+  }
+  return state;
+}
+
 Worker *TPP::CreateWorker() {
   Worker *w = new Worker(this);
   w->emu.reset(Emulator::Create(game));
@@ -673,7 +750,8 @@ Worker *TPP::CreateWorker() {
 void Worker::Visualize(const Goal *goal, vector<uint8> *argb) {
   MutexLock ml(&mutex);
   CHECK(argb->size() == 4 * 256 * 256);
-  emu->GetImageARGB(argb);
+  // Workers only Step, so the emulator's own video output is stale.
+  emu->GetApproximateImageARGB(argb);
   vector<uint8> mem = emu->GetMemory();
 
   if (goal != nullptr) {
@@ -727,7 +805,8 @@ void Worker::Visualize(const Goal *goal, vector<uint8> *argb) {
   DrawDeaths(50, 20, 0xFF, 127, 127, 0xFF);
   DrawDeaths(51, 150, 0, 0, 0xFF, 0xFF);
   
-  const double s = tpp->observations->GetWeightedValue(mem);
+  const double s =
+    tpp->observations->GetWeightedValue(tpp->Pack(mem.data()).data());
   // printf("%f\n", s);
   for (int y = 250; y < 256; y++) {
     int len = std::min(256, 5 + (int)(256 * s));
@@ -757,7 +836,7 @@ void Worker::VizText(const Goal *goal, vector<string> *text) {
   }
 
   text->push_back("--------");
-  tpp->observations->VizText(mem, text);
+  tpp->observations->VizText(tpp->Pack(mem.data()).data(), text);
   if (text->size() > 50) {
     text->resize(50);
     text->push_back(" (ahem!) ");
@@ -774,5 +853,5 @@ void Worker::Observe() {
     emu->GetMemory(&mem);
   }
   
-  tpp->observations->Accumulate(mem);
+  tpp->observations->Accumulate(tpp->Pack(mem.data()).data());
 }
@@ -16,6 +16,8 @@
 #include "weighted-objectives.h"
 #include "../cc-lib/randutil.h"
 #include "autotimer.h"
+#include "node-store.h"
+#include "serialize.h"
 
 struct EmulatorPool;
 
@@ -52,26 +54,23 @@ struct TwoPlayerProblem {
   // Save state for a worker; the worker can save and restore these
   // at will, and they are portable betwen workers.
   struct State {
-    // Emulator savestate.
+    // Emulator savestate (uncompressed). Empty if the state has been
+    // spilled to the node store (see Spill), in which case it's the
+    // record save_handle there, compressed.
     vector<uint8> save;
-    // PERF This is actually part of save. But we use it to
-    // compute objective functions without having to restore
-    // the save. If memory becomes a big problem, we could
-    // have Emulator return a more structured save which
-    // provided a pointer to the 2k memory. This would preclude
-    // cleverness like save state compression, though.
-    // PERF We could store a TwoPlayerProblem-level remapping of
-    // indices used in the objective functions to a dense sequence of
-    // integers, which would usually be much fewer than 2048, and only
-    // store the memory values keyed by those denser indices here.
-    // (i.e., only store the bytes actually used in the objective
-    // functions.)
-    // Note that we use the mem for other stuff, like player position
-    // and death heuristics.
-    vector<uint8> mem;
     // Number of NES frames 
     int depth;
     ControllerHistory prev1, prev2;
+
+    // Just the bytes of RAM that the problem ever looks at (the
+    // objectives, player positions, protected locations), in the
+    // order of TwoPlayerProblem::relevant. These are also in the
+    // save state, but scattered over a couple of kilobytes; packed
+    // here, scoring a node only touches a cache line or two. Use
+    // TwoPlayerProblem::Dense to get the index of a RAM location.
+    vector<uint8> mem;
+
+    int64 save_handle = -1LL;
   };
 
   static int64 StateBytes(const State &s) {
@@ -141,17 +140,22 @@ struct TwoPlayerProblem {
         
     State Save() {
       MutexLock ml(&mutex);
-      return State{ emu->SaveUncompressed(), emu->GetMemory(), depth,
-	            previous1, previous2 };
+      State state{ emu->SaveUncompressed(), depth,
+	           previous1, previous2 };
+      state.mem = tpp->Pack(Emulator::SavedRAM(state.save));
+      return state;
     }
 
     void Restore(const State &state) {
       MutexLock ml(&mutex);
-      emu->LoadUncompressed(state.save);
+      if (state.save.empty()) {
+	CHECK(tpp->node_store != nullptr && state.save_handle >= 0);
+	emu->LoadEx(nullptr, tpp->node_store->Read(state.save_handle));
+      } else {
+	emu->LoadUncompressed(state.save);
+      }
 
       depth = state.depth;
-      // (Doesn't actually need the memory to restore; it's part of
-      // the emulator save state.)
       previous1 = state.prev1;
       previous2 = state.prev2;
     }
@@ -238,8 +242,8 @@ struct TwoPlayerProblem {
   // XXX: Need to determine protect_loc automatically, like during training.
   double EdgePenalty(const State &old_state, const State &new_state) const {
     double res = 1.0;
-    for (int loc : protect_loc)
-      if (new_state.mem[loc] < old_state.mem[loc])
+    for (int idx : protect_idx)
+      if (new_state.mem[idx] < old_state.mem[idx])
 	res *= 0.5;
     return res;
   }
@@ -257,10 +261,10 @@ struct TwoPlayerProblem {
     const int gx = goal.goalx;
     const int gy = goal.goaly;
 
-    const int p1x = state.mem[x1_loc];
-    const int p1y = state.mem[y1_loc];
-    const int p2x = state.mem[x2_loc];
-    const int p2y = state.mem[y2_loc];
+    const int p1x = state.mem[x1_idx];
+    const int p1y = state.mem[y1_idx];
+    const int p2x = state.mem[x2_idx];
+    const int p2y = state.mem[y2_idx];
 
     const int dx1 = p1x - gx;
     const int dy1 = p1y - gy;
@@ -282,7 +286,8 @@ struct TwoPlayerProblem {
   // are near 1" to indicate stuckness.)
   double Score(const State &state) const {
     // "Real" score, from objective functions (compared to global best).
-    const double objective_score = observations->GetWeightedValue(state.mem);
+    const double objective_score = observations->GetWeightedValue(
+	state.mem.data());
 
     // XXX - Useful to include protect_loc here, but measured against the
     // start state? Maybe only the caller should be doing this when expanding
@@ -292,6 +297,16 @@ struct TwoPlayerProblem {
     return penalty * objective_score;
   }
 
+  // Same as Score for each of the n states, into out[0..n-1], but
+  // faster.
+  void Scores(const State *const *states, int n, double *out) const {
+    vector<const uint8 *> mems(n);
+    for (int i = 0; i < n; i++) mems[i] = states[i]->mem.data();
+    observations->GetWeightedValues(mems.data(), n, out);
+    for (int i = 0; i < n; i++)
+      out[i] *= EdgePenalty(start_state, *states[i]);
+  }
+
   // Number of times to subdivide the screen in both x and y
   // coordinates. 1 would yield four quadrants. Exponential!
   static constexpr int GRID_DIVISIONS = 3;
@@ -310,10 +325,10 @@ struct TwoPlayerProblem {
     if (x1_loc == -1 || y1_loc == -1 ||
 	x2_loc == -1 || y2_loc == -1) return false;
 
-    const int p1x = state.mem[x1_loc];
-    const int p1y = state.mem[y1_loc];
-    const int p2x = state.mem[x2_loc];
-    const int p2y = state.mem[y2_loc];
+    const int p1x = state.mem[x1_idx];
+    const int p1y = state.mem[y1_idx];
+    const int p2x = state.mem[x2_idx];
+    const int p2y = state.mem[y2_idx];
 
     const int c1x = p1x / DIVI_X;
     const int c1y = p1y / DIVI_Y;
@@ -338,7 +353,55 @@ struct TwoPlayerProblem {
 
   explicit TwoPlayerProblem(const map<string, string> &config);
 
+  // Index of the RAM location in State::mem, or -1 if it isn't one
+  // of the relevant bytes.
+  int Dense(int loc) const {
+    return (loc >= 0 && loc < 2048) ? dense[loc] : -1;
+  }
+
+  // Copy the relevant bytes out of 2048 bytes of RAM, in the
+  // State::mem representation.
+  vector<uint8> Pack(const uint8 *ram) const {
+    vector<uint8> out;
+    out.reserve(relevant.size());
+    for (int loc : relevant) out.push_back(ram[loc]);
+    return out;
+  }
+
+  // If set, states passed to Spill keep their savestates here
+  // instead of in memory. Not owned. Set before any states are
+  // spilled or restored from a checkpoint.
+  void SetNodeStore(NodeStore *store) { node_store = store; }
+
+  // If there's a node store, move the state's savestate into it.
+  // Everything needed for scoring stays in memory, and Worker::Restore
+  // still works on the state (and copies of it). The stored copy is
+  // compressed, since most nodes are never restored.
+  void Spill(State *state) const {
+    if (node_store == nullptr || state->save.empty()) return;
+    vector<uint8> compressed;
+    Emulator::CompressState(state->save, nullptr, &compressed);
+    state->save_handle = node_store->Append(compressed);
+    state->save.clear();
+    state->save.shrink_to_fit();
+  }
+
+  // For checkpoints. Spilled states are written as their handle, so
+  // the checkpoint is only good with the same node store.
+  void WriteState(const State &state, ByteWriter *w) const;
+  State ReadState(ByteReader *r) const;
+  vector<uint8> SaveObservations() const {
+    return observations->SaveState();
+  }
+  void LoadObservations(const vector<uint8> &bytes) {
+    observations->LoadState(bytes);
+  }
+
  private:
+  // Compute relevant, dense, the *_idx fields, and packed_objectives
+  // once all the locations are known.
+  void InitRelevant();
+
   void InitTimers(const map<string, string> &config,
 		  EmulatorPool *pool,
 		  const vector<uint8> &start);
@@ -367,6 +430,15 @@ struct TwoPlayerProblem {
   // Locations where we want to protect the value from going
   // down. XXX determine these automatically too.
   vector<int> protect_loc;
+
+  // Sorted, distinct RAM locations that are used by any of the above
+  // or the objectives; these are the bytes stored in State::mem.
+  vector<int> relevant;
+  // Inverse of relevant; -1 for locations not in it.
+  int dense[2048];
+  // The locations above, as indices into State::mem.
+  int x1_idx = -1, y1_idx = -1, x2_idx = -1, y2_idx = -1;
+  vector<int> protect_idx;
   
   vector<pair<uint8, uint8>> original_inputs;
   unique_ptr<NMarkovController> markov1, markov2;
@@ -374,7 +446,12 @@ struct TwoPlayerProblem {
   State start_state;
   // For play after warmup.
   unique_ptr<WeightedObjectives> objectives;
+  // The same objectives, but indexing State::mem rather than RAM.
+  // Observations are made with these, so they take packed memories
+  // (see Pack).
+  unique_ptr<WeightedObjectives> packed_objectives;
   unique_ptr<Observations> observations;
+  NodeStore *node_store = nullptr;
 };
 
 // Input needs a < operator so that pftwo can use vectors of inputs
@@ -0,0 +1,79 @@
+// Simple binary serialization for pftwo checkpoints. Values are
+// written little-endian (we only run on x86, so this is just a
+// memcpy) with no padding. There's no versioning here; the
+// checkpoint starts with a magic string that should be changed
+// whenever the format is.
+
+#ifndef __SERIALIZE_H
+#define __SERIALIZE_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pftwo.h"
+
+struct ByteWriter {
+  explicit ByteWriter(vector<uint8> *out) : out(out) {}
+
+  void U8(uint8 v) { out->push_back(v); }
+  void U32(uint32 v) { Raw(&v, sizeof v); }
+  void U64(uint64 v) { Raw(&v, sizeof v); }
+  void I64(int64 v) { Raw(&v, sizeof v); }
+  void Double(double v) { Raw(&v, sizeof v); }
+  // Length-prefixed.
+  void Bytes(const vector<uint8> &v) {
+    U64(v.size());
+    out->insert(out->end(), v.begin(), v.end());
+  }
+  void String(const string &s) {
+    U64(s.size());
+    out->insert(out->end(), s.begin(), s.end());
+  }
+
+ private:
+  void Raw(const void *v, size_t n) {
+    const uint8 *b = (const uint8 *)v;
+    out->insert(out->end(), b, b + n);
+  }
+  vector<uint8> *out;
+};
+
+// Reads what ByteWriter wrote. Reading past the end (i.e., a
+// truncated or corrupt file) is a fatal error.
+struct ByteReader {
+  explicit ByteReader(const vector<uint8> &in) : in(in) {}
+
+  uint8 U8() { uint8 v; Raw(&v, sizeof v); return v; }
+  uint32 U32() { uint32 v; Raw(&v, sizeof v); return v; }
+  uint64 U64() { uint64 v; Raw(&v, sizeof v); return v; }
+  int64 I64() { int64 v; Raw(&v, sizeof v); return v; }
+  double Double() { double v; Raw(&v, sizeof v); return v; }
+  vector<uint8> Bytes() {
+    const uint64 n = U64();
+    CHECK(n <= in.size() - pos) << "Truncated: " << n << " at " << pos;
+    vector<uint8> v(in.begin() + pos, in.begin() + pos + n);
+    pos += n;
+    return v;
+  }
+  string String() {
+    const uint64 n = U64();
+    CHECK(n <= in.size() - pos) << "Truncated: " << n << " at " << pos;
+    string s(in.begin() + pos, in.begin() + pos + n);
+    pos += n;
+    return s;
+  }
+
+  bool Done() const { return pos == in.size(); }
+
+ private:
+  void Raw(void *v, size_t n) {
+    CHECK(n <= in.size() - pos) << "Truncated at " << pos;
+    memcpy(v, in.data() + pos, n);
+    pos += n;
+  }
+  const vector<uint8> &in;
+  size_t pos = 0;
+};
+
+#endif
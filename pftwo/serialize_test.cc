@@ -0,0 +1,107 @@
+#include "serialize.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef __MINGW32__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "../cc-lib/base/logging.h"
+
+using namespace std;
+
+static vector<uint8> Sample() {
+  vector<uint8> bytes;
+  ByteWriter w(&bytes);
+  w.U8(0xAB);
+  w.U32(0xDEADBEEF);
+  w.U64(0x0123456789ABCDEFULL);
+  w.I64(-12345678901LL);
+  w.Double(-0.125);
+  w.Bytes({});
+  w.Bytes({1, 2, 3});
+  w.String("pftwo");
+  return bytes;
+}
+
+static void RoundTrip() {
+  const vector<uint8> bytes = Sample();
+  ByteReader r(bytes);
+  CHECK(r.U8() == 0xAB);
+  CHECK(r.U32() == 0xDEADBEEF);
+  CHECK(r.U64() == 0x0123456789ABCDEFULL);
+  CHECK(r.I64() == -12345678901LL);
+  CHECK(r.Double() == -0.125);
+  CHECK(r.Bytes().empty());
+  CHECK(r.Bytes() == vector<uint8>({1, 2, 3}));
+  CHECK(!r.Done());
+  CHECK(r.String() == "pftwo");
+  CHECK(r.Done());
+}
+
+// Reading a truncated file must fail (with CHECK) rather than
+// returning garbage. Since that aborts, run it in a child process.
+static void ExpectDeath(const char *what, std::function<void()> f) {
+#ifdef __MINGW32__
+  // No fork.
+  (void)what;
+  (void)f;
+#else
+  fflush(stdout);
+  fflush(stderr);
+  const pid_t pid = fork();
+  CHECK(pid >= 0);
+  if (pid == 0) {
+    // Quiet, since the failure is expected.
+    CHECK(freopen("/dev/null", "w", stderr) != nullptr);
+    f();
+    _exit(0);
+  }
+  int status = 0;
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(!(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+    << what << " should have failed.";
+#endif
+}
+
+static void Truncated() {
+  const vector<uint8> bytes = Sample();
+  // Every proper prefix is missing something, whether in the middle
+  // of a fixed-size value or a length-prefixed one.
+  for (int len = 0; len < bytes.size(); len++) {
+    const vector<uint8> prefix(bytes.begin(), bytes.begin() + len);
+    ExpectDeath("Truncated read", [&prefix]() {
+	ByteReader r(prefix);
+	r.U8();
+	r.U32();
+	r.U64();
+	r.I64();
+	r.Double();
+	r.Bytes();
+	r.Bytes();
+	r.String();
+      });
+  }
+
+  // A length that's larger than what's left.
+  vector<uint8> bad;
+  ByteWriter w(&bad);
+  w.U64(1000);
+  w.U8(7);
+  ExpectDeath("Bad length", [&bad]() {
+      ByteReader r(bad);
+      r.Bytes();
+    });
+}
+
+int main(int argc, char **argv) {
+  RoundTrip();
+  Truncated();
+  printf("OK\n");
+  return 0;
+}
@@ -29,6 +29,8 @@
 #include "weighted-objectives.h"
 #include "treesearch.h"
 #include "problem-twoplayer.h"
+#include "node-store.h"
+#include "serialize.h"
 
 // Base "max" nodes in heap. We start cleaning the heap when there are
 // more than this number of nodes, although we often have to keep more
@@ -61,15 +63,23 @@ enum PerfEvent {
   PE_L_UPDATE_TREE_A,
   PE_L_UPDATE_TREE_B,
   PE_L_UPDATE_TREE_C,
-  PE_L_UPDATE_TREE_D,
   PE_L_PROCESS_EXPLORE_QUEUE_A,
   PE_L_PROCESS_EXPLORE_QUEUE_B,
   PE_L_PROCESS_EXPLORE_QUEUE_C,
   PE_L_PROCESS_EXPLORE_QUEUE_D,
   PE_L_SHOULD_DIE_EQ,
   PE_L_SHOULD_DIE_N,
+  // Finer-grained locks within the tree, taken while holding
+  // tree_m shared.
+  PE_L_HEAP,
+  PE_L_GRID,
+  PE_L_CHILDREN,
+  PE_L_EXPLORE,
   // Work
   PE_EXEC,
+  // Writing new nodes' savestates to the node store, including
+  // waiting for its lock.
+  PE_SPILL,
   // Meta
   NUM_PERFEVENTS,
 };
@@ -82,14 +92,18 @@ static const char *PerfEventString(PerfEvent pe) {
     CASE(L_UPDATE_TREE_A);
     CASE(L_UPDATE_TREE_B);
     CASE(L_UPDATE_TREE_C);
-    CASE(L_UPDATE_TREE_D);
     CASE(L_PROCESS_EXPLORE_QUEUE_A);
     CASE(L_PROCESS_EXPLORE_QUEUE_B);
     CASE(L_PROCESS_EXPLORE_QUEUE_C);
     CASE(L_PROCESS_EXPLORE_QUEUE_D);
     CASE(L_SHOULD_DIE_EQ);
     CASE(L_SHOULD_DIE_N);
+    CASE(L_HEAP);
+    CASE(L_GRID);
+    CASE(L_CHILDREN);
+    CASE(L_EXPLORE);
     CASE(EXEC);
+    CASE(SPILL);
   default: return "?";
   }
 #undef CASE
@@ -116,11 +130,21 @@ struct InternalPerfCounterScoped {
 }
 
 static_assert(sizeof (uint64) == sizeof (LARGE_INTEGER), "win64");
-#define PERF_MUTEX_LOCK(pe, mut)				\
-  const uint64 perf_ml_start = PerfCounterNow();		\
-  MutexLock perf_ml(mut);					\
-  const uint64 perf_ml_end = PerfCounterNow();			\
-  perf_counters[pe] += (perf_ml_end - perf_ml_start)
+// Acquires a lock of the given type on mut for the rest of the
+// scope, counting the time spent waiting for it. The names are
+// derived from the event, so a scope can hold locks for different
+// events.
+#define PERF_LOCK(pe, lock_type, mut)				\
+  const uint64 perf_ml_start_ ## pe = PerfCounterNow();		\
+  lock_type perf_ml_ ## pe(*(mut));				\
+  perf_counters[pe] += (PerfCounterNow() - perf_ml_start_ ## pe)
+
+#define PERF_MUTEX_LOCK(pe, mut) \
+  PERF_LOCK(pe, std::unique_lock<std::mutex>, mut)
+#define PERF_READ_LOCK(pe, mut) \
+  PERF_LOCK(pe, TreeSearch::TreeReadLock, mut)
+#define PERF_WRITE_LOCK(pe, mut) \
+  PERF_LOCK(pe, TreeSearch::TreeWriteLock, mut)
 
 // This deliberately does not generate a distinct name to prevent
 // unintentially instantiating it multiple times in the same scope.
@@ -150,16 +174,22 @@ struct WorkThread {
   // Get the root node of the tree and associated state (which must be
   // present). Used during initialization.
   Node *GetRoot() {
-    MutexLock ml(&search->tree_m);
+    TreeSearch::TreeReadLock ml(search->tree_m);
     Node *n = search->tree->root;
     n->num_workers_using++;
     return n;
   }
 
-  // Populates the vector with eligible grid indices.
-  void EligibleGridNodesWithMutex(vector<int> *eligible) {
+  // Score of the best node in the heap. Must hold tree_m.
+  double BestScore() {
+    PERF_MUTEX_LOCK(PE_L_HEAP, &search->tree->heap_m);
+    return -search->tree->heap.GetMinimum().priority;
+  }
+
+  // Populates the vector with eligible grid indices. Must hold
+  // tree_m shared and grid_m, or tree_m exclusively.
+  void EligibleGridNodesWithMutex(double bestscore, vector<int> *eligible) {
     // XXX This stuff is a hack. Improve it!
-    const double bestscore = -search->tree->heap.GetMinimum().priority;
     const double gminscore = GRID_BESTSCORE_FRAC * bestscore;
     // The interval from gminscore to bestscore is size (1.0 -
     // grid_bestscore_frac). When the cell's score falls in this
@@ -180,30 +210,33 @@ struct WorkThread {
     }
   }
   
-  // Must hold tree mutex!
-  // Doesn't update any reference counts.
-  Node *FindGoodNodeWithMutex() {
-    const int size = search->tree->heap.Size();
-    CHECK(size > 0) << "Heap should always have root, at least.";
-    
-    vector<int> eligible_grid;
-    EligibleGridNodesWithMutex(&eligible_grid);
+  // Must hold tree_m (shared is enough); takes the heap and grid
+  // locks as needed. Doesn't update any reference counts.
+  Node *FindGoodNode() {
+    Tree *tree = search->tree;
+    const double bestscore = BestScore();
 
     Node *ret = nullptr;
-    // The more nodes that are eligible, the more likely we are
-    // to be stuck. Take a grid node proportional to the number
-    // of grid nodes.
-    if (!eligible_grid.empty() &&
-	RandDouble(&rc) <
-	// Always a reasonable chance of picking from the grid
-	// (if any is eligible).
-	0.25 +
-	// When the grid is full, an additional 25% chance.
-	0.25 * 
-	// Fraction of the grid that was eligible
-	(eligible_grid.size() / (double)Problem::num_grid_cells)) {
-      const int idx = eligible_grid[RandTo(&rc, eligible_grid.size())];
-      ret = search->tree->grid[idx].node;
+    {
+      PERF_MUTEX_LOCK(PE_L_GRID, &tree->grid_m);
+      vector<int> eligible_grid;
+      EligibleGridNodesWithMutex(bestscore, &eligible_grid);
+
+      // The more nodes that are eligible, the more likely we are
+      // to be stuck. Take a grid node proportional to the number
+      // of grid nodes.
+      if (!eligible_grid.empty() &&
+	  RandDouble(&rc) <
+	  // Always a reasonable chance of picking from the grid
+	  // (if any is eligible).
+	  0.25 +
+	  // When the grid is full, an additional 25% chance.
+	  0.25 * 
+	  // Fraction of the grid that was eligible
+	  (eligible_grid.size() / (double)Problem::num_grid_cells)) {
+	const int idx = eligible_grid[RandTo(&rc, eligible_grid.size())];
+	ret = tree->grid[idx].node;
+      }
     }
     
     if (ret == nullptr) {
@@ -211,16 +244,21 @@ struct WorkThread {
       // good nodes are towards the beginning of the array.
       // Gaussian centered on 0; use 0 for anything out of bounds.
       // (n.b. this doesn't seem to help get unstuck -- evaluate it)
-      const int g = (int)(gauss.Next() * (size * 0.05));
-      const int idx = (g <= 0 || g >= size) ? 0 : g;
-
-      Heap<double, Node>::Cell cell = search->tree->heap.GetByIndex(idx);
+      const double g = gauss.Next();
+      PERF_MUTEX_LOCK(PE_L_HEAP, &tree->heap_m);
+      const int size = tree->heap.Size();
+      CHECK(size > 0) << "Heap should always have root, at least.";
+      const int gi = (int)(g * (size * 0.05));
+      const int idx = (gi <= 0 || gi >= size) ? 0 : gi;
+
+      Heap<double, Node>::Cell cell = tree->heap.GetByIndex(idx);
       ret = cell.value;
     }
     
     // Now ascend up the tree to avoid picking nodes that have high
     // scores but have been explored at lot (this means it's likely
-    // that they're dead ends).
+    // that they're dead ends). Parents don't change, so this needs
+    // no further locking.
     for (;;) {
       if (ret->parent == nullptr)
 	break;
@@ -243,15 +281,14 @@ struct WorkThread {
   // n is the current node, which may be discarded; this function
   // also maintains correct reference counts.
   Node *FindNodeToExtend(Node *n) {
-    PERF_MUTEX_LOCK(PE_L_FIND_NODE_TO_EXTEND, &search->tree_m);
-    // MutexLock ml(&search->tree_m);
+    PERF_READ_LOCK(PE_L_FIND_NODE_TO_EXTEND, &search->tree_m);
 
     CHECK(n->num_workers_using > 0);
 
     // Simple policy: 50% chance of switching to some good node using
     // the heap/grid; 50% chance of staying with the current node.
     if (rc.Byte() < 128) {
-      Node *ret = FindGoodNodeWithMutex();
+      Node *ret = FindGoodNode();
       
       // Giving up on n.
       n->num_workers_using--;
@@ -266,8 +303,17 @@ struct WorkThread {
     }
   }
 
+  // Since this writes the state to the node store (if any), check
+  // with FindChild first that it's not a duplicate. Must hold tree_m
+  // (shared is enough) until the node is inserted, so that the node
+  // store's compaction (see SaveCheckpoint) can't drop the record
+  // before the node is in the tree.
   Node *NewNode(Problem::State newstate, Node *parent) {
     CHECK(parent != nullptr);
+    {
+      PERF_SCOPED(PE_SPILL);
+      search->problem->Spill(&newstate);
+    }
     Node *child = new Node(std::move(newstate), parent);
     child->nes_frames = search->approx_nes_frames.load(
 	std::memory_order_relaxed);
@@ -276,37 +322,57 @@ struct WorkThread {
     return child;
   }
 
-  // Add a new child to the node (unless it's a duplicate).
-  // Returns the new node or existing child. Doesn't change
-  // reference counts. Must hold the tree lock.
-  Node *ExtendNodeWithLock(Node *n,
-			   const Tree::Seq &seq,
-			   Problem::State newstate,
-			   double newscore) {
+  // If the node already has a child with this exact sequence, return
+  // it; otherwise null. Must hold tree_m (shared is enough).
+  Node *FindChild(Node *n, const Tree::Seq &seq) {
+    PERF_MUTEX_LOCK(PE_L_CHILDREN, &n->children_m);
+    auto it = n->children.find(seq);
+    return it == n->children.end() ? nullptr : it->second;
+  }
+
+  // Add a new child (from NewNode) to the node and insert it in the
+  // heap and grid. If the node already has a child with this exact
+  // sequence (another thread may have added it since FindChild),
+  // returns that existing one instead, and the caller should delete
+  // the new child. Doesn't change reference counts. Must hold tree_m
+  // (shared is enough).
+  Node *InsertChild(Node *n,
+		    const Tree::Seq &seq,
+		    Node *child,
+		    double newscore) {
     CHECK(n != nullptr);
-    Node *child = NewNode(std::move(newstate), n);
-    auto res = n->children.insert({seq, child});
-    if (!res.second) {
-      // By dumb luck (this might not be that rare if the markov
-      // model is sparse), we already have a node with this
-      // exact path. We don't allow replacing it.
-      search->stats.same_expansion.Increment();
-
-      delete child;
-      return res.first->second;
-    } else {
-      search->tree->num_nodes++;
+    {
+      PERF_MUTEX_LOCK(PE_L_CHILDREN, &n->children_m);
+      auto res = n->children.insert({seq, child});
+      if (!res.second) {
+	// By dumb luck (this might not be that rare if the markov
+	// model is sparse), we already have a node with this
+	// exact path. We don't allow replacing it.
+	search->stats.same_expansion.Increment();
+	return res.first->second;
+      }
+    }
+
+    // The child can't be deleted while we hold tree_m, even though
+    // it's in the tree without a heap location for a moment.
+    search->tree->num_nodes++;
+    {
+      PERF_MUTEX_LOCK(PE_L_HEAP, &search->tree->heap_m);
       search->tree->heap.Insert(-newscore, child);
       CHECK(child->location != -1);
+      if (search->tree->record_new_nodes)
+	search->tree->new_nodes.push_back(child);
+    }
 
+    {
+      PERF_MUTEX_LOCK(PE_L_GRID, &search->tree->grid_m);
       AddToGridWithLock(child, newscore);
-      
-      return child;
     }
+    return child;
   }
 
-  // Add to the grid if it qualifies. Called from within
-  // ExtendNodeWithLock once we're sure the node is new.
+  // Add to the grid if it qualifies. Must hold grid_m, or tree_m
+  // exclusively.
   void AddToGridWithLock(Node *newnode, double newscore) {
     int cell = 0;
     if (search->problem->GetGridCell(newnode->state, &cell)) {
@@ -323,10 +389,6 @@ struct WorkThread {
     }
   }
   
-  // XXX a lot of this function duplicates the above (which is used
-  // directly during exploration). We should figure out how to merge
-  // them.
-  // 
   // Extend a node with some sequence that we already ran, and
   // that results in the newstate with newscore.
   //
@@ -337,90 +399,96 @@ struct WorkThread {
 		   const Tree::Seq &seq,
 		   Problem::State newstate,
 		   double newscore) {
-    Node *child = NewNode(std::move(newstate), n);
-
-    PERF_MUTEX_LOCK(PE_L_EXTEND_NODE, &search->tree_m);
-    // MutexLock ml(&search->tree_m);
-
     // XXX This should probably be done in the caller, because
     // if NUM_NEXTS isn't 1, we have more fine-grained evidence
     // that we could collect. (Right now it's like, "the probability
     // that randomly expanding the node NUM_NEXTS times and picking
     // the best one will actually make things worse") which is maybe
     // harder to think about, and certainly converges more slowly.
+    // We hold a reference to n, so this doesn't need the lock.
     const double oldscore = search->problem->Score(n->state);
     if (oldscore > newscore) {
       n->was_loss++;
     }
 
-    auto res = n->children.insert({seq, child});
-
-    CHECK(n->num_workers_using > 0);
-    n->num_workers_using--;
-
-    if (!res.second) {
-      // By dumb luck (this might not be that rare if the markov
-      // model is sparse), we already have a node with this
-      // exact path. We don't allow replacing it.
-      search->stats.same_expansion.Increment();
-
-      delete child;
-      // Maintain the invariant that the worker is at the
-      // state of the returned node.
-      Node *ch = res.first->second;
-
-      CHECK(ch != nullptr);
-      worker->Restore(ch->state);
+    // Holding tree_m, move our reference from n to ch, and make sure
+    // the worker is at its state.
+    auto MoveTo = [this, n](Node *ch, bool restore) {
+      CHECK(n->num_workers_using > 0);
+      n->num_workers_using--;
       ch->num_workers_using++;
+      if (restore) worker->Restore(ch->state);
       return ch;
+    };
 
-    } else {
-      search->tree->num_nodes++;
-      search->tree->heap.Insert(-newscore, child);
-      CHECK(child->location != -1);
-
-      child->num_workers_using++;
-      AddToGridWithLock(child, newscore);
-      return child;
+    // Only make the new node, which spills its state to the node
+    // store, if there's no such child yet.
+    {
+      PERF_READ_LOCK(PE_L_EXTEND_NODE, &search->tree_m);
+      if (Node *ch = FindChild(n, seq)) {
+	search->stats.same_expansion.Increment();
+	return MoveTo(ch, true);
+      }
     }
+    PERF_READ_LOCK(PE_L_EXTEND_NODE, &search->tree_m);
+
+    Node *child = NewNode(std::move(newstate), n);
+    Node *ch = InsertChild(n, seq, child, newscore);
+    if (ch != child) delete child;
+    return MoveTo(ch, ch != child);
   }
 
   // At startup, ensure that the tree contains at least a root node.
   // Only does it in one thread, but doesn't return until this is the
   // case.
   void InitializeTree() {
-    MutexLock ml(&search->tree_m);
+    TreeSearch::TreeWriteLock ml(search->tree_m);
     if (search->tree == nullptr) {
       // I won the race!
       printf("Initialize tree...\n");
       Problem::State s = worker->Save();
-      search->tree = new Tree(search->problem->Score(s), s);
+      const double score = search->problem->Score(s);
+      search->problem->Spill(&s);
+      search->tree = new Tree(score, s);
+      search->tree->node_budget = search->node_budget;
     }
   }
 
   void MaybeUpdateTree() {
     Tree *tree = search->tree;
     {
-      PERF_MUTEX_LOCK(PE_L_UPDATE_TREE_A, &search->tree_m);
-      // MutexLock ml(&search->tree_m);
       // No use in decrementing update counter -- when we
       // finish we reset it to the max value.
-      if (tree->update_in_progress)
+      if (tree->update_in_progress.load())
 	return;
 
       // Also, we're not allowed to make steps until
       // the explore queue is empty.
-      if (!tree->explore_queue.empty())
+      {
+	PERF_READ_LOCK(PE_L_UPDATE_TREE_A, &search->tree_m);
+	PERF_MUTEX_LOCK(PE_L_EXPLORE, &tree->explore_m);
+	if (!tree->explore_queue.empty())
+	  return;
+      }
+
+      // Once the counter goes negative, the thread that resets it
+      // from the value it saw is the one that updates; the others
+      // saw a stale value. (Resetting it separately, after claiming
+      // update_in_progress, would let a thread that decremented it
+      // in the meantime claim the flag again once the update is
+      // done, and run a second one right away.) The winner might
+      // still find another thread's update in progress, in which
+      // case it just gives up on this one.
+      int steps = tree->steps_until_update.fetch_sub(1) - 1;
+      if (steps >= 0)
 	return;
-      
-      if (tree->steps_until_update == 0) {
-	tree->steps_until_update = Tree::UPDATE_FREQUENCY;
-	tree->update_in_progress = true;
-	// Enter fixup below.
-      } else {
-	tree->steps_until_update--;
+      if (!tree->steps_until_update.compare_exchange_strong(
+	      steps, Tree::UPDATE_FREQUENCY))
 	return;
-      }
+      bool expected = false;
+      if (!tree->update_in_progress.compare_exchange_strong(expected, true))
+	return;
+      // Enter fixup below.
     }
 
     // This is run every UPDATE_FREQUENCY calls, in some
@@ -431,107 +499,173 @@ struct WorkThread {
 
     search->problem->Commit();
     
-    // Re-build heap. We do this by recalculating the score for
-    // each node in place; most of the time this won't change the
-    // shape of the heap much.
+    // Rescore every node, and rebuild the heap and grid (and trim the
+    // tree if it's too big) with the new scores. Workers keep
+    // running while we do most of this, since it's done on a
+    // snapshot of the nodes off to the side. Only the updating
+    // thread deletes nodes, so the snapshot's pointers stay valid
+    // without holding any lock.
+    //
+    // The snapshot is the heap, which by invariant contains all the
+    // nodes. Nodes inserted after this are recorded in new_nodes
+    // until we swap in the results.
+    vector<Node *> nodes;
     {
-      worker->SetStatus("Tree: Reheap");
-      {
-	// MutexLock ml(&search->tree_m);
-	PERF_MUTEX_LOCK(PE_L_UPDATE_TREE_B, &search->tree_m);
-
-	printf("Clear grid ...");
-	// First, just clear the grid since every node has a chance to
-	// become the best in a cell below, including the ones that are
-	// already there.
-	for (Tree::GridCell &gc : search->tree->grid) {
-	  if (gc.node != nullptr) {
-	    gc.node->used_in_grid--;
-	    gc.score = 0.0;
-	    gc.node = nullptr;
-	  }
-	}
-	
-	printf("Reheap ...\n");
-
-	// tree->heap.Clear();
-
-	std::function<void(Node *)> ReHeapRec =
-	  [this, tree, &ReHeapRec](Node *n) {
-	  // Act on the node if it's in the heap.
-	  if (n->location != -1) {
-	    const double new_score = search->problem->Score(n->state);
-	    // Note negation of score so that bigger real scores
-	    // are more minimum for the heap ordering.
-	    tree->heap.AdjustPriority(n, -new_score);
-	    CHECK(n->location != -1);
-	    AddToGridWithLock(n, new_score);
-	  }
-	  for (pair<const Tree::Seq, Node *> &child : n->children) {
-	    ReHeapRec(child.second);
-	  }
-	};
-	ReHeapRec(tree->root);
-      }
+      worker->SetStatus("Tree: Snapshot");
+      PERF_READ_LOCK(PE_L_UPDATE_TREE_B, &search->tree_m);
+      PERF_MUTEX_LOCK(PE_L_HEAP, &tree->heap_m);
+      const int size = tree->heap.Size();
+      nodes.reserve(size);
+      for (int i = 0; i < size; i++)
+	nodes.push_back(tree->heap.GetByIndex(i).value);
+      CHECK(tree->new_nodes.empty());
+      tree->record_new_nodes = true;
     }
-    
+
+    // Score the snapshot in parallel. Scoring is thread-safe (the
+    // workers call it all the time), but cheap, so it's done in
+    // batches.
+    worker->SetStatus("Tree: Rescore");
+    printf("Rescore %d nodes ...\n", (int)nodes.size());
+    vector<int> grid_cells(nodes.size(), -1);
     {
-      // MutexLock ml(&search->tree_m);
-      PERF_MUTEX_LOCK(PE_L_UPDATE_TREE_C, &search->tree_m);
-      const int64 MAX_NODES = search->tree->MaxNodes();
-      if (tree->num_nodes > MAX_NODES) {
-	printf("Trim tree (have %llu, max: %llu)...\n",
-	       tree->num_nodes, MAX_NODES);
-
-	// Here we want to delete the worst-scoring nodes in order
-	// to stay under our budget. We can't delete ancestors of
-	// nodes we keep, and we can't delete a node that a worker
-	// is currently using.
-	
-	// What we'll do is pop the best MAX_NODES nodes from the
-	// heap. This is better than the old way of sorting all the
-	// scores to get a cutoff score, because it's like
-	// MAX_NODES*lg(MAX_NODES) rather than num_nodes*lg(num_nodes)
-	// and it also allows us to arbitrarily break ties. (The tie
-	// situation can get very bad when we have a flat objective
-	// function and are stuck--there can be tens of millions of
-	// nodes with the same score).
-
-	// We also compute the 'area under the curve' (auc) for the
-	// nodes we're keeping. This is high when all the nodes have
-	// almost the maximum score, which suggests that we are
-	// 'stuck.'
-	//
-	// The objective-function-based score is normalized against
-	// the best value we've ever seen, so it's typical for the
-	// best score to be 1.0. But in some cases, we might Observe a
-	// good-looking state but not insert it into the tree. For
-	// example, we might beat a level but with one of the players
-	// dead. In this case, Score()s might be forever small. So
-	// here we normalize against the single best score when
-	// computing AUC.
-	const double best_score = -tree->heap.GetMinimum().priority;
-	// Predivided normalization factor, and negated because priorities
-	// are negative scores.
-	const double negative_one_over_best_score =
-	  best_score <= 0.0 ? 0.0 : (-1.0 / best_score);
-	double auc = 0.0;
-	double worst_kept_score = -1.0;
-	for (int i = 0; i < MAX_NODES && !tree->heap.Empty(); i++) {
-	  Heap<double, Node>::Cell best = tree->heap.PopMinimum();
-	  auc += best.priority * negative_one_over_best_score;
-	  best.value->keep = true;
-	  worst_kept_score = -best.priority;
-	}
+      static constexpr int CHUNK = 256;
+      const int num_nodes = nodes.size();
+      ParallelComp((num_nodes + CHUNK - 1) / CHUNK,
+		   [this, num_nodes, &nodes, &grid_cells](int chunk) {
+		     const int start = chunk * CHUNK;
+		     const int end = std::min(num_nodes, start + CHUNK);
+		     const Problem::State *states[CHUNK] = {};
+		     double scores[CHUNK] = {};
+		     for (int i = start; i < end; i++)
+		       states[i - start] = &nodes[i]->state;
+		     search->problem->Scores(states, end - start, scores);
+		     for (int i = start; i < end; i++) {
+		       Node *n = nodes[i];
+		       n->update_score = scores[i - start];
+		       int cell = 0;
+		       if (search->problem->GetGridCell(n->state, &cell))
+			 grid_cells[i] = cell;
+		     }
+		   },
+		   search->num_workers);
+    }
 
-	tree->stuckness = auc * (1.0 / MAX_NODES);
-	printf("\n ... auc %.2f; stuckness %.4f\n", auc, tree->stuckness);
-	printf("\n ... kept nodes range in score from %.4f to %.4f\n",
-	       worst_kept_score, best_score);
+    // The new grid, with the same rule as AddToGridWithLock. The
+    // used_in_grid counts are fixed up when it's swapped in.
+    vector<Tree::GridCell> grid(Problem::num_grid_cells,
+				Tree::GridCell(0.0, nullptr));
+    auto AddToNewGrid = [&grid](int cell, Node *n) {
+      CHECK(cell >= 0 && cell < grid.size()) << cell << " vs " << grid.size();
+      Tree::GridCell *gc = &grid[cell];
+      if (gc->node == nullptr || n->update_score > gc->score) {
+	gc->score = n->update_score;
+	gc->node = n;
+      }
+    };
+    for (int i = 0; i < nodes.size(); i++)
+      if (grid_cells[i] != -1)
+	AddToNewGrid(grid_cells[i], nodes[i]);
+
+    // Only the update changes max_depth.
+    const int64 MAX_NODES = tree->MaxNodes();
+    const bool trim = nodes.size() > MAX_NODES;
+    double stuckness = 0.0;
+    if (trim) {
+      worker->SetStatus("Tree: Choose nodes to keep");
+      printf("Trim tree (have %llu, max: %llu)...\n",
+	     (uint64)nodes.size(), MAX_NODES);
+
+      // Here we want to delete the worst-scoring nodes in order
+      // to stay under our budget. We can't delete ancestors of
+      // nodes we keep, and we can't delete a node that a worker
+      // is currently using.
+
+      // What we'll do is select the best MAX_NODES nodes from the
+      // snapshot. This is better than the old way of sorting all
+      // the scores to get a cutoff score, because it's linear time
+      // and it also allows us to arbitrarily break ties. (The tie
+      // situation can get very bad when we have a flat objective
+      // function and are stuck--there can be tens of millions of
+      // nodes with the same score).
+      vector<Node *> best = nodes;
+      std::nth_element(best.begin(), best.begin() + (MAX_NODES - 1),
+		       best.end(),
+		       [](const Node *a, const Node *b) {
+			 return a->update_score > b->update_score;
+		       });
+      best.resize(MAX_NODES);
+
+      // We also compute the 'area under the curve' (auc) for the
+      // nodes we're keeping. This is high when all the nodes have
+      // almost the maximum score, which suggests that we are
+      // 'stuck.'
+      //
+      // The objective-function-based score is normalized against
+      // the best value we've ever seen, so it's typical for the
+      // best score to be 1.0. But in some cases, we might Observe a
+      // good-looking state but not insert it into the tree. For
+      // example, we might beat a level but with one of the players
+      // dead. In this case, Score()s might be forever small. So
+      // here we normalize against the single best score when
+      // computing AUC.
+      double best_score = best[0]->update_score;
+      double worst_kept_score = best[0]->update_score;
+      for (const Node *n : best) {
+	best_score = std::max(best_score, n->update_score);
+	worst_kept_score = std::min(worst_kept_score, n->update_score);
+      }
+      // Predivided normalization factor.
+      const double one_over_best_score =
+	best_score <= 0.0 ? 0.0 : (1.0 / best_score);
+      double auc = 0.0;
+      for (Node *n : nodes) n->keep = false;
+      for (Node *n : best) {
+	auc += n->update_score * one_over_best_score;
+	n->keep = true;
+      }
 
-	// We popped off the best nodes, so now the heap only contains
-	// nodes we'll probably delete.
-	tree->heap.Clear();
+      stuckness = auc * (1.0 / MAX_NODES);
+      printf("\n ... auc %.2f; stuckness %.4f\n", auc, stuckness);
+      printf("\n ... kept nodes range in score from %.4f to %.4f\n",
+	     worst_kept_score, best_score);
+    }
+
+    {
+      worker->SetStatus("Tree: Swap in");
+      PERF_WRITE_LOCK(PE_L_UPDATE_TREE_C, &search->tree_m);
+
+      // Include the nodes that were added since the snapshot. Their
+      // scores in the heap are already current, and we keep them
+      // all, since they weren't considered for trimming.
+      tree->record_new_nodes = false;
+      for (Node *n : tree->new_nodes) {
+	n->update_score = -tree->heap.GetCell(n).priority;
+	n->keep = true;
+	int cell = 0;
+	if (search->problem->GetGridCell(n->state, &cell))
+	  AddToNewGrid(cell, n);
+	nodes.push_back(n);
+      }
+      tree->new_nodes.clear();
+
+      for (Tree::GridCell &gc : tree->grid)
+	if (gc.node != nullptr) gc.node->used_in_grid--;
+      for (Tree::GridCell &gc : grid)
+	if (gc.node != nullptr) gc.node->used_in_grid++;
+      tree->grid.swap(grid);
+
+      tree->heap.Clear();
+      vector<Heap<double, Node>::Cell> heap_cells;
+      if (!trim) {
+	// Note negation of score so that bigger real scores
+	// are more minimum for the heap ordering.
+	heap_cells.reserve(nodes.size());
+	for (Node *n : nodes)
+	  heap_cells.push_back({-n->update_score, n});
+	tree->heap.Build(std::move(heap_cells));
+      } else {
+	tree->stuckness = stuckness;
 
 	// Now make a pass over the tree and clean out nodes where we
 	// can. This loop also computes the new maximum depth.
@@ -542,7 +676,7 @@ struct WorkThread {
 	std::function<bool(Node *)> CleanRec =
 	  // Returns true if we should keep this node; otherwise,
 	  // the node is deleted.
-	  [this, tree, &max_depth, &deleted_nodes,
+	  [tree, &max_depth, &deleted_nodes, &heap_cells,
 	   &kept_score, &kept_worker, &kept_parent, &kept_grid,
 	   &CleanRec](Node *n) -> bool {
 	  if (n->keep)
@@ -572,14 +706,8 @@ struct WorkThread {
 	  
 	  if (keep) {
 	    max_depth = std::max(n->depth, max_depth);
-	    // PERF: We have to recompute the score AGAIN here;
-	    // particularly for nodes we're keeping because a worker
-	    // is using it. We just cleared the entire heap so we
-	    // don't even have its score.
-	    const double new_score = search->problem->Score(n->state);
-	    tree->heap.Insert(-new_score, n);
+	    heap_cells.push_back({-n->update_score, n});
 	    n->keep = false;
-	    CHECK(n->location != -1);
 	  } else {
 	    deleted_nodes++;
 	    tree->num_nodes--;
@@ -595,6 +723,7 @@ struct WorkThread {
 	// the root!
 	CHECK(CleanRec(tree->root)) << "Uh, the root was deleted.";
 
+	tree->heap.Build(std::move(heap_cells));
 	tree->max_depth = max_depth;
 	
 	printf(" ... Reasons for keeping nodes:\n"
@@ -607,7 +736,7 @@ struct WorkThread {
 	printf(" ... Deleted %llu; now the tree is size %llu.\n"
 	       " ... Max depth is %d.\n",
 	       deleted_nodes,
-	       tree->num_nodes,
+	       tree->num_nodes.load(),
 	       max_depth);
 
 	// Now, find some nodes for exploration.
@@ -641,7 +770,8 @@ struct WorkThread {
 	  
 	  // Prioritize using existing cells if we have them.
 	  vector<int> goodcells;
-	  EligibleGridNodesWithMutex(&goodcells);
+	  EligibleGridNodesWithMutex(-tree->heap.GetMinimum().priority,
+				     &goodcells);
 	  set<int> isgood;
 	  for (int c : goodcells) isgood.insert(c);
 
@@ -686,7 +816,7 @@ struct WorkThread {
 	    // XXX I think it would be better if we required the
 	    // score to be close to the max score, because otherwise
 	    // there's basically no chance of this helping.
-	    Node *source = FindGoodNodeWithMutex();
+	    Node *source = FindGoodNode();
 	    Problem::Goal goal = search->problem->RandomGoal(&rc);
 	    // printf("Explore random (goal %d,%d)\n", goal.goalx, goal.goaly);
 	    AddExploreNode(source, goal);
@@ -699,14 +829,10 @@ struct WorkThread {
     }
 
 
-    {
-      // MutexLock ml(&search->tree_m);
-      PERF_MUTEX_LOCK(PE_L_UPDATE_TREE_D, &search->tree_m);
-      tree->update_in_progress = false;
-    }
+    tree->update_in_progress = false;
   }
 
-  // Holding the tree mutex, find any explore node in the explore
+  // Holding tree_m and explore_m, find any explore node in the explore
   // queue, increment its reference count, and return a pointer to
   // it. The pointer stays valid even if the lock is relinquished,
   // since the reference count is nonzero. Returns nullptr if none
@@ -737,8 +863,8 @@ struct WorkThread {
     Problem::State start_state;
     double start_dist = -1.0;
     {
-      // MutexLock ml(&search->tree_m);
-      PERF_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_A, &search->tree_m);
+      PERF_READ_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_A, &search->tree_m);
+      PERF_MUTEX_LOCK(PE_L_EXPLORE, &search->tree->explore_m);
       en = GetExploreNodeWithMutex();
       if (en == nullptr) return false;
       // I should have a lock.
@@ -820,8 +946,8 @@ struct WorkThread {
 	// At some point, we got closer to the goal. Put this in
 	// the ExploreNode if it is still an improvement (might have
 	// lost a race).
-	// MutexLock ml(&search->tree_m);
-	PERF_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_B, &search->tree_m);
+	PERF_READ_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_B, &search->tree_m);
+	PERF_MUTEX_LOCK(PE_L_EXPLORE, &search->tree->explore_m);
 	
 	if (best_distance < en->distance) {
 	  en->distance = best_distance;
@@ -853,15 +979,22 @@ struct WorkThread {
 	// keep saving in that loop...
 	Problem::State newstate = worker->Save();
 	double score = search->problem->Score(newstate);
+	// If it's a duplicate, the existing node keeps its goal, and
+	// there's no need to make (and spill) a new one.
+	bool dupe = false;
 	{
-	  // MutexLock ml(&search->tree_m);
-	  PERF_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_C, &search->tree_m);
-	  Node *child =
-	    ExtendNodeWithLock(en->source, full_seq,
-			       std::move(newstate), score);
+	  PERF_READ_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_C, &search->tree_m);
+	  dupe = FindChild(en->source, full_seq) != nullptr;
+	}
+	if (dupe) search->stats.same_expansion.Increment();
+	if (!dupe) {
+	  PERF_READ_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_C, &search->tree_m);
+	  Node *child = NewNode(std::move(newstate), en->source);
 	  // XXX: This is TPP specific.
 	  child->goalx = en->goal.goalx;
 	  child->goaly = en->goal.goaly;
+	  if (InsertChild(en->source, full_seq, child, score) != child)
+	    delete child;
 	}
       }
     }
@@ -869,8 +1002,8 @@ struct WorkThread {
     // Finally, reduce the iteration count, and maybe clean up the
     // ExploreNode.
     {
-      // MutexLock ml(&search->tree_m);
-      PERF_MUTEX_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_D, &search->tree_m);
+      PERF_READ_LOCK(PE_L_PROCESS_EXPLORE_QUEUE_D, &search->tree_m);
+      PERF_MUTEX_LOCK(PE_L_EXPLORE, &search->tree->explore_m);
       CHECK(en->iterations_in_progress > 0);
       en->iterations_in_progress--;
       en->bad += num_bad;
@@ -1086,9 +1219,9 @@ private:
 TreeSearch::TreeSearch(Options opt) : opt(opt) {
   CHECK_GT(opt.num_nexts, 0) << "Allowed range";
   
-  map<string, string> config = Util::ReadFileToMap("config.txt");
+  map<string, string> config = Util::ReadFileToMap(opt.config_file);
   if (config.empty()) {
-    fprintf(stderr, "Missing config.txt.\n");
+    fprintf(stderr, "Missing %s.\n", opt.config_file.c_str());
     abort();
   }
 
@@ -1099,6 +1232,50 @@ TreeSearch::TreeSearch(Options opt) : opt(opt) {
   }
 
   problem.reset(new Problem(config));
+
+  if (ContainsKey(config, "node-budget")) {
+    node_budget = atoll(config["node-budget"].c_str());
+    CHECK(node_budget > 0) << "In config, 'node-budget' should be >0.";
+  }
+
+  // Optional persistence; see SaveCheckpoint.
+  checkpoint_file = GetDefault(config, "checkpoint", "");
+  string resume_file;
+  if (!checkpoint_file.empty()) {
+    if (Util::ExistsFile(checkpoint_file)) {
+      resume_file = checkpoint_file;
+    } else if (Util::ExistsFile(checkpoint_file + ".tmp")) {
+      // Interrupted while replacing the checkpoint (MoveFileEx isn't
+      // guaranteed to be atomic), so the new one is still under the
+      // temporary name. (Or while writing the very first one, in
+      // which case it's incomplete and loading will fail.)
+      resume_file = checkpoint_file + ".tmp";
+      printf("Checkpoint %s is missing, but %s exists.\n",
+	     checkpoint_file.c_str(), resume_file.c_str());
+    }
+  }
+  const bool resume = !resume_file.empty();
+  const string node_store_file = GetDefault(config, "nodestore", "");
+  if (!node_store_file.empty()) {
+    const int64 cache_mb =
+      atoll(GetDefault(config, "nodestore-cache-mb", "256").c_str());
+    // Only keep the old contents if the checkpoint may refer to them.
+    // But if there's no checkpoint, the node store may still be
+    // valuable (the checkpoint was misplaced, or the config is
+    // wrong), so only start over if that's explicitly requested.
+    const bool truncate = !resume;
+    if (truncate && Util::ExistsFile(node_store_file)) {
+      CHECK(atoi(GetDefault(config, "nodestore-truncate", "0").c_str()))
+	<< "Node store " << node_store_file << " exists, but there's no "
+	"checkpoint to resume from. To discard it and start over, delete "
+	"it or set nodestore-truncate 1 in the config.";
+    }
+    node_store.reset(new NodeStore(node_store_file, truncate,
+				   cache_mb * 1024LL * 1024LL));
+    problem->SetNodeStore(node_store.get());
+  }
+
+  if (resume) LoadCheckpoint(resume_file);
 }
 
 vector<Worker *> TreeSearch::WorkersWithLock() const {
@@ -1112,7 +1289,7 @@ vector<Worker *> TreeSearch::WorkersWithLock() const {
 
 void TreeSearch::StartThreads() {
   // Maybe this should be locked separately?
-  MutexLock ml(&tree_m);
+  TreeWriteLock ml(tree_m);
   CHECK(workers.empty());
   CHECK(num_workers > 0);
   workers.reserve(num_workers);
@@ -1142,7 +1319,7 @@ void TreeSearch::SetApproximateNesFrames(int64 nes_frames) {
 
 string TreeSearch::SaveBestMovie(const string &filename) {
   Printf("Saving best.\n");
-  MutexLock ml(&tree_m);
+  TreeWriteLock ml(tree_m);
   auto best = tree->heap.GetByIndex(0);
 
   // Each segment of the solution, along with a subtitle for
@@ -1197,6 +1374,216 @@ string TreeSearch::SaveBestMovie(const string &filename) {
 			       "generated by pftwo");
 }
 
+// Change this whenever the format changes.
+static constexpr char CHECKPOINT_MAGIC[] = "pftwo checkpoint 2";
+
+void TreeSearch::SaveCheckpoint() {
+  if (checkpoint_file.empty()) return;
+
+  // What can change in the tree is copied with tree_m held
+  // exclusively, so that this is a consistent snapshot. The rest,
+  // notably the states (which can be large), doesn't change once a
+  // node is in the tree, so it's encoded after releasing the lock.
+  // Until then the nodes are pinned with num_workers_using, so that
+  // the update can't delete them. The sequences are copied, since
+  // the update rebuilds the children maps.
+  struct NodeCopy {
+    Tree::Node *node = nullptr;
+    int64 parent = -1LL;
+    Tree::Seq seq;
+    int chosen = 0, was_loss = 0;
+    double priority = 0.0;
+  };
+  vector<NodeCopy> order;
+  vector<std::pair<int64, double>> grid;
+  double stuckness = 0.0;
+  int max_depth = 0;
+  {
+    Printf("Checkpoint...\n");
+    TreeWriteLock ml(tree_m);
+    if (tree == nullptr) return;
+
+    // Spilled states refer to the node store, so its contents need
+    // to be on disk before the checkpoint is.
+    if (node_store.get() != nullptr) node_store->Flush();
+
+    // Nodes in preorder, so that parents come before their children,
+    // referring to their parent by index.
+    std::unordered_map<const Tree::Node *, int64> index;
+    vector<std::pair<Tree::Node *, const Tree::Seq *>> stack =
+      {{tree->root, nullptr}};
+    while (!stack.empty()) {
+      auto p = stack.back();
+      stack.pop_back();
+      Tree::Node *n = p.first;
+      index[n] = order.size();
+      order.emplace_back();
+      NodeCopy *nc = &order.back();
+      nc->node = n;
+      nc->parent = n->parent == nullptr ? -1LL : index[n->parent];
+      if (p.second != nullptr) nc->seq = *p.second;
+      nc->chosen = n->chosen.load();
+      nc->was_loss = n->was_loss.load();
+      nc->priority = tree->heap.GetCell(n).priority;
+      n->num_workers_using++;
+      for (const auto &child : n->children)
+	stack.push_back({child.second, &child.first});
+    }
+
+    grid.reserve(tree->grid.size());
+    for (const Tree::GridCell &gc : tree->grid)
+      grid.emplace_back(gc.node == nullptr ? -1LL : index[gc.node],
+			gc.score);
+
+    stuckness = tree->stuckness;
+    max_depth = tree->max_depth;
+
+    // Only the tree's states are needed from the node store. (Other
+    // copies, like explore nodes' start states, are of the tree's, or
+    // are not spilled.) New records are added with tree_m held, so
+    // this sees every one either in the tree or already dead.
+    if (node_store.get() != nullptr) {
+      vector<int64> live;
+      live.reserve(order.size());
+      for (const NodeCopy &nc : order)
+	if (nc.node->state.save_handle >= 0)
+	  live.push_back(nc.node->state.save_handle);
+      node_store->StartCompaction(live);
+    }
+  }
+
+  vector<uint8> bytes;
+  ByteWriter w(&bytes);
+  w.String(CHECKPOINT_MAGIC);
+  const int64 num_nodes = order.size();
+  w.I64(num_nodes);
+  for (const NodeCopy &nc : order) {
+    const Tree::Node *n = nc.node;
+    w.I64(nc.parent);
+    w.U32(nc.seq.size());
+    for (const Problem::Input input : nc.seq) {
+      w.U8(input.p1);
+      w.U8(input.p2);
+    }
+    problem->WriteState(n->state, &w);
+    w.I64(n->nes_frames);
+    w.I64(n->walltime_seconds);
+    w.I64(n->goalx);
+    w.I64(n->goaly);
+    w.U32(nc.chosen);
+    w.U32(nc.was_loss);
+    w.Double(nc.priority);
+  }
+
+  w.U32(grid.size());
+  for (const auto &gc : grid) {
+    w.I64(gc.first);
+    w.Double(gc.second);
+  }
+
+  w.Double(stuckness);
+  w.U32(max_depth);
+  // (Protected by its own lock.)
+  w.Bytes(problem->SaveObservations());
+
+  {
+    TreeReadLock ml(tree_m);
+    for (const NodeCopy &nc : order) nc.node->num_workers_using--;
+  }
+
+  // The checkpoint can refer to either the old node store or the
+  // compacted one, since it only needs the live records. So replace
+  // the node store only once the new checkpoint is in place.
+  if (node_store.get() != nullptr) node_store->WriteCompaction();
+
+  // Write to a temporary file first and then replace the old
+  // checkpoint with it in one step, so that there's always a
+  // complete checkpoint on disk.
+  const string tmp = checkpoint_file + ".tmp";
+  CHECK(Util::WriteFileBytes(tmp, bytes)) << tmp;
+  #ifdef __MINGW32__
+  // Windows rename fails if the destination exists.
+  CHECK(MoveFileEx(tmp.c_str(), checkpoint_file.c_str(),
+		   MOVEFILE_REPLACE_EXISTING)) << tmp;
+  #else
+  CHECK(0 == rename(tmp.c_str(), checkpoint_file.c_str())) << tmp;
+  #endif
+  if (node_store.get() != nullptr) node_store->FinishCompaction();
+  Printf("Wrote checkpoint %s (%lld nodes, %.2f MB).\n",
+	 checkpoint_file.c_str(), num_nodes,
+	 bytes.size() / (1024.0 * 1024.0));
+}
+
+void TreeSearch::LoadCheckpoint(const string &filename) {
+  printf("Resuming from checkpoint %s...\n", filename.c_str());
+  const vector<uint8> bytes = Util::ReadFileBytes(filename);
+  ByteReader r(bytes);
+  CHECK(r.String() == CHECKPOINT_MAGIC) << filename
+    << " is not a checkpoint, or is from a different version.";
+
+  CHECK(tree == nullptr);
+  const int64 num_nodes = r.I64();
+  CHECK(num_nodes > 0) << filename;
+  vector<Tree::Node *> nodes;
+  nodes.reserve(num_nodes);
+  vector<Heap<double, Tree::Node>::Cell> heap_cells;
+  heap_cells.reserve(num_nodes);
+  for (int64 i = 0; i < num_nodes; i++) {
+    const int64 parent = r.I64();
+    CHECK(parent < i) << "Parents come first.";
+    Tree::Seq seq(r.U32());
+    for (Problem::Input &input : seq) {
+      input.p1 = r.U8();
+      input.p2 = r.U8();
+    }
+    Problem::State state = problem->ReadState(&r);
+
+    Tree::Node *n = nullptr;
+    if (parent < 0) {
+      CHECK(i == 0) << "Only the first node is the root.";
+      // Its heap priority is set below.
+      tree = new Tree(0.0, std::move(state));
+      n = tree->root;
+    } else {
+      n = new Tree::Node(std::move(state), nodes[parent]);
+      CHECK(nodes[parent]->children.insert({seq, n}).second)
+	<< "Duplicate child in checkpoint";
+    }
+    n->nes_frames = r.I64();
+    n->walltime_seconds = r.I64();
+    n->goalx = r.I64();
+    n->goaly = r.I64();
+    n->chosen = r.U32();
+    n->was_loss = r.U32();
+    heap_cells.push_back({r.Double(), n});
+    nodes.push_back(n);
+  }
+  tree->heap.Build(std::move(heap_cells));
+
+  CHECK(r.U32() == tree->grid.size()) << "Different grid size?";
+  for (Tree::GridCell &gc : tree->grid) {
+    const int64 idx = r.I64();
+    const double score = r.Double();
+    if (idx >= 0) {
+      CHECK(idx < num_nodes);
+      gc.node = nodes[idx];
+      gc.score = score;
+      gc.node->used_in_grid++;
+    }
+  }
+
+  tree->stuckness = r.Double();
+  tree->max_depth = r.U32();
+  problem->LoadObservations(r.Bytes());
+  CHECK(r.Done()) << "Extra bytes at the end of " << filename;
+
+  // As in a new tree, this doesn't count the root.
+  tree->num_nodes = num_nodes - 1;
+  tree->node_budget = node_budget;
+  printf("Resumed with %lld nodes, max depth %d.\n",
+	 num_nodes, tree->max_depth);
+}
+
 void TreeSearch::PrintPerfCounters() {
   vector<int64> totals;
   int64 total_denom = 0LL;
@@ -1207,7 +1594,7 @@ void TreeSearch::PrintPerfCounters() {
   QueryPerformanceFrequency((LARGE_INTEGER*)&freq);
   
   {
-    MutexLock ml(&tree_m);
+    TreeReadLock ml(tree_m);
     for (WorkThread *w : workers) {
       total_denom += w->PerfGetTotal();
       for (int i = 0; i < NUM_PERFEVENTS; i++) {
@@ -1222,6 +1609,57 @@ void TreeSearch::PrintPerfCounters() {
 	   (double)totals[i] / (double)freq,
 	   (100.0 * totals[i]) / (double)total_denom,
 	   PerfEventString((PerfEvent)i));
+
+  if (Emulator::HasPerfCounters()) {
+    // Summed over the workers' emulators. Each worker's lock keeps
+    // us from reading its counters mid-step.
+    vector<Worker *> ws;
+    {
+      TreeReadLock ml(tree_m);
+      for (WorkThread *w : workers) ws.push_back(w->GetWorker());
+    }
+    PerfCounters pc;
+    int64 handler_reads = 0LL, handler_writes = 0LL;
+    for (Worker *w : ws) {
+      MutexLock ml(&w->mutex);
+      const PerfCounters one = w->emu->GetPerfCounters();
+      pc.frames += one.frames;
+      pc.instructions += one.instructions;
+      pc.irqs += one.irqs;
+      pc.nmis += one.nmis;
+      pc.dma_cycles += one.dma_cycles;
+      pc.ppu_lines += one.ppu_lines;
+      pc.mapper_cpu_hooks += one.mapper_cpu_hooks;
+      pc.mapper_scanline_hooks += one.mapper_scanline_hooks;
+      for (int p = 0; p < 256; p++) {
+	pc.handler_reads[p] += one.handler_reads[p];
+	pc.handler_writes[p] += one.handler_writes[p];
+	handler_reads += one.handler_reads[p];
+	handler_writes += one.handler_writes[p];
+      }
+    }
+
+    const double frames = std::max(pc.frames, (int64)1);
+    printf("Emulator (%lld frames; per frame):\n", pc.frames);
+    printf("%.1f\tinstructions\n", pc.instructions / frames);
+    printf("%.1f\tppu lines\n", pc.ppu_lines / frames);
+    printf("%.3f\tirqs\n", pc.irqs / frames);
+    printf("%.3f\tnmis\n", pc.nmis / frames);
+    printf("%.1f\tdma cycles\n", pc.dma_cycles / frames);
+    printf("%.1f\tmapper cpu hooks\n", pc.mapper_cpu_hooks / frames);
+    printf("%.1f\tmapper scanline hooks\n",
+	   pc.mapper_scanline_hooks / frames);
+    printf("%.1f\thandler reads\n", handler_reads / frames);
+    printf("%.1f\thandler writes\n", handler_writes / frames);
+    // Just the busiest pages.
+    for (int p = 0; p < 256; p++) {
+      const int64 n = pc.handler_reads[p] + pc.handler_writes[p];
+      if (n / frames >= 1.0) {
+	printf("  $%02xxx\t%.1f reads\t%.1f writes\n", p,
+	       pc.handler_reads[p] / frames, pc.handler_writes[p] / frames);
+      }
+    }
+  }
   printf("\n");
   fflush(stdout);
 }
@@ -7,6 +7,9 @@
 #include <set>
 #include <memory>
 #include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
 
 #ifdef __MINGW32__
 #include <windows.h>
@@ -31,6 +34,7 @@
 
 #include "weighted-objectives.h"
 #include "problem-twoplayer.h"
+#include "node-store.h"
 
 // Base "max" nodes in heap. We start cleaning the heap when there are
 // more than this number of nodes, although we often have to keep more
@@ -60,6 +64,17 @@ struct WorkThread;
 // In addition to this tree of nodes, the "tree" also contains
 // a queue of nodes for explicit exploration. It also contains
 // a heap for prioritizing the next nodes to expand.
+//
+// Locking: Everything here is protected by TreeSearch::tree_m, a
+// reader-writer lock. Workers finding and extending nodes only hold
+// it shared, so that they can proceed in parallel; this guarantees
+// that no node is deleted or reparented and no heap is rebuilt out
+// from under them. Within that, the individual parts of the tree
+// have their own locks (below), always acquired in the order
+// explore_m, Node::children_m, heap_m, grid_m. Anything that
+// restructures or walks the whole tree (the periodic update,
+// saving, the UI's tree statistics) holds tree_m exclusively, and
+// then doesn't need the finer locks.
 struct Tree {
   using State = Problem::State;
   using Seq = vector<Problem::Input>;
@@ -85,7 +100,9 @@ struct Tree {
     
     // Child nodes. Currently, no guarantee that these don't
     // share prefixes, but there cannot be duplicates.
+    // Protected by children_m.
     map<Seq, Node *> children;
+    std::mutex children_m;
 
     // Benchmark info for this node, only used for movie output. This
     // makes it possible to compare the efficiency of progress (both
@@ -101,34 +118,39 @@ struct Tree {
     // Total number of times chosen for expansion. This will
     // be related to the number of children, but can be more
     // in the case that the tree is pruned or children collide.
-    int chosen = 0;
+    std::atomic<int> chosen{0};
 
     // Number of times that expansion yielded a loss on the
     // objective function. Used to compute the chance that
     // a node is hopeless. (XXX But we don't actually use
     // this to compute anything yet.)
-    int was_loss = 0;
+    std::atomic<int> was_loss{0};
 
-    // For heap. By invariant, all nodes are in the heap (but this
-    // will be temporarily violated during insertion/deletion).
+    // For heap; protected by heap_m. By invariant, all nodes are in
+    // the heap (but this will be temporarily violated during
+    // insertion/deletion).
     int location = -1;
 
     // Reference count. This also includes outstanding explore nodes
     // sourced from this node. When zero (and the lock not held), the
-    // node can be garbage collected.
-    int num_workers_using = 0;
+    // node can be garbage collected. Can be modified holding tree_m
+    // shared, since collection only happens with it held exclusively.
+    std::atomic<int> num_workers_using{0};
 
     // Number of references from the grid, which also keeps nodes
-    // alive.
+    // alive. Protected by grid_m.
     int used_in_grid = 0;
     
-    // Should only be used inside the tree cleanup procedure. Marks
-    // nodes that should not be garbage collected because they are
-    // among the best.
+    // Should only be used inside the tree update procedure (which
+    // only one thread runs at a time). Marks nodes that should not
+    // be garbage collected because they are among the best, and
+    // holds the node's newly computed score.
     bool keep = false;
+    double update_score = 0.0;
   };
 
-  // Everything in ExploreNode also protected by the tree mutex.
+  // Everything in ExploreNode is protected by explore_m, except
+  // source and goal, which don't change once it's in the queue.
   struct ExploreNode {
     // Points to the tree Node that this exploration began from.
     // Sequences continue from that node, for example.
@@ -164,15 +186,25 @@ struct Tree {
     }
   }
 
-  // Must hold mutex.
+  // Must hold tree_m, or be the thread updating the tree.
   int64 MaxNodes() const {
-    return BASE_NODE_BUDGET + max_depth * NODE_BUDGET_BONUS_PER_DEPTH;
+    return node_budget + max_depth * NODE_BUDGET_BONUS_PER_DEPTH;
   }
+
+  // BASE_NODE_BUDGET, unless overridden in the config. Set when the
+  // tree is created.
+  int64 node_budget = BASE_NODE_BUDGET;
   
   // Tree prioritized by negation of score at current epoch. Negation
   // is used so that the minimum node is actually the node with the
-  // best score.
+  // best score. Protected by heap_m.
   Heap<double, Node> heap;
+  std::mutex heap_m;
+  // While the tree update is working on a snapshot of the heap,
+  // nodes inserted into the heap are also appended to new_nodes, so
+  // that it can account for them. Also protected by heap_m.
+  bool record_new_nodes = false;
+  vector<Node *> new_nodes;
 
   // In addition to the main heap, we keep a grid containing the best
   // node(s) matching some criteria, called the key. A canonical use
@@ -189,27 +221,31 @@ struct Tree {
     GridCell(double score, Node *node) : score(score), node(node) {}
   };
 
+  // Protected by grid_m.
   vector<GridCell> grid;
+  std::mutex grid_m;
   
   // If this has anything in it, we're in exploration mode.
+  // Protected by explore_m.
   std::list<ExploreNode> explore_queue;
+  std::mutex explore_m;
   // Stuckness estimate from the last reheap.
   double stuckness = 0.0;
   // The maximum depth of the tree.
   // We use this to increase the budget for the total size of
   // the tree, since we have to at least retain the path back
-  // to the root for the best node.
+  // to the root for the best node. Only changed by the update.
   int max_depth = 0;
   
   Node *root = nullptr;
   // Number of steps until we update reheap and thin the tree.
-  int steps_until_update = STEPS_TO_FIRST_UPDATE;
+  std::atomic<int> steps_until_update{STEPS_TO_FIRST_UPDATE};
   // If this is true, a thread is updating the tree. It does not
   // necessarily hold the lock, because some calculations can be
   // done without the tree (like sorting observations). If set,
   // another thread should avoid also beginning an update.
-  bool update_in_progress = false;
-  int64 num_nodes = 0;
+  std::atomic<bool> update_in_progress{false};
+  std::atomic<int64> num_nodes{0};
 };
 
 struct TreeSearch {
@@ -232,6 +268,10 @@ struct TreeSearch {
     // Due to threading, the process is inherently random.
     // But this explicitly seeds it to get better randomness.
     int random_seed = 0;
+
+    // Read at startup. Relative paths in it (the game, movie,
+    // checkpoint, etc.) are relative to the working directory.
+    string config_file = "config.txt";
   };
 
   TreeSearch(Options options);
@@ -239,8 +279,11 @@ struct TreeSearch {
   // Initialized by one of the workers with the post-warmup
   // state.
   Tree *tree = nullptr;
-  // Coarse locking.
-  std::mutex tree_m;
+  // Protects the tree (see the comment there) and the set of
+  // workers. Hold it with TreeReadLock or TreeWriteLock.
+  std::shared_mutex tree_m;
+  using TreeReadLock = std::shared_lock<std::shared_mutex>;
+  using TreeWriteLock = std::unique_lock<std::shared_mutex>;
 
   // The UI thread must periodically call these for the benchmark
   // metrics to be correct in the output FM2s.
@@ -265,19 +308,47 @@ struct TreeSearch {
 
   // Returns the actual file written.
   string SaveBestMovie(const string &filename_part);
+
+  // If the config has a "checkpoint" file, write the tree to it: its
+  // topology, node states and statistics, the heap priorities, the
+  // grid, and the problem's observations. The tree lock is held
+  // exclusively only while the parts that can change are copied
+  // (the explore queue is not saved); the states are encoded and the
+  // file is written after releasing it. If the
+  // checkpoint file exists at startup, the search resumes from it,
+  // with the same heap and grid.
+  //
+  // With "nodestore" in the config, nodes' savestates are kept in
+  // that file rather than in memory, and the checkpoint refers to
+  // them there; keep the two files together. Each checkpoint also
+  // compacts the node store, dropping the savestates of nodes that
+  // have since been deleted from the tree. An existing node store
+  // without a checkpoint is an error, unless the config also says
+  // "nodestore-truncate 1".
+  void SaveCheckpoint();
   
   // Not holding the lock.
   void StartThreads();
   void DestroyThreads();
 
   // For UI thread; returns the current workers.
-  // Should hold the lock or ensure the number of workers
-  // is not changed.
+  // Should hold the lock (shared is enough) or ensure the number
+  // of workers is not changed.
   vector<Worker *> WorkersWithLock() const;
   
  private:
   friend struct WorkThread;
+  // In the constructor, before any threads are started. The file is
+  // normally checkpoint_file.
+  void LoadCheckpoint(const string &filename);
+
   const Options opt;
+  // From the config. Empty if not checkpointing.
+  string checkpoint_file;
+  int64 node_budget = BASE_NODE_BUDGET;
+  // If non-null, the problem's node store.
+  std::unique_ptr<NodeStore> node_store;
+
   // Updated by the UI thread.
   std::atomic<int64> approx_sec{0LL};
   std::atomic<int64> approx_nes_frames{0LL};
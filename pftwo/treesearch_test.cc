@@ -0,0 +1,114 @@
+// Round trip through a checkpoint: grow a small tree, save it while
+// the workers are running and again after stopping them, resume from
+// it in a new TreeSearch, and check that that saves the same bytes
+// and that every node's state can still be restored.
+//
+// This needs a pftwo config and the game files it names, so run it
+// in the directory you'd run pftwo in:
+//   treesearch_test.exe [config.txt]
+// Its own checkpoint and node store are treesearch_test-*.
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../cc-lib/base/logging.h"
+#include "../cc-lib/util.h"
+
+#include "treesearch.h"
+
+using namespace std;
+
+static constexpr char CONFIG[] = "treesearch_test-config.txt";
+static constexpr char CHECKPOINT[] = "treesearch_test-ck.bin";
+static constexpr char NODESTORE[] = "treesearch_test-ns.bin";
+
+// Grow the tree to about this many nodes.
+static constexpr int64 NUM_NODES = 200LL;
+
+static void RemoveFiles() {
+  for (const string f : {(string)CHECKPOINT, (string)NODESTORE})
+    for (const string suffix : {"", ".tmp"})
+      (void)Util::remove(f + suffix);
+}
+
+// The base config, but with our own checkpoint and node store (with
+// a small cache, so that restoring reads the file).
+static void WriteConfig(const string &base) {
+  map<string, string> config = Util::ReadFileToMap(base);
+  CHECK(!config.empty()) << "Missing " << base;
+  config["workers"] = "2";
+  config["checkpoint"] = CHECKPOINT;
+  config["nodestore"] = NODESTORE;
+  config["nodestore-cache-mb"] = "1";
+  config.erase("nodestore-truncate");
+  string contents;
+  for (const auto &p : config)
+    contents += p.first + " " + p.second + "\n";
+  CHECK(Util::WriteFile(CONFIG, contents));
+}
+
+static int64 NumNodes(TreeSearch *search) {
+  TreeSearch::TreeReadLock ml(search->tree_m);
+  return search->tree == nullptr ? 0LL : search->tree->num_nodes.load();
+}
+
+static void WaitForNodes(TreeSearch *search, int64 n) {
+  while (NumNodes(search) < n)
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+int main(int argc, char **argv) {
+  WriteConfig(argc > 1 ? argv[1] : "config.txt");
+  RemoveFiles();
+
+  TreeSearch::Options opt;
+  opt.config_file = CONFIG;
+
+  vector<uint8> saved;
+  {
+    TreeSearch search{opt};
+    CHECK(search.tree == nullptr) << "Shouldn't have resumed.";
+    search.StartThreads();
+    WaitForNodes(&search, NUM_NODES / 2);
+    // While the workers are adding nodes.
+    search.SaveCheckpoint();
+    WaitForNodes(&search, NUM_NODES);
+    search.DestroyThreads();
+    search.SaveCheckpoint();
+    saved = Util::ReadFileBytes(CHECKPOINT);
+    CHECK(!saved.empty());
+  }
+
+  {
+    TreeSearch search{opt};
+    CHECK(search.tree != nullptr) << "Should have resumed.";
+    search.SaveCheckpoint();
+    CHECK(Util::ReadFileBytes(CHECKPOINT) == saved) << "Checkpoint "
+      "changed by loading and saving it again.";
+
+    // The states are in the (compacted) node store.
+    std::unique_ptr<Problem::Worker> worker{search.problem->CreateWorker()};
+    int64 restored = 0LL;
+    vector<const Tree::Node *> stack = {search.tree->root};
+    while (!stack.empty()) {
+      const Tree::Node *n = stack.back();
+      stack.pop_back();
+      worker->Restore(n->state);
+      CHECK(worker->Save().mem == n->state.mem) << restored;
+      restored++;
+      for (const auto &child : n->children) stack.push_back(child.second);
+    }
+    CHECK(restored == search.tree->num_nodes + 1) << restored;
+    printf("Restored %lld nodes.\n", restored);
+  }
+
+  RemoveFiles();
+  (void)Util::remove(CONFIG);
+  printf("OK\n");
+  return 0;
+}
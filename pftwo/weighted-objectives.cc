@@ -2,6 +2,7 @@
 #include "weighted-objectives.h"
 
 #include <algorithm>
+#include <memory>
 #include <set>
 #include <string>
 #include <iostream>
@@ -227,7 +228,7 @@ struct SampleObservations : public Observations {
     return (double)idx / values.size();
   }
   
-  void Accumulate(const vector<uint8> &memory) override {
+  void Accumulate(const uint8 *memory) override {
     MutexLock ml(&acc_mutex);
     for (int i = 0; i < wo.Size(); i++) {
       const pair<vector<int>, double> &obj = wo.Get(i);
@@ -300,7 +301,7 @@ struct SampleObservations : public Observations {
 	   accumulated, dropped, discarded, in_mem);
   }
 
-  vector<double> GetNormalizedValues(const vector<uint8> &mem) override {
+  vector<double> GetNormalizedValues(const uint8 *mem) override {
     vector<double> vals;
     vals.reserve(wo.Size());
     {
@@ -315,7 +316,7 @@ struct SampleObservations : public Observations {
     return vals;
   }
 
-  double GetNormalizedValue(const vector<uint8> &mem) override {
+  double GetNormalizedValue(const uint8 *mem) override {
     double sum = 0.0;
 
     {
@@ -331,7 +332,7 @@ struct SampleObservations : public Observations {
     return sum;
   }
 
-  double GetWeightedValue(const vector<uint8> &mem) override {
+  double GetWeightedValue(const uint8 *mem) override {
     double numer = 0.0;
     double total_weight = 0.0;
     
@@ -385,9 +386,10 @@ struct MixedBaseObservations : public Observations {
       // acc_maxbytes.push_back(vector<uint8>{obj.size(), 0});
     }
     obs_maxbytes = acc_maxbytes;
+    CompileWithLock();
   }
   
-  void Accumulate(const vector<uint8> &memory) override {
+  void Accumulate(const uint8 *memory) override {
     MutexLock ml(&acc_mutex);
     for (int i = 0; i < wo.Size(); i++) {
       const vector<int> &obj = wo.Get(i).first;
@@ -404,9 +406,69 @@ struct MixedBaseObservations : public Observations {
     MutexLock mlo(&obs_mutex);
     MutexLock mla(&acc_mutex);
     obs_maxbytes = acc_maxbytes;
+    CompileWithLock();
   }
 
-  vector<double> GetNormalizedValues(const vector<uint8> &mem) override {
+  // The weighted value is linear in the memory bytes. The value of
+  // byte j in an objective is its digit times the place value
+  // (product of the radices after it) over the largest representable
+  // number (product of all the radices); that simplifies to
+  // 1 / (product of the radices up to and including j). So with
+  // the weights folded in, the whole thing is just a sum of
+  // coefficient * mem[loc], which we compile here so that scoring
+  // doesn't have to walk the objectives. Computing the coefficient
+  // this way also doesn't overflow for long objectives.
+  struct Compiled {
+    // Parallel; sorted by location, which is distinct.
+    vector<uint16> locs;
+    vector<double> coefs;
+
+    inline double Value(const uint8 *mem) const {
+      const int num = locs.size();
+      const uint16 *l = locs.data();
+      const double *c = coefs.data();
+      double sum = 0.0;
+      for (int k = 0; k < num; k++)
+	sum += c[k] * mem[l[k]];
+      return sum;
+    }
+  };
+
+  // Must hold obs_mutex.
+  void CompileWithLock() {
+    double total_weight = 0.0;
+    for (int i = 0; i < wo.Size(); i++) {
+      CHECK(wo.Get(i).second >= 0.0);
+      total_weight += wo.Get(i).second;
+    }
+    CHECK(total_weight != 0);
+
+    // Summing the coefficients for locations that appear in multiple
+    // objectives.
+    vector<double> coef(2048, 0.0);
+    for (int i = 0; i < wo.Size(); i++) {
+      const vector<int> &obj = wo.Get(i).first;
+      const double weight = wo.Get(i).second / total_weight;
+      double radices = 1.0;
+      for (int j = 0; j < obj.size(); j++) {
+	CHECK(obj[j] >= 0 && obj[j] < 2048) << obj[j];
+	radices *= ((int)obs_maxbytes[i][j] + 1);
+	coef[obj[j]] += weight / radices;
+      }
+    }
+
+    std::shared_ptr<Compiled> c = std::make_shared<Compiled>();
+    for (int loc = 0; loc < 2048; loc++) {
+      if (coef[loc] != 0.0) {
+	c->locs.push_back(loc);
+	c->coefs.push_back(coef[loc]);
+      }
+    }
+    std::atomic_store(&compiled,
+		      std::shared_ptr<const Compiled>(std::move(c)));
+  }
+
+  vector<double> GetNormalizedValues(const uint8 *mem) override {
     vector<double> vals;
     vals.resize(wo.Size());
     {
@@ -451,7 +513,7 @@ struct MixedBaseObservations : public Observations {
 
   // PERF the following two could maybe be faster by inlining
   // the above (not creating the vectors).
-  double GetNormalizedValue(const vector<uint8> &mem) override {
+  double GetNormalizedValue(const uint8 *mem) override {
     double sum = 0.0;
     for (const double val : GetNormalizedValues(mem))
       sum += val;
@@ -460,28 +522,46 @@ struct MixedBaseObservations : public Observations {
     return sum;
   }
 
-  double GetWeightedValue(const vector<uint8> &mem) override {
-    double numer = 0.0;
-    double total_weight = 0.0;
+  // These score against the current snapshot without taking
+  // obs_mutex, so they don't wait on (or block) a Commit.
+  double GetWeightedValue(const uint8 *mem) override {
+    return std::atomic_load(&compiled)->Value(mem);
+  }
 
-    const vector<double> vals = GetNormalizedValues(mem);
-    CHECK(vals.size() > 0);
-    for (int i = 0; i < vals.size(); i++) {
-      const double weight = wo.Get(i).second;
-      CHECK(vals[i] >= 0.0);
-      CHECK(weight >= 0.0);
-      CHECK(!isnan(vals[i]));
-      numer += weight * vals[i];
-      total_weight += weight;
-    }
+  void GetWeightedValues(const uint8 *const *mems, int n,
+			 double *out) override {
+    const std::shared_ptr<const Compiled> c = std::atomic_load(&compiled);
+    for (int i = 0; i < n; i++)
+      out[i] = c->Value(mems[i]);
+  }
 
-    CHECK(!isnan(numer));
-    CHECK(!isnan(total_weight));
-    CHECK(total_weight != 0);
-    return numer / total_weight;
+  // The max bytes, committed then accumulated, in objective order.
+  vector<uint8> SaveState() override {
+    MutexLock mlo(&obs_mutex);
+    MutexLock mla(&acc_mutex);
+    vector<uint8> out;
+    for (const vector<uint8> &v : obs_maxbytes)
+      out.insert(out.end(), v.begin(), v.end());
+    for (const vector<uint8> &v : acc_maxbytes)
+      out.insert(out.end(), v.begin(), v.end());
+    return out;
+  }
+
+  void LoadState(const vector<uint8> &bytes) override {
+    MutexLock mlo(&obs_mutex);
+    MutexLock mla(&acc_mutex);
+    int pos = 0;
+    for (vector<vector<uint8>> *maxbytes : {&obs_maxbytes, &acc_maxbytes}) {
+      for (vector<uint8> &v : *maxbytes) {
+	CHECK(pos + v.size() <= bytes.size()) << "Objectives don't match?";
+	for (uint8 &b : v) b = bytes[pos++];
+      }
+    }
+    CHECK(pos == bytes.size()) << "Objectives don't match?";
+    CompileWithLock();
   }
 
-  virtual void VizText(const vector<uint8> &mem, vector<string> *text) {
+  virtual void VizText(const uint8 *mem, vector<string> *text) {
     double numer = 0.0;
     double total_weight = 0.0;
 
@@ -503,6 +583,10 @@ struct MixedBaseObservations : public Observations {
   }
   
   vector<vector<uint8>> obs_maxbytes, acc_maxbytes;
+  // Derived from obs_maxbytes by CompileWithLock, which replaces it
+  // (with std::atomic_store) rather than modifying it, so readers can
+  // keep using a snapshot. Never null.
+  std::shared_ptr<const Compiled> compiled;
   std::mutex obs_mutex, acc_mutex;
 };
 
@@ -511,6 +595,12 @@ struct MixedBaseObservations : public Observations {
 Observations::Observations(const WeightedObjectives &wo) : wo(wo) {}
 Observations::~Observations() {}
 
+void Observations::GetWeightedValues(const uint8 *const *memories, int n,
+				     double *out) {
+  for (int i = 0; i < n; i++)
+    out[i] = GetWeightedValue(memories[i]);
+}
+
 Observations *Observations::SampleObservations(const WeightedObjectives &wo,
 					       int max_samples) {
   return new ::SampleObservations(wo, max_samples);
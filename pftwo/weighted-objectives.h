@@ -45,7 +45,8 @@ struct WeightedObjectives {
     return weighted[i];
   }
 
-  static const vector<uint8> Value(const vector<uint8> &memory,
+  // Memory is 2048 bytes of RAM.
+  static const vector<uint8> Value(const uint8 *memory,
 				   const vector<int> &objective) {
     vector<uint8> ret;
     ret.resize(objective.size());
@@ -79,7 +80,10 @@ struct Observations {
   // since we thin this to keep a sample of the observed range. It's
   // more important to observe a *variety* of states.
   // Observing is a little expensive.
-  virtual void Accumulate(const vector<uint8> &memory) = 0;
+  //
+  // Here and below, memory is 2048 bytes of RAM; this allows scoring
+  // directly from an emulator save state (Emulator::SavedRAM).
+  virtual void Accumulate(const uint8 *memory) = 0;
 
   // Rebases values for GetNormalizedValue.
   virtual void Commit() = 0;
@@ -89,20 +93,34 @@ struct Observations {
   // function relative to the values we've observed and committed; 1 means
   // that this is the higest value we've ever seen for that objective.
   // Does not observe the memory.
-  virtual double GetNormalizedValue(const vector<uint8> &memory) = 0;
+  virtual double GetNormalizedValue(const uint8 *memory) = 0;
 
   // As GetNormalizedValue, but the weighted average of each fraction.
   // In [0, 1].
-  virtual double GetWeightedValue(const vector<uint8> &memory) = 0;
+  virtual double GetWeightedValue(const uint8 *memory) = 0;
+
+  // Same as GetWeightedValue for each of the n memories, writing the
+  // results to out[0..n-1]. Use this when scoring lots of states at
+  // once (e.g. rescoring the whole tree after a Commit); it takes any
+  // locks once and some strategies have a much faster batch loop.
+  // The default just calls GetWeightedValue.
+  virtual void GetWeightedValues(const uint8 *const *memories, int n,
+				 double *out);
   
   // As above, but rather than producing a single value for all objectives,
   // returns one value fraction per objective, in the same order they
   // appear within the WeightedObjectives object.
   // Weights are ignored. Does not observe the memory.
-  virtual vector<double> GetNormalizedValues(const vector<uint8> &memory) = 0;
+  virtual vector<double> GetNormalizedValues(const uint8 *memory) = 0;
 
   // Write some short strings into the text to describe the memory.
-  virtual void VizText(const vector<uint8> &mem, vector<string> *text) {}
+  virtual void VizText(const uint8 *mem, vector<string> *text) {}
+
+  // For checkpoints: Serialize the accumulated and committed
+  // observations, and restore them (with the same objectives). The
+  // default saves nothing, so observations start over on restore.
+  virtual vector<uint8> SaveState() { return {}; }
+  virtual void LoadState(const vector<uint8> &bytes) {}
   
   // Construct concrete instances with different strategies. Caller
   // owns the new-ly created object.